@@ -0,0 +1,281 @@
+#define _GNU_SOURCE // posix_memalign and MAP_ANONYMOUS under -std=c99
+
+#include "alloc.h"
+#include "numa.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Allocator for matrix data. Every request is rounded up to a size class and served with a
+ * 64-byte aligned block. Freed blocks are not returned to the system but pushed on the free
+ * list of their class, so the next matrix of a similar size reuses a block whose pages are
+ * already mapped. The free lists are LIFO, so the most recently freed (and most likely still
+ * cached) block goes out first. Once the cached blocks exceed the cache limit, the largest ones
+ * are released first.
+ *
+ * Size classes: everything up to 64 bytes is class 0; above that, each power of two 2^p is
+ * split into four classes of 2^p + {1, 2, 3, 4} * 2^(p - 2) bytes, so at most a fifth of a
+ * block is wasted.
+ *
+ * Blocks of at least NUMA_MIN_BYTES are mapped from the system directly rather than taken from
+ * malloc, so that a new one comes with zero pages nobody has touched yet (see numa.h). Blocks
+ * of at least huge_min_bytes whose size is a whole number of huge pages (every class from 8 MiB
+ * up) are also aligned to HUGE_PAGE_BYTES and asked to be backed by huge pages, so that a large
+ * matrix needs a TLB entry per 2 MiB instead of per 4 KiB; the strided walks down the columns
+ * of the multiplication otherwise miss the TLB on nearly every entry.
+ */
+#define NUM_CLASSES (4 * 58 + 1)
+
+/* Default for the cache limit, overridden by the NUMC_CACHE_BYTES environment variable */
+#define DEFAULT_CACHE_LIMIT ((size_t)1 << 30)
+
+/* Default for huge_min_bytes, overridden by NUMC_HUGE_BYTES; NUMC_HUGE_PAGES sets the mode */
+#define DEFAULT_HUGE_MIN_BYTES ((size_t)8 << 20)
+
+/* The huge_mode names NUMC_HUGE_PAGES takes, in the order of huge_mode */
+static const char *huge_mode_names[] = {"off", "transparent", "hugetlbfs"};
+
+/* A cached block; the link lives in the (otherwise unused) first bytes of the block */
+typedef struct free_block {
+    struct free_block *next;
+} free_block;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static free_block *free_lists[NUM_CLASSES];
+static alloc_stats stats;
+static int initialized = 0;
+
+/* Returns the index of the smallest size class holding `bytes` */
+static int size_class(size_t bytes) {
+    if (bytes <= 64) return 0;
+    int p = 63 - __builtin_clzll((unsigned long long)(bytes - 1));
+    size_t base = (size_t)1 << p;
+    size_t quarter = base >> 2;
+    int sub = (int)((bytes - base + quarter - 1) / quarter);
+    return (p - 6) * 4 + sub;
+}
+
+/* Returns the size in bytes of the blocks of size class `idx` */
+static size_t class_size(int idx) {
+    if (idx == 0) return 64;
+    int p = (idx - 1) / 4 + 6;
+    int sub = (idx - 1) % 4 + 1;
+    return ((size_t)1 << p) + sub * ((size_t)1 << (p - 2));
+}
+
+/*
+ * Maps `size` bytes, a whole number of huge pages, for huge pages in the given mode. Sets `huge`
+ * if the kernel accepted them; it may still back the block with normal pages where it has no
+ * huge ones free. Returns NULL if there is no memory.
+ */
+static void *huge_alloc(size_t size, huge_mode mode, int *huge) {
+    int prot = PROT_READ | PROT_WRITE, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+    if (mode == HUGE_HUGETLBFS) {
+        int page = MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        page |= 21 << MAP_HUGE_SHIFT; // 2 MiB pages, whatever the default size of the pool
+#endif
+        void *block = mmap(NULL, size, prot, flags | page, -1, 0);
+        if (block != MAP_FAILED) {
+            *huge = 1;
+            return block;
+        }
+    }
+#endif
+    /* Map a huge page more than needed and cut the block out at the first huge page boundary */
+    char *raw = (char *)mmap(NULL, size + HUGE_PAGE_BYTES, prot, flags, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    char *block = (char *)(((uintptr_t)raw + HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(HUGE_PAGE_BYTES - 1));
+    if (block > raw) munmap(raw, (size_t)(block - raw));
+    munmap(block + size, (size_t)(raw + HUGE_PAGE_BYTES - block));
+#ifdef MADV_HUGEPAGE
+    *huge = !madvise(block, size, MADV_HUGEPAGE);
+#endif
+    return block;
+}
+
+/*
+ * Gets a block of `size` bytes, a size class, from the system, with huge pages in the given
+ * mode if it is large enough. Sets `fresh` if its pages are known to be zero and untouched, and
+ * `huge` if it was mapped for huge pages. Returns NULL if there is no memory.
+ */
+static void *system_alloc(size_t size, size_t huge_min_bytes, huge_mode mode, int *fresh,
+                          int *huge) {
+    void *block = NULL;
+    *fresh = 0;
+    *huge = 0;
+    if (size < NUMA_MIN_BYTES) return posix_memalign(&block, ALLOC_ALIGNMENT, size) ? NULL : block;
+    if (mode != HUGE_OFF && size >= huge_min_bytes && size % HUGE_PAGE_BYTES == 0) {
+        block = huge_alloc(size, mode, huge);
+        if (block == NULL) return NULL;
+    } else {
+        block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) return NULL;
+    }
+    numa_place(block, size);
+    *fresh = 1;
+    return block;
+}
+
+/* Returns a block of `size` bytes from system_alloc to the system */
+static void system_free(void *block, size_t size) {
+    if (size < NUMA_MIN_BYTES) {
+        free(block);
+    } else {
+        munmap(block, size);
+    }
+}
+
+/* Reads the cache limit and the huge page settings from the environment. Called with the lock held. */
+static void init_locked(void) {
+    const char *limit = getenv("NUMC_CACHE_BYTES");
+    stats.cache_limit = limit != NULL ? strtoull(limit, NULL, 10) : DEFAULT_CACHE_LIMIT;
+    const char *huge_min = getenv("NUMC_HUGE_BYTES");
+    stats.huge_min_bytes = huge_min != NULL ? strtoull(huge_min, NULL, 10) : DEFAULT_HUGE_MIN_BYTES;
+    const char *mode = getenv("NUMC_HUGE_PAGES");
+    stats.huge = HUGE_TRANSPARENT;
+    for (int m = HUGE_OFF; mode != NULL && m <= HUGE_HUGETLBFS; m++) {
+        if (!strcmp(mode, huge_mode_names[m])) stats.huge = (huge_mode)m;
+    }
+    initialized = 1;
+}
+
+/*
+ * Releases cached blocks, largest first, until at most `keep` bytes are cached. Called with
+ * the lock held. Returns the number of bytes released.
+ */
+static size_t trim_locked(size_t keep) {
+    size_t released = 0;
+    for (int idx = NUM_CLASSES - 1; idx >= 0 && stats.bytes_cached > keep; idx--) {
+        while (free_lists[idx] != NULL && stats.bytes_cached > keep) {
+            free_block *block = free_lists[idx];
+            free_lists[idx] = block -> next;
+            system_free(block, class_size(idx));
+            stats.bytes_cached -= class_size(idx);
+            released += class_size(idx);
+        }
+    }
+    return released;
+}
+
+/*
+ * Returns a 64-byte aligned buffer for `n` doubles, or NULL if there is no memory. The buffer
+ * is zeroed only if `zero` is set, so callers that overwrite every entry anyway can skip it.
+ * Large reused blocks are zeroed by numa_zero, so their pages are touched the way the kernels
+ * will touch them.
+ */
+double *alloc_data(size_t n, int zero) {
+    if (n > (SIZE_MAX >> 1) / sizeof(double)) return NULL;
+    size_t bytes = n * sizeof(double);
+    int idx = size_class(bytes);
+    size_t size = class_size(idx);
+    void *block = NULL;
+    int fresh = 0, huge = 0;
+    pthread_mutex_lock(&lock);
+    if (!initialized) init_locked();
+    if (free_lists[idx] != NULL) {
+        block = free_lists[idx];
+        free_lists[idx] = free_lists[idx] -> next;
+        stats.bytes_cached -= size;
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    stats.bytes_live += size;
+    size_t huge_min_bytes = stats.huge_min_bytes;
+    huge_mode mode = stats.huge;
+    pthread_mutex_unlock(&lock);
+    if (block == NULL) {
+        block = system_alloc(size, huge_min_bytes, mode, &fresh, &huge);
+        pthread_mutex_lock(&lock);
+        if (block == NULL) stats.bytes_live -= size;
+        if (huge) stats.huge_mapped += size;
+        pthread_mutex_unlock(&lock);
+        if (block == NULL) return NULL;
+    }
+    if (zero && !fresh) {
+        if (size < NUMA_MIN_BYTES) {
+            memset(block, 0, bytes);
+        } else {
+            numa_zero(block, bytes);
+        }
+    }
+    STATS_ALLOC(size);
+    return (double *)block;
+}
+
+/* Gives back a buffer of `n` doubles returned by alloc_data. `data` may be NULL. */
+void free_data(double *data, size_t n) {
+    if (data == NULL) return;
+    int idx = size_class(n * sizeof(double));
+    size_t size = class_size(idx);
+    pthread_mutex_lock(&lock);
+    if (!initialized) init_locked();
+    stats.bytes_live -= size;
+    if (size <= stats.cache_limit) {
+        free_block *block = (free_block *)data;
+        block -> next = free_lists[idx];
+        free_lists[idx] = block;
+        stats.bytes_cached += size;
+        trim_locked(stats.cache_limit);
+    } else {
+        system_free(data, size);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Copies the current counters to `out` */
+void alloc_get_stats(alloc_stats *out) {
+    pthread_mutex_lock(&lock);
+    if (!initialized) init_locked();
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Releases every cached block to the system. Returns the number of bytes released. */
+size_t alloc_trim(void) {
+    pthread_mutex_lock(&lock);
+    size_t released = trim_locked(0);
+    pthread_mutex_unlock(&lock);
+    return released;
+}
+
+/*
+ * Maps blocks of at least `min_bytes` bytes for huge pages in the given mode from now on.
+ * Blocks already mapped keep their pages.
+ */
+void alloc_set_huge_pages(size_t min_bytes, huge_mode mode) {
+    pthread_mutex_lock(&lock);
+    if (!initialized) init_locked();
+    stats.huge_min_bytes = min_bytes;
+    stats.huge = mode;
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Returns the number of bytes of the process that the kernel actually backs with huge pages,
+ * transparent or from hugetlbfs, according to /proc/self/smaps_rollup, or -1 if the kernel
+ * has no such file. Matrix data is usually most of them.
+ */
+long long alloc_huge_resident(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == NULL) return -1;
+    char line[256];
+    long long total = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        long long kb;
+        if (sscanf(line, "AnonHugePages: %lld kB", &kb) == 1
+                || sscanf(line, "Shared_Hugetlb: %lld kB", &kb) == 1
+                || sscanf(line, "Private_Hugetlb: %lld kB", &kb) == 1) {
+            total += kb << 10;
+        }
+    }
+    fclose(f);
+    return total;
+}
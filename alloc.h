@@ -0,0 +1,38 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/* Alignment of every buffer handed out by alloc_data, a cache line */
+#define ALLOC_ALIGNMENT 64
+
+/* Size of a huge page, and the alignment of blocks that may get them */
+#define HUGE_PAGE_BYTES ((size_t)2 << 20)
+
+/* How blocks of at least huge_min_bytes are backed, see alloc_set_huge_pages */
+typedef enum huge_mode {
+    HUGE_OFF, // normal pages
+    HUGE_TRANSPARENT, // the default: mappings aligned to huge pages and advised with MADV_HUGEPAGE
+    HUGE_HUGETLBFS // pages reserved in the hugetlbfs pool, HUGE_TRANSPARENT once the pool runs out
+} huge_mode;
+
+/* Counters and settings of the data allocator, see alloc_get_stats */
+typedef struct alloc_stats {
+    size_t bytes_live; // bytes currently handed out to matrices and scratch buffers
+    size_t bytes_cached; // bytes of freed blocks kept for reuse
+    size_t cache_limit; // bytes_cached is trimmed to stay below this
+    size_t hits; // allocations served from the cache
+    size_t misses; // allocations that had to go to the system
+    size_t huge_min_bytes; // blocks of at least this many bytes are mapped for huge pages
+    huge_mode huge; // how those blocks get their huge pages
+    size_t huge_mapped; // bytes of all the blocks mapped for huge pages so far
+} alloc_stats;
+
+double *alloc_data(size_t n, int zero);
+void free_data(double *data, size_t n);
+void alloc_get_stats(alloc_stats *stats);
+size_t alloc_trim(void);
+void alloc_set_huge_pages(size_t min_bytes, huge_mode mode);
+long long alloc_huge_resident(void);
+
+#endif
@@ -0,0 +1,359 @@
+#include "matrix.h" // Python.h first, which asks for POSIX 2008: clock_gettime and setenv
+#include "kernels.h"
+#include "threading.h"
+#include "pool.h"
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Microbenchmark driver for the kernels of matrix.c, built by `make bench`. It first measures
+ * the two ceilings of the roofline model on this machine, for every kernel variant and thread
+ * count: the peak rate of the GEMM micro kernel on operands in L1, and the bandwidth of memcpy
+ * on buffers far larger than the caches. It then times the operations over a sweep of shapes
+ * (square, skinny, fat, and odd sizes that leave remainders in every vector loop), thread
+ * counts and kernel variants, and prints everything as one JSON document on stdout. Each
+ * result carries its arithmetic intensity and the ceiling the roofline puts on it, so it can
+ * be read as a fraction of what the hardware allows.
+ *
+ * Options: -q runs a quick sweep of small shapes, -k NAME only runs that kernel variant,
+ * -t N,N,... sets the thread counts (default 1, 2, 4, ... up to the number of cores, which is
+ * also the most a count can be) and -r N sets the minimum number of timed repetitions.
+ */
+
+/* Every case is repeated until it has run for MIN_SECONDS or MAX_REPS times, but at least -r times */
+#define MIN_SECONDS 0.3
+#define MAX_REPS 50
+#define MAX_THREAD_COUNTS 16
+
+/* Seconds each roofline ceiling is measured for */
+#define PEAK_SECONDS 0.2
+
+typedef enum bench_op { OP_ADD, OP_ABS, OP_MUL } bench_op;
+
+static const char *op_names[] = {"add", "abs", "mul"};
+
+/* One benchmarked shape: result is m x n, and k is the shared dimension of a product */
+typedef struct bench_case {
+    bench_op op;
+    int m, n, k;
+    const char *shape; // "square", "skinny", "fat" or "odd"
+} bench_case;
+
+static const bench_case full_cases[] = {
+    {OP_ADD, 64, 64, 0, "square"},
+    {OP_ADD, 1000, 1000, 0, "square"},
+    {OP_ADD, 4096, 4096, 0, "square"},
+    {OP_ADD, 1 << 20, 3, 0, "skinny"},
+    {OP_ADD, 3, 1 << 20, 0, "fat"},
+    {OP_ADD, 999, 1001, 0, "odd"},
+    {OP_ADD, 17, 4099, 0, "odd"},
+    {OP_ABS, 1000, 1000, 0, "square"},
+    {OP_ABS, 4096, 4096, 0, "square"},
+    {OP_ABS, 997, 1003, 0, "odd"},
+    {OP_MUL, 128, 128, 128, "square"},
+    {OP_MUL, 512, 512, 512, "square"},
+    {OP_MUL, 1024, 1024, 1024, "square"},
+    {OP_MUL, 2048, 2048, 16, "skinny"},
+    {OP_MUL, 32, 32, 8192, "fat"},
+    {OP_MUL, 1001, 1003, 997, "odd"},
+    {OP_MUL, 257, 255, 259, "odd"},
+};
+
+static const bench_case quick_cases[] = {
+    {OP_ADD, 256, 256, 0, "square"},
+    {OP_ADD, 1 << 16, 3, 0, "skinny"},
+    {OP_ADD, 3, 1 << 16, 0, "fat"},
+    {OP_ADD, 99, 101, 0, "odd"},
+    {OP_ABS, 97, 103, 0, "odd"},
+    {OP_MUL, 128, 128, 128, "square"},
+    {OP_MUL, 512, 512, 8, "skinny"},
+    {OP_MUL, 8, 8, 2048, "fat"},
+    {OP_MUL, 101, 103, 97, "odd"},
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Returns the `p`th percentile of the `n` sorted values in `v`, interpolating between neighbors */
+static double percentile(const double *v, int n, double p) {
+    double pos = p / 100 * (n - 1);
+    int lo = (int)pos;
+    int hi = lo + 1 < n ? lo + 1 : lo;
+    return v[lo] + (v[hi] - v[lo]) * (pos - lo);
+}
+
+/* Makes every kernel call use exactly `threads` threads, bypassing the cost model */
+static void force_threads(int threads) {
+    threading_config config = {threads, 0, 0, 0, -1};
+    set_threading(&config);
+}
+
+/* Selects the kernel variant `name`. Returns 0 if the CPU does not support it. */
+static int use_kernels(const char *name) {
+    setenv("NUMC_BACKEND", name, 1);
+    return strcmp(select_kernels() -> name, name) == 0;
+}
+
+/* ROOFLINE CEILINGS */
+
+/* Packed operands and result tile of one thread running the micro kernel */
+typedef struct peak_ctx {
+    const kernel_table *k;
+    double *buffers; // PEAK_KC * (mr + nr) + mr * nr doubles per slot
+    long calls; // micro kernel calls per slot
+} peak_ctx;
+
+/* Shared dimension of each micro kernel call, small enough for both slivers to stay in L1 */
+#define PEAK_KC 128
+
+static size_t peak_slot_doubles(const kernel_table *k) {
+    return (size_t)PEAK_KC * (k -> mr + k -> nr) + k -> mr * k -> nr;
+}
+
+static void peak_body(void *arg, long i, int slot) {
+    peak_ctx *ctx = (peak_ctx *)arg;
+    const kernel_table *k = ctx -> k;
+    double *ap = ctx -> buffers + (size_t)i * peak_slot_doubles(k);
+    double *bp = ap + (size_t)PEAK_KC * k -> mr;
+    double *c = bp + (size_t)PEAK_KC * k -> nr;
+    for (long call = 0; call < ctx -> calls; call++) {
+        k -> micro_kernel(PEAK_KC, ap, bp, c, k -> nr, k -> mr, k -> nr, 1.0, 1.0);
+    }
+}
+
+/* Returns the GFLOP/s of the micro kernel of `k` on `threads` threads, each on its own tile */
+static double measure_peak(const kernel_table *k, int threads) {
+    size_t per_slot = peak_slot_doubles(k);
+    double *buffers = alloc_data(per_slot * threads, 1);
+    for (size_t i = 0; i < per_slot * threads; i++) {
+        buffers[i] = 1e-3 * (i % 7);
+    }
+    peak_ctx ctx = {k, buffers, 1};
+    double elapsed = 0;
+    while (elapsed < PEAK_SECONDS) {
+        ctx.calls *= 2;
+        double start = now();
+        pool_parallel_for(threads, threads, peak_body, &ctx);
+        elapsed = now() - start;
+    }
+    free_data(buffers, per_slot * threads);
+    double flops = 2.0 * k -> mr * k -> nr * PEAK_KC * ctx.calls * threads;
+    return flops / elapsed * 1e-9;
+}
+
+typedef struct copy_ctx {
+    char *dst;
+    const char *src;
+    size_t chunk;
+    size_t bytes;
+} copy_ctx;
+
+static void copy_body(void *arg, long i, int slot) {
+    copy_ctx *ctx = (copy_ctx *)arg;
+    size_t begin = (size_t)i * ctx -> chunk;
+    size_t len = ctx -> bytes - begin < ctx -> chunk ? ctx -> bytes - begin : ctx -> chunk;
+    memcpy(ctx -> dst + begin, ctx -> src + begin, len);
+}
+
+/*
+ * Returns the GB/s of memcpy of `bytes` bytes on `threads` threads, counting the bytes read
+ * and the bytes written, which is how the results count their traffic too.
+ */
+static double measure_bandwidth(size_t bytes, int threads) {
+    double *src = alloc_data(bytes / sizeof(double), 1);
+    double *dst = alloc_data(bytes / sizeof(double), 1);
+    copy_ctx ctx = {(char *)dst, (const char *)src, (size_t)1 << 20, bytes};
+    long chunks = (long)((bytes + ctx.chunk - 1) / ctx.chunk);
+    pool_parallel_for(chunks, threads, copy_body, &ctx);
+    double best = 0;
+    double total = 0;
+    while (total < PEAK_SECONDS) {
+        double start = now();
+        pool_parallel_for(chunks, threads, copy_body, &ctx);
+        double elapsed = now() - start;
+        total += elapsed;
+        if (best == 0 || elapsed < best) best = elapsed;
+    }
+    free_data(src, bytes / sizeof(double));
+    free_data(dst, bytes / sizeof(double));
+    return 2.0 * bytes / best * 1e-9;
+}
+
+/* OPERATIONS */
+
+static int run_op(const bench_case *c, matrix *result, matrix *a, matrix *b) {
+    switch (c -> op) {
+    case OP_ADD:
+        return add_matrix(result, a, b);
+    case OP_ABS:
+        return abs_matrix(result, a);
+    case OP_MUL:
+        return mul_matrix(result, a, b);
+    }
+    return -1;
+}
+
+static double case_flops(const bench_case *c) {
+    return c -> op == OP_MUL ? 2.0 * c -> m * c -> n * c -> k : (double)c -> m * c -> n;
+}
+
+/* Bytes the operation has to move at the least: its operands read once and its result written once */
+static double case_bytes(const bench_case *c) {
+    double entries = (double)c -> m * c -> n;
+    switch (c -> op) {
+    case OP_ADD:
+        return 3 * entries * sizeof(double);
+    case OP_ABS:
+        return 2 * entries * sizeof(double);
+    case OP_MUL:
+        return ((double)c -> m * c -> k + (double)c -> k * c -> n + entries) * sizeof(double);
+    }
+    return 0;
+}
+
+/*
+ * Times `c` with the active kernels on `threads` threads and prints its JSON object. `peak`
+ * and `bandwidth` are the ceilings measured for the same kernels and thread count.
+ */
+static void bench_case_run(const bench_case *c, const char *kernel, int threads, int min_reps,
+                           double peak, double bandwidth, int first) {
+    matrix *result = NULL, *a = NULL, *b = NULL;
+    int a_cols = c -> op == OP_MUL ? c -> k : c -> n;
+    int b_rows = c -> op == OP_MUL ? c -> k : c -> m;
+    if (allocate_matrix(&result, c -> m, c -> n) || allocate_matrix(&a, c -> m, a_cols)
+            || allocate_matrix(&b, b_rows, c -> n)) {
+        fprintf(stderr, "bench: cannot allocate %s %d x %d x %d\n", op_names[c -> op], c -> m,
+                c -> n, c -> k);
+        exit(1);
+    }
+    rand_matrix(a, 1, -1, 1);
+    rand_matrix(b, 2, -1, 1);
+    run_op(c, result, a, b); // warm up the caches, the pool and the allocator
+    double times[MAX_REPS];
+    int reps = 0;
+    double total = 0;
+    while (reps < MAX_REPS && (reps < min_reps || total < MIN_SECONDS)) {
+        double start = now();
+        run_op(c, result, a, b);
+        times[reps] = now() - start;
+        total += times[reps++];
+    }
+    qsort(times, reps, sizeof(double), compare_doubles);
+    double median = percentile(times, reps, 50);
+    double flops = case_flops(c), bytes = case_bytes(c);
+    double intensity = flops / bytes;
+    double ceiling = intensity * bandwidth < peak ? intensity * bandwidth : peak;
+    double gflops = flops / median * 1e-9;
+    printf("%s    {\"op\": \"%s\", \"shape\": \"%s\", \"m\": %d, \"n\": %d, \"k\": %d, "
+           "\"kernel\": \"%s\", \"threads\": %d, \"reps\": %d, \"median_s\": %.9f, "
+           "\"p10_s\": %.9f, \"p90_s\": %.9f, \"min_s\": %.9f, \"gflops\": %.4f, \"gbps\": %.4f, "
+           "\"intensity\": %.4f, \"roofline_gflops\": %.4f, \"fraction_of_roofline\": %.4f, "
+           "\"bound\": \"%s\"}",
+           first ? "" : ",\n", op_names[c -> op], c -> shape, c -> m, c -> n, c -> k, kernel,
+           threads, reps, median, percentile(times, reps, 10), percentile(times, reps, 90),
+           times[0], gflops, bytes / median * 1e-9, intensity, ceiling, gflops / ceiling,
+           intensity * bandwidth < peak ? "memory" : "compute");
+    fflush(stdout);
+    deallocate_matrix(result);
+    deallocate_matrix(a);
+    deallocate_matrix(b);
+}
+
+int main(int argc, char **argv) {
+    const char *only_kernel = NULL;
+    int quick = 0, min_reps = 5;
+    int thread_counts[MAX_THREAD_COUNTS];
+    int num_threads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            quick = 1;
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            only_kernel = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            min_reps = atoi(argv[++i]);
+            if (min_reps < 1) min_reps = 1;
+            if (min_reps > MAX_REPS) min_reps = MAX_REPS;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            for (char *t = strtok(argv[++i], ","); t != NULL && num_threads < MAX_THREAD_COUNTS;
+                    t = strtok(NULL, ",")) {
+                if (atoi(t) > 0) thread_counts[num_threads++] = atoi(t);
+                if (num_threads > 0 && thread_counts[num_threads - 1] > pool_cores()) {
+                    thread_counts[num_threads - 1] = pool_cores(); // what the cost model allows
+                }
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-q] [-k kernel] [-t threads,...] [-r reps]\n", argv[0]);
+            return 2;
+        }
+    }
+    int cores = pool_cores();
+    if (num_threads == 0) {
+        for (int t = 1; t < cores && num_threads < MAX_THREAD_COUNTS - 1; t *= 2) {
+            thread_counts[num_threads++] = t;
+        }
+        thread_counts[num_threads++] = cores;
+    }
+    const char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+    const char *kernels[4];
+    int num_kernels = 0;
+    for (int i = 0; i < 4; i++) {
+        if ((only_kernel == NULL || strcmp(only_kernel, names[i]) == 0) && use_kernels(names[i])) {
+            kernels[num_kernels++] = names[i];
+        }
+    }
+    if (num_kernels == 0) {
+        fprintf(stderr, "bench: kernel variant %s is not supported here\n", only_kernel);
+        return 1;
+    }
+    const bench_case *cases = quick ? quick_cases : full_cases;
+    int num_cases = quick ? sizeof(quick_cases) / sizeof(quick_cases[0])
+        : sizeof(full_cases) / sizeof(full_cases[0]);
+    size_t copy_bytes = quick ? (size_t)32 << 20 : (size_t)256 << 20;
+
+    double peaks[4][MAX_THREAD_COUNTS], bandwidths[MAX_THREAD_COUNTS];
+    printf("{\n  \"machine\": {\"cores\": %d, \"kernels\": [", cores);
+    for (int i = 0; i < num_kernels; i++) {
+        printf("%s\"%s\"", i ? ", " : "", kernels[i]);
+    }
+    printf("], \"memcpy_bytes\": %zu},\n  \"roofline\": [\n", copy_bytes);
+    for (int t = 0; t < num_threads; t++) {
+        bandwidths[t] = measure_bandwidth(copy_bytes, thread_counts[t]);
+    }
+    for (int i = 0; i < num_kernels; i++) {
+        use_kernels(kernels[i]);
+        for (int t = 0; t < num_threads; t++) {
+            peaks[i][t] = measure_peak(active_kernels(), thread_counts[t]);
+            printf("%s    {\"kernel\": \"%s\", \"threads\": %d, \"peak_gflops\": %.4f, "
+                   "\"memcpy_gbps\": %.4f, \"ridge_intensity\": %.4f}",
+                   i == 0 && t == 0 ? "" : ",\n", kernels[i], thread_counts[t], peaks[i][t],
+                   bandwidths[t], peaks[i][t] / bandwidths[t]);
+        }
+    }
+    printf("\n  ],\n  \"results\": [\n");
+    int first = 1;
+    for (int c = 0; c < num_cases; c++) {
+        for (int i = 0; i < num_kernels; i++) {
+            use_kernels(kernels[i]);
+            for (int t = 0; t < num_threads; t++) {
+                force_threads(thread_counts[t]);
+                bench_case_run(&cases[c], kernels[i], thread_counts[t], min_reps, peaks[i][t],
+                               bandwidths[t], first);
+                first = 0;
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+    pool_shutdown();
+    return 0;
+}
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE // clock_gettime and pthread_atfork under -std=c99
+
+#include "executor.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef enum task_state { TASK_WAITING, TASK_QUEUED, TASK_RUNNING, TASK_DONE } task_state;
+
+/* An edge from a task to one that depends on it, kept in the dependent task */
+typedef struct edge {
+    task *to;
+    struct edge *next;
+} edge;
+
+struct task {
+    task_fn run;
+    void *arg;
+    task_state state;
+    int status; // what `run` returned, or TASK_DEPENDENCY_FAILED; valid once TASK_DONE
+    int waiting; // dependencies that have not finished yet
+    int dependency_failed; // set if one of them failed, so this one will not run
+    edge *dependents; // tasks depending on this one that were submitted before it finished
+    edge edges[EXECUTOR_MAX_DEPS]; // this task's entries in the `dependents` of its dependencies
+    task *next; // in the queue
+};
+
+static pthread_mutex_t executor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER; // threads wait here for tasks
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; // executor_wait waits here
+static pthread_t threads[EXECUTOR_MAX_THREADS];
+static int nthreads = 0;
+static int max_threads = EXECUTOR_DEFAULT_THREADS;
+static int stopping = 0;
+static int atfork_registered = 0;
+static task *head = NULL, *tail = NULL; // tasks ready to run, oldest first
+static int pending = 0; // tasks submitted and not finished
+
+/* Appends `t`, whose dependencies are all done, to the queue. Called with the lock held. */
+static void enqueue(task *t) {
+    t -> state = TASK_QUEUED;
+    t -> next = NULL;
+    if (tail != NULL) tail -> next = t;
+    else head = t;
+    tail = t;
+    pthread_cond_signal(&work_cond);
+}
+
+/*
+ * Marks `t` done with `status` and releases the tasks waiting for it. Those whose last
+ * dependency this was are queued, or finished right away if one of their dependencies failed.
+ * Called with the lock held.
+ */
+static void finish(task *t, int status) {
+    t -> state = TASK_DONE;
+    t -> status = status;
+    pending--;
+    edge *e = t -> dependents;
+    t -> dependents = NULL;
+    for (; e != NULL; e = e -> next) {
+        task *d = e -> to;
+        if (status) d -> dependency_failed = 1;
+        if (--d -> waiting > 0) continue;
+        if (d -> dependency_failed) finish(d, TASK_DEPENDENCY_FAILED);
+        else enqueue(d);
+    }
+    pthread_cond_broadcast(&done_cond);
+}
+
+/*
+ * Runs queued tasks until executor_shutdown, which lets the threads drain the queue first. A
+ * task can only be waiting on tasks that are queued or running, so the last thread left
+ * running finishes them all.
+ */
+static void *executor_main(void *arg) {
+    trace_thread_name("numc executor");
+    pthread_mutex_lock(&executor_lock);
+    while (1) {
+        while (!stopping && head == NULL) {
+            pthread_cond_wait(&work_cond, &executor_lock);
+        }
+        if (head == NULL) break;
+        task *t = head;
+        head = t -> next;
+        if (head == NULL) tail = NULL;
+        t -> state = TASK_RUNNING;
+        pthread_mutex_unlock(&executor_lock);
+        TRACE_BEGIN(span);
+        int status = t -> run(t -> arg);
+        TRACE_END(span, "task", status);
+        pthread_mutex_lock(&executor_lock);
+        finish(t, status != 0);
+    }
+    pthread_mutex_unlock(&executor_lock);
+    return NULL;
+}
+
+/*
+ * In the child of a fork only the forking thread exists. Forget the threads so that the next
+ * submission starts new ones; tasks that were running in the parent never finish in the child.
+ */
+static void reset_after_fork(void) {
+    pthread_mutex_init(&executor_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+    nthreads = 0;
+    stopping = 0;
+}
+
+/* Starts threads until there are max_threads. Called with the lock held. */
+static void start_threads(void) {
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, reset_after_fork);
+        atfork_registered = 1;
+    }
+    while (nthreads < max_threads) {
+        if (pthread_create(&threads[nthreads], NULL, executor_main, NULL)) return;
+        nthreads++;
+    }
+}
+
+/*
+ * Submits a task running run(arg) once the `ndeps` (at most EXECUTOR_MAX_DEPS) tasks of `deps`
+ * have finished. If one of them fails, `run` is never called and the task finishes with
+ * TASK_DEPENDENCY_FAILED. Returns NULL if there is no memory for the task, or if not even one
+ * thread could be started. The caller owns the task and frees it with executor_release.
+ */
+task *executor_submit(task_fn run, void *arg, task **deps, int ndeps) {
+    task *t = (task *)calloc(1, sizeof(task));
+    if (t == NULL) return NULL;
+    t -> run = run;
+    t -> arg = arg;
+    t -> state = TASK_WAITING;
+    pthread_mutex_lock(&executor_lock);
+    start_threads();
+    if (nthreads == 0) {
+        pthread_mutex_unlock(&executor_lock);
+        free(t);
+        return NULL;
+    }
+    pending++;
+    for (int i = 0; i < ndeps && i < EXECUTOR_MAX_DEPS; i++) {
+        task *d = deps[i];
+        if (d -> state == TASK_DONE) {
+            if (d -> status) t -> dependency_failed = 1;
+            continue;
+        }
+        t -> edges[i].to = t;
+        t -> edges[i].next = d -> dependents;
+        d -> dependents = &t -> edges[i];
+        t -> waiting++;
+    }
+    if (t -> waiting == 0) {
+        if (t -> dependency_failed) finish(t, TASK_DEPENDENCY_FAILED);
+        else enqueue(t);
+    }
+    pthread_mutex_unlock(&executor_lock);
+    return t;
+}
+
+/*
+ * Waits until `t` has finished, for at most `timeout` seconds unless `timeout` is negative.
+ * Returns nonzero if it has.
+ */
+int executor_wait(task *t, double timeout) {
+    struct timespec deadline;
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double secs = deadline.tv_nsec / 1e9 + timeout;
+        deadline.tv_sec += (time_t)secs;
+        deadline.tv_nsec = (long)((secs - (time_t)secs) * 1e9);
+    }
+    pthread_mutex_lock(&executor_lock);
+    int timed_out = 0;
+    while (t -> state != TASK_DONE && !timed_out) {
+        if (timeout < 0) pthread_cond_wait(&done_cond, &executor_lock);
+        else timed_out = pthread_cond_timedwait(&done_cond, &executor_lock, &deadline) != 0;
+    }
+    int done = t -> state == TASK_DONE;
+    pthread_mutex_unlock(&executor_lock);
+    return done;
+}
+
+/* Returns nonzero if `t` has finished, without waiting */
+int executor_done(task *t) {
+    pthread_mutex_lock(&executor_lock);
+    int done = t -> state == TASK_DONE;
+    pthread_mutex_unlock(&executor_lock);
+    return done;
+}
+
+/*
+ * Returns 0 if the finished task `t` succeeded, 1 if it failed, or TASK_DEPENDENCY_FAILED if it
+ * never ran
+ */
+int executor_status(task *t) {
+    pthread_mutex_lock(&executor_lock);
+    int status = t -> status;
+    pthread_mutex_unlock(&executor_lock);
+    return status;
+}
+
+/* Frees `t`, which must have finished */
+void executor_release(task *t) {
+    free(t);
+}
+
+/* Sets how many threads run tasks, at least 1 and at most EXECUTOR_MAX_THREADS */
+void executor_set_threads(int count) {
+    if (count < 1) count = 1;
+    if (count > EXECUTOR_MAX_THREADS) count = EXECUTOR_MAX_THREADS;
+    pthread_mutex_lock(&executor_lock);
+    int shrink = count < nthreads;
+    max_threads = count;
+    pthread_mutex_unlock(&executor_lock);
+    /* Extra threads are stopped by stopping all of them; the next submission starts the rest */
+    if (shrink) executor_shutdown();
+}
+
+int executor_threads(void) {
+    pthread_mutex_lock(&executor_lock);
+    int count = max_threads;
+    pthread_mutex_unlock(&executor_lock);
+    return count;
+}
+
+/* Returns the number of tasks submitted that have not finished */
+int executor_pending(void) {
+    pthread_mutex_lock(&executor_lock);
+    int count = pending;
+    pthread_mutex_unlock(&executor_lock);
+    return count;
+}
+
+/* Runs every task submitted so far to completion, then stops and joins the threads */
+void executor_shutdown(void) {
+    pthread_mutex_lock(&executor_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_cond);
+    int count = nthreads;
+    pthread_mutex_unlock(&executor_lock);
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_lock(&executor_lock);
+    nthreads = 0;
+    stopping = 0;
+    pthread_mutex_unlock(&executor_lock);
+}
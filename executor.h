@@ -0,0 +1,40 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+/*
+ * Background executor for whole operations, behind numc.submit. Tasks run on a few threads of
+ * their own, separate from the workers of pool.h: a task runs a kernel, whose loops the kernel
+ * splits over the pool as usual, so independent tasks overlap and the thread that submitted
+ * them goes on with its work. A task may depend on earlier tasks, and is only queued once all
+ * of them have finished; tasks whose dependencies are done run in submission order. The
+ * threads never touch Python objects, so they never need the GIL.
+ */
+
+/* Threads started unless executor_set_threads says otherwise */
+#define EXECUTOR_DEFAULT_THREADS 4
+
+/* Most threads executor_set_threads allows */
+#define EXECUTOR_MAX_THREADS 64
+
+/* Most tasks one task may depend on */
+#define EXECUTOR_MAX_DEPS 2
+
+/* Runs a task. Returns nonzero if it failed. */
+typedef int (*task_fn)(void *arg);
+
+typedef struct task task;
+
+/* What executor_status returns for a task that did not run because a dependency failed */
+#define TASK_DEPENDENCY_FAILED (-1)
+
+task *executor_submit(task_fn run, void *arg, task **deps, int ndeps);
+int executor_wait(task *t, double timeout);
+int executor_done(task *t);
+int executor_status(task *t);
+void executor_release(task *t);
+void executor_set_threads(int threads);
+int executor_threads(void);
+int executor_pending(void);
+void executor_shutdown(void);
+
+#endif
@@ -0,0 +1,211 @@
+#include "expr.h"
+#include "threading.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Number of entries evaluated at a time. Each node of the tree gets a buffer of this size, so
+ * all the intermediate values of a chunk stay in L1 and only the leaves and the result ever
+ * travel to and from memory.
+ */
+#define EXPR_CHUNK 256
+
+/* One step of the postfix program a tree is flattened into before evaluation */
+typedef struct instr {
+    expr_op op;
+    matrix *mat; // the operand of an EXPR_LEAF step
+} instr;
+
+static expr *new_node(expr_op op, int64_t rows, int64_t cols) {
+    expr *e = (expr *)malloc(sizeof(expr));
+    if (e == NULL) return NULL;
+    e -> op = op;
+    e -> rows = rows; e -> cols = cols;
+    e -> mat = NULL; e -> lhs = NULL; e -> rhs = NULL;
+    e -> nodes = 1;
+    e -> ref_cnt = 1;
+    return e;
+}
+
+/*
+ * Returns a leaf reading the entries of `mat`, or NULL if there is no memory. The leaf holds
+ * a view of `mat`, so the data stays alive as long as the leaf does.
+ */
+expr *expr_leaf(matrix *mat) {
+    expr *e = new_node(EXPR_LEAF, mat -> rows, mat -> cols);
+    if (e == NULL) return NULL;
+    if (allocate_matrix_view(&e -> mat, mat, 0, mat -> rows, mat -> cols, mat -> row_stride,
+                             mat -> col_stride)) {
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+/* Returns a node applying EXPR_NEG or EXPR_ABS to `a`, or NULL if there is no memory */
+expr *expr_unary(expr_op op, expr *a) {
+    expr *e = new_node(op, a -> rows, a -> cols);
+    if (e == NULL) return NULL;
+    e -> lhs = a;
+    a -> ref_cnt++;
+    e -> nodes = a -> nodes + 1;
+    return e;
+}
+
+/*
+ * Returns a node applying EXPR_ADD or EXPR_SUB to `a` and `b`, which must have the same shape,
+ * or NULL if there is no memory. The caller keeps its own references to the operands.
+ */
+expr *expr_binary(expr_op op, expr *a, expr *b) {
+    expr *e = new_node(op, a -> rows, a -> cols);
+    if (e == NULL) return NULL;
+    e -> lhs = a; e -> rhs = b;
+    a -> ref_cnt++; b -> ref_cnt++;
+    e -> nodes = a -> nodes + b -> nodes + 1;
+    return e;
+}
+
+/* Drops a reference to `e`, freeing the node and releasing its operands once it was the last */
+void expr_release(expr *e) {
+    if (e == NULL || --e -> ref_cnt) return;
+    deallocate_matrix(e -> mat);
+    expr_release(e -> lhs);
+    expr_release(e -> rhs);
+    free(e);
+}
+
+/* Returns the matrix owning the data `mat` is a view of */
+static matrix *root(matrix *mat) {
+    while (mat -> parent) mat = mat -> parent;
+    return mat;
+}
+
+/*
+ * Returns nonzero if evaluating `e` reads any of the data `mat` shares with its parents and
+ * slices, i.e. if writing to `mat` could change the value of `e`.
+ */
+int expr_reads(expr *e, matrix *mat) {
+    if (e == NULL) return 0;
+    if (e -> op == EXPR_LEAF) {
+        matrix *r1 = root(e -> mat), *r2 = root(mat);
+        return r1 -> data < r2 -> data + (size_t)r2 -> rows * r2 -> cols
+            && r2 -> data < r1 -> data + (size_t)r1 -> rows * r1 -> cols;
+    }
+    return expr_reads(e -> lhs, mat) || expr_reads(e -> rhs, mat);
+}
+
+/* Appends the steps of `e` to `prog` in postfix order. Returns the new length of `prog`. */
+static int compile(expr *e, instr *prog, int len) {
+    if (e -> lhs) len = compile(e -> lhs, prog, len);
+    if (e -> rhs) len = compile(e -> rhs, prog, len);
+    prog[len].op = e -> op;
+    prog[len].mat = e -> mat;
+    return len + 1;
+}
+
+/*
+ * Runs the program on the `n` entries starting at (r, c) of every leaf and writes them to
+ * `dst`. Values on the stack either point straight into a leaf or into the buffer of their
+ * stack slot, so contiguous leaves are never copied and the last step writes to `dst` directly.
+ */
+static void run_chunk(const kernel_table *k, const instr *prog, int len, int64_t r, int64_t c,
+                      int n, double *dst, double (*bufs)[EXPR_CHUNK]) {
+    const double *stack[EXPR_MAX_NODES];
+    int top = 0;
+    for (int i = 0; i < len; i++) {
+        const instr *in = &prog[i];
+        int arity = in -> op == EXPR_LEAF ? 0 : in -> op == EXPR_ADD || in -> op == EXPR_SUB ? 2 : 1;
+        double *out = i == len - 1 ? dst : bufs[top - arity];
+        switch (in -> op) {
+        case EXPR_LEAF: {
+            const matrix *m = in -> mat;
+            const double *src = &m -> data[r * m -> row_stride + c * m -> col_stride];
+            if (m -> col_stride != 1) {
+                for (int j = 0; j < n; j++) {
+                    bufs[top][j] = src[j * m -> col_stride];
+                }
+                src = bufs[top];
+            }
+            stack[top++] = src;
+            break;
+        }
+        case EXPR_ADD:
+            k -> add(out, stack[top - 2], stack[top - 1], n);
+            stack[--top - 1] = out;
+            break;
+        case EXPR_SUB:
+            k -> sub(out, stack[top - 2], stack[top - 1], n);
+            stack[--top - 1] = out;
+            break;
+        case EXPR_NEG:
+            k -> neg(out, stack[top - 1], n);
+            stack[top - 1] = out;
+            break;
+        case EXPR_ABS:
+            k -> abs(out, stack[top - 1], n);
+            stack[top - 1] = out;
+            break;
+        }
+    }
+    if (stack[0] != dst) memcpy(dst, stack[0], n * sizeof(double));
+}
+
+/* Arguments shared by the chunks of one expr_evaluate */
+typedef struct eval_ctx {
+    const kernel_table *k;
+    const instr *prog;
+    int len;
+    int64_t chunks; // chunks per row
+    int64_t cols;
+    double *dst;
+} eval_ctx;
+
+/* Evaluates chunk `t`, counting row by row */
+static void eval_body(void *arg, long t, int slot) {
+    eval_ctx *ctx = (eval_ctx *)arg;
+    TRACE_BEGIN(span);
+    double bufs[EXPR_MAX_NODES][EXPR_CHUNK];
+    int64_t r = t / ctx -> chunks;
+    int64_t c = t % ctx -> chunks * EXPR_CHUNK;
+    int n = ctx -> cols - c < EXPR_CHUNK ? (int)(ctx -> cols - c) : EXPR_CHUNK;
+    run_chunk(ctx -> k, ctx -> prog, ctx -> len, r, c, n, &ctx -> dst[r * ctx -> cols + c], bufs);
+    TRACE_END(span, "expr tile", t);
+}
+
+/*
+ * Evaluates `e` into `result`, a contiguous matrix of the same shape that does not overlap any
+ * leaf, in one parallel pass: every chunk of entries is pushed through the whole tree while it
+ * is in L1, so no intermediate matrix is ever written to memory. If all leaves are contiguous
+ * the data is treated as one flat array, otherwise it goes row by row.
+ * Return 0 upon success and a nonzero value upon failure.
+ */
+int expr_evaluate(matrix *result, expr *e) {
+    if (result -> rows != e -> rows || result -> cols != e -> cols || !is_contiguous(result)
+            || e -> nodes > EXPR_MAX_NODES) {
+        return 1;
+    }
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_EXPR);
+    instr prog[EXPR_MAX_NODES];
+    int len = compile(e, prog, 0);
+    int flat = 1, leaves = 0;
+    for (int i = 0; i < len; i++) {
+        if (prog[i].op == EXPR_LEAF && !is_contiguous(prog[i].mat)) flat = 0;
+        if (prog[i].op == EXPR_LEAF) leaves++;
+    }
+    exec_plan plan = plan_elementwise((long)(result -> rows * result -> cols));
+    const kernel_table *k = plan.kernels;
+    int threads = plan.threads;
+    int64_t rows = flat ? 1 : result -> rows;
+    int64_t cols = flat ? result -> rows * result -> cols : result -> cols;
+    int64_t chunks = (cols + EXPR_CHUNK - 1) / EXPR_CHUNK;
+    long total = (long)(rows * chunks);
+    eval_ctx ctx = {k, prog, len, chunks, cols, result -> data};
+    pool_parallel_for(total, threads, eval_body, &ctx);
+    double d = (double)result -> rows * result -> cols;
+    STATS_END(scope, d, leaves * d * sizeof(double), d * sizeof(double), (len - leaves) * d);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "matrix.h"
+
+/*
+ * Deferred element-wise expressions. In lazy mode the number methods do not compute anything;
+ * they build a tree of these nodes whose leaves are the operand matrices, and the whole tree
+ * is evaluated by expr_evaluate in a single pass over the data once the result is needed.
+ * Nodes are shared between trees (a pending result used twice), so they are reference counted.
+ */
+typedef enum expr_op { EXPR_LEAF, EXPR_ADD, EXPR_SUB, EXPR_NEG, EXPR_ABS } expr_op;
+
+typedef struct expr {
+    expr_op op;
+    int64_t rows; // number of rows of the result
+    int64_t cols; // number of columns of the result
+    matrix *mat; // EXPR_LEAF only: a view of the operand, which keeps its data alive
+    struct expr *lhs; // the operand of a unary node, the left operand of a binary one
+    struct expr *rhs; // the right operand of a binary node
+    int nodes; // number of nodes in the tree rooted here, leaves included
+    int ref_cnt; // number of trees and numc.Matrix objects holding this node
+} expr;
+
+/* Largest tree evaluated in one pass; operands that would make a tree bigger are evaluated first */
+#define EXPR_MAX_NODES 16
+
+expr *expr_leaf(matrix *mat);
+expr *expr_unary(expr_op op, expr *a);
+expr *expr_binary(expr_op op, expr *a, expr *b);
+void expr_release(expr *e);
+int expr_reads(expr *e, matrix *mat);
+int expr_evaluate(matrix *result, expr *e);
+
+#endif
@@ -0,0 +1,446 @@
+#include "kernels.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Include SSE intrinsics
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <x86intrin.h>
+#define KERNELS_X86 1
+#endif
+
+/*
+ * Every variant below is compiled with its own target options, so the module itself can be
+ * built for the baseline instruction set and still run AVX2 or AVX-512 code where the CPU
+ * has it. The table for the running CPU is picked once by select_kernels().
+ */
+
+/*
+ * Element-wise kernels. Their bodies are the same for every instruction set; the compiler
+ * vectorizes them for whatever target is active where the macro is expanded.
+ */
+#define ELEMENTWISE_KERNELS(isa)                                                  \
+static void add_##isa(double *dst, const double *a, const double *b, int64_t n) { \
+    for (int64_t i = 0; i < n; i++) {                                             \
+        dst[i] = a[i] + b[i];                                                     \
+    }                                                                             \
+}                                                                                 \
+static void sub_##isa(double *dst, const double *a, const double *b, int64_t n) { \
+    for (int64_t i = 0; i < n; i++) {                                             \
+        dst[i] = a[i] - b[i];                                                     \
+    }                                                                             \
+}                                                                                 \
+static void neg_##isa(double *dst, const double *a, int64_t n) {                  \
+    for (int64_t i = 0; i < n; i++) {                                             \
+        dst[i] = -a[i];                                                           \
+    }                                                                             \
+}                                                                                 \
+static void abs_##isa(double *dst, const double *a, int64_t n) {                  \
+    for (int64_t i = 0; i < n; i++) {                                             \
+        dst[i] = fabs(a[i]);                                                      \
+    }                                                                             \
+}                                                                                 \
+static void fill_##isa(double *dst, double val, int64_t n) {                      \
+    for (int64_t i = 0; i < n; i++) {                                             \
+        dst[i] = val;                                                             \
+    }                                                                             \
+}
+
+/*
+ * Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011): ten
+ * rounds of two 32 x 32 -> 64 bit multiplications turn a 128-bit counter and a 64-bit key into
+ * 128 random bits. Every counter is independent of the others, so the loops below process a
+ * block of counters per round and vectorize like the element-wise kernels.
+ */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+#define PHILOX_TWO_PI 6.283185307179586476925286766559
+/* Counters processed per block, small enough for the block to stay in registers and L1 */
+#define PHILOX_BLOCK 64
+
+/*
+ * Runs the rounds on `n` counters held in four word arrays, in place. The rounds of one counter
+ * are unrolled so that the loop over the counters is the innermost one and vectorizes; it is
+ * always inlined, so each variant below compiles it for its own instruction set.
+ */
+static inline __attribute__((always_inline)) void philox_block(uint32_t *x0, uint32_t *x1,
+        uint32_t *x2, uint32_t *x3, int n, uint32_t k0, uint32_t k1) {
+    for (int i = 0; i < n; i++) {
+        uint32_t a = x0[i], b = x1[i], c = x2[i], d = x3[i];
+        uint32_t ka = k0, kb = k1;
+        #pragma GCC unroll 10
+        for (int r = 0; r < PHILOX_ROUNDS; r++) {
+            uint64_t p0 = (uint64_t)PHILOX_M0 * a;
+            uint64_t p1 = (uint64_t)PHILOX_M1 * c;
+            a = (uint32_t)(p1 >> 32) ^ b ^ ka;
+            c = (uint32_t)(p0 >> 32) ^ d ^ kb;
+            b = (uint32_t)p1;
+            d = (uint32_t)p0;
+            ka += PHILOX_W0;
+            kb += PHILOX_W1;
+        }
+        x0[i] = a; x1[i] = b; x2[i] = c; x3[i] = d;
+    }
+}
+
+/*
+ * Returns a double in [0, 1) made of the top 52 bits of `hi` and `lo`: they become the mantissa
+ * of a number in [1, 2), which avoids the 64-bit integer conversion SSE2 and AVX2 do not have.
+ */
+static inline __attribute__((always_inline)) double unit_double(uint32_t hi, uint32_t lo) {
+    uint64_t bits = 0x3FF0000000000000ull | ((uint64_t)hi << 20) | (lo >> 12);
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val - 1;
+}
+
+/*
+ * Fills `n` entries from the counters first, first + 1, ... The uniform variant uses the first
+ * two words of each output, the normal one all four for one Box-Muller transform.
+ */
+static inline __attribute__((always_inline)) void philox_fill(double *dst, uint64_t key,
+        uint64_t first, int64_t n, int normal, double a, double b) {
+    uint32_t x0[PHILOX_BLOCK], x1[PHILOX_BLOCK], x2[PHILOX_BLOCK], x3[PHILOX_BLOCK];
+    for (int64_t start = 0; start < n; start += PHILOX_BLOCK) {
+        int len = n - start < PHILOX_BLOCK ? (int)(n - start) : PHILOX_BLOCK;
+        for (int i = 0; i < len; i++) {
+            uint64_t ctr = first + start + i;
+            x0[i] = (uint32_t)ctr;
+            x1[i] = (uint32_t)(ctr >> 32);
+            x2[i] = 0;
+            x3[i] = 0;
+        }
+        philox_block(x0, x1, x2, x3, len, (uint32_t)key, (uint32_t)(key >> 32));
+        if (normal) {
+            for (int i = 0; i < len; i++) {
+                double u1 = 1 - unit_double(x0[i], x1[i]); // (0, 1], so the log is finite
+                double u2 = unit_double(x2[i], x3[i]);
+                dst[start + i] = a + b * sqrt(-2 * log(u1)) * cos(PHILOX_TWO_PI * u2);
+            }
+        } else {
+            for (int i = 0; i < len; i++) {
+                dst[start + i] = a + (b - a) * unit_double(x0[i], x1[i]);
+            }
+        }
+    }
+}
+
+#define RANDOM_KERNELS(isa)                                                                           \
+static void uniform_##isa(double *dst, uint64_t key, uint64_t first, int64_t n, double a, double b) { \
+    philox_fill(dst, key, first, n, 0, a, b);                                                         \
+}                                                                                                     \
+static void normal_##isa(double *dst, uint64_t key, uint64_t first, int64_t n, double a, double b) {  \
+    philox_fill(dst, key, first, n, 1, a, b);                                                         \
+}
+
+/*
+ * Writes `alpha` times the `m` x `n` valid part of a tile computed into `buf` (row length `nr`)
+ * plus `beta` times the old contents to `c`. Used by the micro kernels for the partial tiles on
+ * the right and bottom edges.
+ */
+static void store_edge_tile(double *c, int64_t ldc, const double *buf, int nr, int m, int n,
+                            double alpha, double beta) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double val = alpha * buf[i * nr + j];
+            c[i * ldc + j] = beta == 0 ? val : val + beta * c[i * ldc + j];
+        }
+    }
+}
+
+/* Portable fallback, kept free of vector code so it runs anywhere */
+#pragma GCC push_options
+#pragma GCC optimize("no-tree-vectorize")
+
+ELEMENTWISE_KERNELS(scalar)
+RANDOM_KERNELS(scalar)
+
+#define SCALAR_MR 4
+#define SCALAR_NR 4
+
+static void micro_kernel_scalar(int kc, const double *ap, const double *bp, double *c, int64_t ldc,
+                                int m, int n, double alpha, double beta) {
+    double acc[SCALAR_MR * SCALAR_NR] = {0};
+    for (int k = 0; k < kc; k++) {
+        for (int i = 0; i < SCALAR_MR; i++) {
+            for (int j = 0; j < SCALAR_NR; j++) {
+                acc[i * SCALAR_NR + j] += ap[i] * bp[j];
+            }
+        }
+        ap += SCALAR_MR;
+        bp += SCALAR_NR;
+    }
+    store_edge_tile(c, ldc, acc, SCALAR_NR, m, n, alpha, beta);
+}
+
+#pragma GCC pop_options
+
+static const kernel_table scalar_kernels = {
+    "scalar", add_scalar, sub_scalar, neg_scalar, abs_scalar, fill_scalar,
+    uniform_scalar, normal_scalar,
+    SCALAR_MR, SCALAR_NR, micro_kernel_scalar
+};
+
+#ifdef KERNELS_X86
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+
+ELEMENTWISE_KERNELS(sse2)
+RANDOM_KERNELS(sse2)
+
+#define SSE2_MR 4
+#define SSE2_NR 4
+
+/* 4 x 4 tile in eight xmm accumulators */
+static void micro_kernel_sse2(int kc, const double *ap, const double *bp, double *c, int64_t ldc,
+                              int m, int n, double alpha, double beta) {
+    __m128d acc[SSE2_MR][2];
+    for (int i = 0; i < SSE2_MR; i++) {
+        acc[i][0] = _mm_setzero_pd();
+        acc[i][1] = _mm_setzero_pd();
+    }
+    for (int k = 0; k < kc; k++) {
+        __m128d b0 = _mm_load_pd(bp);
+        __m128d b1 = _mm_load_pd(bp + 2);
+        for (int i = 0; i < SSE2_MR; i++) {
+            __m128d a = _mm_load1_pd(ap + i);
+            acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(a, b0));
+            acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(a, b1));
+        }
+        ap += SSE2_MR;
+        bp += SSE2_NR;
+    }
+    if (m == SSE2_MR && n == SSE2_NR) {
+        __m128d va = _mm_set1_pd(alpha), vb = _mm_set1_pd(beta);
+        for (int i = 0; i < SSE2_MR; i++) {
+            double *dst = c + i * ldc;
+            acc[i][0] = _mm_mul_pd(va, acc[i][0]);
+            acc[i][1] = _mm_mul_pd(va, acc[i][1]);
+            if (beta != 0) {
+                acc[i][0] = _mm_add_pd(acc[i][0], _mm_mul_pd(vb, _mm_loadu_pd(dst)));
+                acc[i][1] = _mm_add_pd(acc[i][1], _mm_mul_pd(vb, _mm_loadu_pd(dst + 2)));
+            }
+            _mm_storeu_pd(dst, acc[i][0]);
+            _mm_storeu_pd(dst + 2, acc[i][1]);
+        }
+    } else {
+        double buf[SSE2_MR * SSE2_NR];
+        for (int i = 0; i < SSE2_MR; i++) {
+            _mm_storeu_pd(buf + i * SSE2_NR, acc[i][0]);
+            _mm_storeu_pd(buf + i * SSE2_NR + 2, acc[i][1]);
+        }
+        store_edge_tile(c, ldc, buf, SSE2_NR, m, n, alpha, beta);
+    }
+}
+
+#pragma GCC pop_options
+
+static const kernel_table sse2_kernels = {
+    "sse2", add_sse2, sub_sse2, neg_sse2, abs_sse2, fill_sse2,
+    uniform_sse2, normal_sse2,
+    SSE2_MR, SSE2_NR, micro_kernel_sse2
+};
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+ELEMENTWISE_KERNELS(avx2)
+RANDOM_KERNELS(avx2)
+
+#define AVX2_MR 6
+#define AVX2_NR 8
+
+/*
+ * The whole 6 x 8 tile lives in twelve ymm registers for the entire k loop: every step
+ * loads one row of the B sliver, broadcasts each element of the A column and issues twelve
+ * FMAs, so no horizontal reduction is ever needed.
+ */
+static void micro_kernel_avx2(int kc, const double *ap, const double *bp, double *c, int64_t ldc,
+                              int m, int n, double alpha, double beta) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+    __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+    __m256d b0, b1, a;
+    for (int k = 0; k < kc; k++) {
+        b0 = _mm256_load_pd(bp);
+        b1 = _mm256_load_pd(bp + 4);
+        a = _mm256_broadcast_sd(ap);
+        c00 = _mm256_fmadd_pd(a, b0, c00); c01 = _mm256_fmadd_pd(a, b1, c01);
+        a = _mm256_broadcast_sd(ap + 1);
+        c10 = _mm256_fmadd_pd(a, b0, c10); c11 = _mm256_fmadd_pd(a, b1, c11);
+        a = _mm256_broadcast_sd(ap + 2);
+        c20 = _mm256_fmadd_pd(a, b0, c20); c21 = _mm256_fmadd_pd(a, b1, c21);
+        a = _mm256_broadcast_sd(ap + 3);
+        c30 = _mm256_fmadd_pd(a, b0, c30); c31 = _mm256_fmadd_pd(a, b1, c31);
+        a = _mm256_broadcast_sd(ap + 4);
+        c40 = _mm256_fmadd_pd(a, b0, c40); c41 = _mm256_fmadd_pd(a, b1, c41);
+        a = _mm256_broadcast_sd(ap + 5);
+        c50 = _mm256_fmadd_pd(a, b0, c50); c51 = _mm256_fmadd_pd(a, b1, c51);
+        ap += AVX2_MR;
+        bp += AVX2_NR;
+    }
+    double buf[AVX2_MR * AVX2_NR];
+    int full = m == AVX2_MR && n == AVX2_NR;
+    double *dst = full ? c : buf;
+    int64_t ld = full ? ldc : AVX2_NR;
+    if (full) {
+        /* Scale in registers; partial tiles are scaled by store_edge_tile instead */
+        __m256d va = _mm256_set1_pd(alpha);
+        c00 = _mm256_mul_pd(va, c00); c01 = _mm256_mul_pd(va, c01);
+        c10 = _mm256_mul_pd(va, c10); c11 = _mm256_mul_pd(va, c11);
+        c20 = _mm256_mul_pd(va, c20); c21 = _mm256_mul_pd(va, c21);
+        c30 = _mm256_mul_pd(va, c30); c31 = _mm256_mul_pd(va, c31);
+        c40 = _mm256_mul_pd(va, c40); c41 = _mm256_mul_pd(va, c41);
+        c50 = _mm256_mul_pd(va, c50); c51 = _mm256_mul_pd(va, c51);
+    }
+    if (full && beta != 0) {
+        __m256d vb = _mm256_set1_pd(beta);
+        c00 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst), c00); c01 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 4), c01);
+        c10 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + ld), c10); c11 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + ld + 4), c11);
+        c20 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 2 * ld), c20); c21 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 2 * ld + 4), c21);
+        c30 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 3 * ld), c30); c31 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 3 * ld + 4), c31);
+        c40 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 4 * ld), c40); c41 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 4 * ld + 4), c41);
+        c50 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 5 * ld), c50); c51 = _mm256_fmadd_pd(vb, _mm256_loadu_pd(dst + 5 * ld + 4), c51);
+    }
+    _mm256_storeu_pd(dst, c00); _mm256_storeu_pd(dst + 4, c01);
+    _mm256_storeu_pd(dst + ld, c10); _mm256_storeu_pd(dst + ld + 4, c11);
+    _mm256_storeu_pd(dst + 2 * ld, c20); _mm256_storeu_pd(dst + 2 * ld + 4, c21);
+    _mm256_storeu_pd(dst + 3 * ld, c30); _mm256_storeu_pd(dst + 3 * ld + 4, c31);
+    _mm256_storeu_pd(dst + 4 * ld, c40); _mm256_storeu_pd(dst + 4 * ld + 4, c41);
+    _mm256_storeu_pd(dst + 5 * ld, c50); _mm256_storeu_pd(dst + 5 * ld + 4, c51);
+    if (!full) {
+        store_edge_tile(c, ldc, buf, AVX2_NR, m, n, alpha, beta);
+    }
+}
+
+#pragma GCC pop_options
+
+static const kernel_table avx2_kernels = {
+    "avx2", add_avx2, sub_avx2, neg_avx2, abs_avx2, fill_avx2,
+    uniform_avx2, normal_avx2,
+    AVX2_MR, AVX2_NR, micro_kernel_avx2
+};
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+
+ELEMENTWISE_KERNELS(avx512)
+RANDOM_KERNELS(avx512)
+
+#define AVX512_MR 8
+#define AVX512_NR 16
+
+/* 8 x 16 tile in sixteen zmm accumulators, same scheme as the AVX2 kernel */
+static void micro_kernel_avx512(int kc, const double *ap, const double *bp, double *c, int64_t ldc,
+                                int m, int n, double alpha, double beta) {
+    __m512d acc[AVX512_MR][2];
+    for (int i = 0; i < AVX512_MR; i++) {
+        acc[i][0] = _mm512_setzero_pd();
+        acc[i][1] = _mm512_setzero_pd();
+    }
+    for (int k = 0; k < kc; k++) {
+        __m512d b0 = _mm512_load_pd(bp);
+        __m512d b1 = _mm512_load_pd(bp + 8);
+        for (int i = 0; i < AVX512_MR; i++) {
+            __m512d a = _mm512_set1_pd(ap[i]);
+            acc[i][0] = _mm512_fmadd_pd(a, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(a, b1, acc[i][1]);
+        }
+        ap += AVX512_MR;
+        bp += AVX512_NR;
+    }
+    if (m == AVX512_MR && n == AVX512_NR) {
+        __m512d va = _mm512_set1_pd(alpha), vb = _mm512_set1_pd(beta);
+        for (int i = 0; i < AVX512_MR; i++) {
+            double *dst = c + i * ldc;
+            acc[i][0] = _mm512_mul_pd(va, acc[i][0]);
+            acc[i][1] = _mm512_mul_pd(va, acc[i][1]);
+            if (beta != 0) {
+                acc[i][0] = _mm512_fmadd_pd(vb, _mm512_loadu_pd(dst), acc[i][0]);
+                acc[i][1] = _mm512_fmadd_pd(vb, _mm512_loadu_pd(dst + 8), acc[i][1]);
+            }
+            _mm512_storeu_pd(dst, acc[i][0]);
+            _mm512_storeu_pd(dst + 8, acc[i][1]);
+        }
+    } else {
+        double buf[AVX512_MR * AVX512_NR];
+        for (int i = 0; i < AVX512_MR; i++) {
+            _mm512_storeu_pd(buf + i * AVX512_NR, acc[i][0]);
+            _mm512_storeu_pd(buf + i * AVX512_NR + 8, acc[i][1]);
+        }
+        store_edge_tile(c, ldc, buf, AVX512_NR, m, n, alpha, beta);
+    }
+}
+
+#pragma GCC pop_options
+
+static const kernel_table avx512_kernels = {
+    "avx512", add_avx512, sub_avx512, neg_avx512, abs_avx512, fill_avx512,
+    uniform_avx512, normal_avx512,
+    AVX512_MR, AVX512_NR, micro_kernel_avx512
+};
+
+#endif
+
+static const kernel_table *kernels = NULL;
+
+/*
+ * Picks the fastest variant the CPU supports. The environment variable NUMC_BACKEND can
+ * name a slower variant instead, which is useful for testing the fallbacks on a new machine.
+ * Returns the selected table.
+ */
+const kernel_table *select_kernels(void) {
+    const kernel_table *best = &scalar_kernels;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    const kernel_table *supported[4] = {&scalar_kernels, NULL, NULL, NULL};
+    if (__builtin_cpu_supports("sse2")) {
+        supported[1] = best = &sse2_kernels;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        supported[2] = best = &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("fma")) {
+        supported[3] = best = &avx512_kernels;
+    }
+    const char *name = getenv("NUMC_BACKEND");
+    if (name != NULL) {
+        for (int i = 0; i < 4; i++) {
+            if (supported[i] != NULL && strcmp(supported[i] -> name, name) == 0) {
+                best = supported[i];
+            }
+        }
+    }
+#endif
+    kernels = best;
+    return best;
+}
+
+/* Returns the table selected by select_kernels(), selecting one on first use */
+const kernel_table *active_kernels(void) {
+    const kernel_table *k = kernels;
+    return k != NULL ? k : select_kernels();
+}
+
+/* Returns the portable scalar table, which has no setup cost for very short loops */
+const kernel_table *scalar_kernel_table(void) {
+    return &scalar_kernels;
+}
+
+/* Computes one Philox4x32-10 block, for checking the generator against published test vectors */
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t x0 = ctr[0], x1 = ctr[1], x2 = ctr[2], x3 = ctr[3];
+    philox_block(&x0, &x1, &x2, &x3, 1, key[0], key[1]);
+    out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+}
@@ -0,0 +1,48 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+/*
+ * Inner loops of the matrix operations, compiled once per instruction set. matrix.c never
+ * calls them directly; it asks for the table of the best variant the CPU supports and goes
+ * through its function pointers.
+ */
+typedef struct kernel_table {
+    const char *name; // "scalar", "sse2", "avx2" or "avx512"
+    void (*add)(double *dst, const double *a, const double *b, int64_t n);
+    void (*sub)(double *dst, const double *a, const double *b, int64_t n);
+    void (*neg)(double *dst, const double *a, int64_t n);
+    void (*abs)(double *dst, const double *a, int64_t n);
+    void (*fill)(double *dst, double val, int64_t n);
+    /*
+     * Random fills. Entry i of `dst` gets the value Philox4x32-10 yields for the counter
+     * `first + i` under `key`, so the numbers only depend on the seed and on their position in
+     * the matrix, never on how the entries are split between calls or threads.
+     * uniform draws from [a, b); normal draws from a normal distribution with mean a and
+     * standard deviation b.
+     */
+    void (*uniform)(double *dst, uint64_t key, uint64_t first, int64_t n, double a, double b);
+    void (*normal)(double *dst, uint64_t key, uint64_t first, int64_t n, double a, double b);
+    int mr; // rows of the register tile of the micro kernel
+    int nr; // columns of the register tile of the micro kernel
+    /*
+     * Computes the mr x nr product of a packed sliver of A and a packed sliver of B over `kc`
+     * and stores `alpha` times it plus `beta` times the old contents to the tile `c` (row
+     * length `ldc`), of which only the top-left `m` x `n` entries are valid. If `beta` is 0
+     * the old contents are not read at all, so they may be uninitialized.
+     */
+    void (*micro_kernel)(int kc, const double *ap, const double *bp, double *c, int64_t ldc,
+                         int m, int n, double alpha, double beta);
+} kernel_table;
+
+/* Largest register tile over all variants, used to size the packing buffers */
+#define KERNEL_MAX_MR 8
+#define KERNEL_MAX_NR 16
+
+const kernel_table *select_kernels(void);
+const kernel_table *active_kernels(void);
+const kernel_table *scalar_kernel_table(void);
+void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]);
+
+#endif
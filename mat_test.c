@@ -1,7 +1,18 @@
 #include "CUnit/CUnit.h"
 #include "CUnit/Basic.h"
 #include "matrix.h"
+#include "expr.h"
+#include "kernels.h"
+#include "pool.h"
+#include "storage.h"
+#include "ooc.h"
+#include "stats.h"
+#include "trace.h"
+#include "numa.h"
+#include "executor.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 /* Test Suite setup and cleanup functions: */
 int init_suite(void) { return 0; }
@@ -156,6 +167,8 @@ void alloc_fail_test(void) {
   CU_ASSERT_EQUAL(allocate_matrix(&mat, 0, 0), -1);
   CU_ASSERT_EQUAL(allocate_matrix(&mat, 0, 1), -1);
   CU_ASSERT_EQUAL(allocate_matrix(&mat, 1, 0), -1);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat, (int64_t)1 << 40, (int64_t)1 << 40), -1);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat, INT64_MAX, 2), -1);
 }
 
 void alloc_success_test(void) {
@@ -201,6 +214,471 @@ void alloc_ref_success_test(void) {
   deallocate_matrix(mat);
 }
 
+void alloc_view_test(void) {
+  matrix *mat = NULL;
+  matrix *from = NULL;
+  allocate_matrix(&from, 4, 5);
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 5; j++) {
+      set(from, i, j, i * 5 + j);
+    }
+  }
+  // rows 1 and 3, columns 4, 2 and 0
+  CU_ASSERT_EQUAL(allocate_matrix_view(&mat, from, 9, 2, 3, 10, -2), 0);
+  CU_ASSERT_PTR_EQUAL(mat->parent, from);
+  CU_ASSERT_EQUAL(from->ref_cnt, 2);
+  CU_ASSERT_EQUAL(get(mat, 0, 0), 9);
+  CU_ASSERT_EQUAL(get(mat, 0, 2), 5);
+  CU_ASSERT_EQUAL(get(mat, 1, 1), 17);
+  set(mat, 1, 2, -1);
+  CU_ASSERT_EQUAL(get(from, 3, 0), -1);
+  deallocate_matrix(from);
+  deallocate_matrix(mat);
+}
+
+void strided_ops_test(void) {
+  matrix *from = NULL;
+  matrix *view = NULL;
+  matrix *result = NULL;
+  allocate_matrix(&from, 4, 4);
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      set(from, i, j, i * 4 + j);
+    }
+  }
+  // every other column, a 4 x 2 view
+  allocate_matrix_view(&view, from, 0, 4, 2, 4, 2);
+  allocate_matrix(&result, 4, 2);
+  add_matrix(result, view, view);
+  CU_ASSERT_EQUAL(get(result, 3, 1), 2 * 14);
+  neg_matrix(result, view);
+  CU_ASSERT_EQUAL(get(result, 2, 0), -8);
+  fill_matrix(view, 1);
+  CU_ASSERT_EQUAL(get(from, 1, 2), 1);
+  CU_ASSERT_EQUAL(get(from, 1, 3), 7);
+  deallocate_matrix(result);
+  allocate_matrix(&result, 2, 2);
+  // rows 0 and 2 of the view times the first two rows of the view
+  matrix *top = NULL;
+  matrix *even = NULL;
+  allocate_matrix_view(&top, view, 0, 2, 2, 4, 2);
+  allocate_matrix_view(&even, view, 0, 2, 2, 8, 2);
+  set(from, 0, 0, 2);
+  mul_matrix(result, even, top);
+  CU_ASSERT_EQUAL(get(result, 0, 0), 2 * 2 + 1 * 1);
+  CU_ASSERT_EQUAL(get(result, 1, 1), 1 * 1 + 1 * 1);
+  deallocate_matrix(top);
+  deallocate_matrix(even);
+  deallocate_matrix(result);
+  deallocate_matrix(view);
+  deallocate_matrix(from);
+}
+
+static int released = 0;
+
+static void count_release(void *owner) {
+  released += *(int *)owner;
+}
+
+void alloc_external_test(void) {
+  double data[6] = {0, 1, 2, 3, 4, 5};
+  int one = 1;
+  matrix *mat = NULL;
+  matrix *slice = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix_external(&mat, data, 2, 3, count_release, &one), 0);
+  CU_ASSERT_PTR_EQUAL(mat->data, data);
+  CU_ASSERT_EQUAL(get(mat, 1, 2), 5);
+  allocate_matrix_ref(&slice, mat, 3, 1, 3);
+  deallocate_matrix(mat);
+  CU_ASSERT_EQUAL(released, 0);
+  deallocate_matrix(slice);
+  CU_ASSERT_EQUAL(released, 1);
+}
+
+void gemm_test(void) {
+  matrix *result = NULL;
+  matrix *mat1 = NULL;
+  matrix *mat2 = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&result, 2, 3), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat1, 4, 2), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat2, 3, 4), 0);
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 2; j++) {
+      set(mat1, i, j, i - j);
+    }
+    for (int j = 0; j < 3; j++) {
+      set(mat2, j, i, i * j + 1);
+    }
+  }
+  fill_matrix(result, 1);
+  /* result = 2 * mat1^T * mat2^T + 3 * result */
+  CU_ASSERT_EQUAL(gemm_matrix(result, 2, 1, mat1, 1, mat2, 3), 0);
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 3; j++) {
+      double dot = 0;
+      for (int k = 0; k < 4; k++) {
+        dot += (k - i) * (k * j + 1);
+      }
+      CU_ASSERT_EQUAL(get(result, i, j), 2 * dot + 3);
+    }
+  }
+  CU_ASSERT_NOT_EQUAL(gemm_matrix(result, 1, 0, mat1, 1, mat2, 0), 0);
+  deallocate_matrix(result);
+  deallocate_matrix(mat1);
+  deallocate_matrix(mat2);
+}
+
+void expr_test(void) {
+  matrix *result = NULL;
+  matrix *mat1 = NULL;
+  matrix *mat2 = NULL;
+  matrix *view = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&result, 3, 2), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat1, 3, 2), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mat2, 2, 3), 0);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      set(mat1, i, j, i * 2 + j);
+      set(mat2, j, i, i - j * 4);
+    }
+  }
+  /* the transpose of mat2 as a strided view */
+  CU_ASSERT_EQUAL(allocate_matrix_view(&view, mat2, 0, 3, 2, 1, 3), 0);
+  expr *a = expr_leaf(mat1);
+  expr *b = expr_leaf(view);
+  expr *diff = expr_binary(EXPR_SUB, a, b);
+  expr *abs_diff = expr_unary(EXPR_ABS, diff);
+  expr *e = expr_binary(EXPR_ADD, abs_diff, a);
+  CU_ASSERT_EQUAL(e->nodes, 6);
+  CU_ASSERT(expr_reads(e, mat2));
+  CU_ASSERT(!expr_reads(e, result));
+  CU_ASSERT_EQUAL(expr_evaluate(result, e), 0);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 2; j++) {
+      double x = i * 2 + j, y = i - j * 4;
+      CU_ASSERT_EQUAL(get(result, i, j), (x > y ? x - y : y - x) + x);
+    }
+  }
+  expr_release(a);
+  expr_release(b);
+  expr_release(diff);
+  expr_release(abs_diff);
+  expr_release(e);
+  deallocate_matrix(view);
+  deallocate_matrix(result);
+  deallocate_matrix(mat1);
+  deallocate_matrix(mat2);
+}
+
+/* Adds each iteration to the counter of its slot, so no two iterations of a slot may overlap */
+static void pool_count_body(void *ctx, long i, int slot) {
+  long *counts = (long *)ctx;
+  counts[slot] += i;
+}
+
+void rand_test(void) {
+  /* Known-answer vectors of the Random123 distribution for Philox4x32-10 */
+  uint32_t zero[4] = {0, 0, 0, 0}, ones[4] = {~0u, ~0u, ~0u, ~0u}, out[4];
+  philox4x32(zero, zero, out);
+  CU_ASSERT(out[0] == 0x6627e8d5 && out[1] == 0xe169c58d && out[2] == 0xbc57ac4c && out[3] == 0x9b00dbd8);
+  philox4x32(ones, ones, out);
+  CU_ASSERT(out[0] == 0x408f276d && out[1] == 0x41c83b0e && out[2] == 0xa20bc7c6 && out[3] == 0x6d5451fd);
+  /* A strided view gets the same numbers as a contiguous matrix of its shape */
+  matrix *mat = NULL;
+  matrix *parent = NULL;
+  matrix *view = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&mat, 3, 5), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&parent, 6, 10), 0);
+  CU_ASSERT_EQUAL(allocate_matrix_view(&view, parent, 1, 3, 5, 20, 2), 0);
+  rand_matrix(mat, 42, -1, 1);
+  rand_matrix(view, 42, -1, 1);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 5; j++) {
+      CU_ASSERT_EQUAL(get(view, i, j), get(mat, i, j));
+      CU_ASSERT(get(mat, i, j) >= -1 && get(mat, i, j) < 1);
+    }
+  }
+  randn_matrix(mat, 42, 0, 1);
+  CU_ASSERT_NOT_EQUAL(get(mat, 0, 0), get(view, 0, 0));
+  deallocate_matrix(view);
+  deallocate_matrix(parent);
+  deallocate_matrix(mat);
+}
+
+void pool_test(void) {
+  long counts[8] = {0};
+  pool_parallel_for(10000, 8, pool_count_body, counts);
+  long sum = 0;
+  for (int s = 0; s < 8; s++) {
+    sum += counts[s];
+  }
+  CU_ASSERT_EQUAL(sum, 10000L * 9999 / 2);
+  CU_ASSERT(pool_workers() >= 1);
+  /* Workers are pinned only to CPUs the process may run on, so pinning succeeds under any mask */
+  CU_ASSERT(pool_cores() >= 1);
+  CU_ASSERT_EQUAL(pool_set_pinning(1), 0);
+  long pinned[8] = {0};
+  pool_parallel_for(10000, 8, pool_count_body, pinned);
+  CU_ASSERT_EQUAL(pinned[0] + pinned[1] + pinned[2] + pinned[3] + pinned[4] + pinned[5] + pinned[6] + pinned[7],
+                  10000L * 9999 / 2);
+  CU_ASSERT_EQUAL(pool_set_pinning(0), 0);
+  /* Fewer iterations than threads, then a restart after shutting down */
+  pool_shutdown();
+  CU_ASSERT_EQUAL(pool_workers(), 0);
+  long few[8] = {0};
+  pool_parallel_for(3, 8, pool_count_body, few);
+  CU_ASSERT_EQUAL(few[0] + few[1] + few[2], 3);
+  pool_shutdown();
+}
+
+void storage_test(void) {
+  const char *path = "numc_storage_test.numc";
+  matrix *mat = NULL;
+  matrix *slice = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&mat, 5, 7), 0);
+  for (int i = 0; i < 35; i++) {
+    mat->data[i] = i * 0.5 - 3;
+  }
+  /* Every other column, saved contiguously */
+  CU_ASSERT_EQUAL(allocate_matrix_view(&slice, mat, 0, 5, 4, 7, 2), 0);
+  CU_ASSERT_EQUAL(matrix_save(path, slice), STORAGE_OK);
+  for (int use_mmap = 0; use_mmap < 2; use_mmap++) {
+    matrix *loaded = NULL;
+    CU_ASSERT_EQUAL(matrix_load(&loaded, path, use_mmap, 1), STORAGE_OK);
+    CU_ASSERT_EQUAL(loaded->rows, 5);
+    CU_ASSERT_EQUAL(loaded->cols, 4);
+    for (int i = 0; i < 5; i++) {
+      for (int j = 0; j < 4; j++) {
+        CU_ASSERT_EQUAL(get(loaded, i, j), get(slice, i, j));
+      }
+    }
+    CU_ASSERT_EQUAL((uintptr_t)loaded->data % 64, 0);
+    deallocate_matrix(loaded);
+  }
+  /* A flipped bit in the data is caught */
+  FILE *f = fopen(path, "r+b");
+  fseek(f, STORAGE_HEADER_SIZE + 3, SEEK_SET);
+  int byte = fgetc(f);
+  fseek(f, STORAGE_HEADER_SIZE + 3, SEEK_SET);
+  fputc(byte ^ 4, f);
+  fclose(f);
+  matrix *loaded = NULL;
+  CU_ASSERT_EQUAL(matrix_load(&loaded, path, 0, 1), STORAGE_CHECKSUM);
+  CU_ASSERT_EQUAL(matrix_load(&loaded, path, 1, 1), STORAGE_CHECKSUM);
+  remove(path);
+  CU_ASSERT_EQUAL(matrix_load(&loaded, path, 1, 0), STORAGE_IO);
+  deallocate_matrix(slice);
+  deallocate_matrix(mat);
+}
+
+void ooc_test(void) {
+  /* A 70 x 50 product in tiles of 16, through a cache that holds only six tiles */
+  ooc_set_budget(6 * 16 * 16 * sizeof(double));
+  ooc_matrix *a = NULL, *b = NULL, *c = NULL;
+  CU_ASSERT_EQUAL(ooc_create(&a, "numc_ooc_a.tiles", 70, 40, 16), STORAGE_OK);
+  CU_ASSERT_EQUAL(ooc_create(&b, "numc_ooc_b.tiles", 40, 50, 16), STORAGE_OK);
+  CU_ASSERT_EQUAL(ooc_create(&c, "numc_ooc_c.tiles", 70, 50, 16), STORAGE_OK);
+  matrix *ma = NULL, *mb = NULL, *mc = NULL, *out = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&ma, 70, 40), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mb, 40, 50), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&mc, 70, 50), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&out, 70, 50), 0);
+  rand_matrix(ma, 1, -1, 1);
+  rand_matrix(mb, 2, -1, 1);
+  CU_ASSERT_EQUAL(ooc_write_block(a, 0, 0, ma), 0);
+  CU_ASSERT_EQUAL(ooc_write_block(b, 0, 0, mb), 0);
+  CU_ASSERT_EQUAL(ooc_mul(c, a, b), 0);
+  CU_ASSERT_EQUAL(mul_matrix(mc, ma, mb), 0);
+  CU_ASSERT_EQUAL(ooc_read_block(out, c, 0, 0), 0);
+  for (int i = 0; i < 70 * 50; i++) {
+    CU_ASSERT_DOUBLE_EQUAL(out->data[i], mc->data[i], 1e-12);
+  }
+  CU_ASSERT_EQUAL(ooc_mul(c, a, a), 1);
+  /* A read failing halfway through a tile of a product leaves that tile as the file has it */
+  CU_ASSERT_EQUAL(ooc_flush(c), 0);
+  CU_ASSERT_PTR_NOT_NULL(ooc_pin(b, 0, 0, OOC_READ));
+  int fd = b->fd;
+  b->fd = -1;
+  CU_ASSERT_EQUAL(ooc_mul(c, a, b), -1);
+  b->fd = fd;
+  ooc_unpin(b, 0, 0, 0);
+  CU_ASSERT_EQUAL(ooc_read_block(out, c, 0, 0), 0);
+  for (int i = 0; i < 70 * 50; i++) {
+    CU_ASSERT_DOUBLE_EQUAL(out->data[i], mc->data[i], 1e-12);
+  }
+  ooc_stats stats;
+  ooc_get_stats(&stats);
+  CU_ASSERT(stats.writes > 0); // the cache was too small to keep the results
+  /* Closing writes back the tiles still cached, so a reopened file has the same entries */
+  CU_ASSERT_EQUAL(ooc_close(c), 0);
+  CU_ASSERT_EQUAL(ooc_open(&c, "numc_ooc_c.tiles"), STORAGE_OK);
+  CU_ASSERT_EQUAL(c->rows, 70);
+  CU_ASSERT_EQUAL(c->cols, 50);
+  CU_ASSERT_EQUAL(ooc_add(c, c, c), 0);
+  CU_ASSERT_EQUAL(ooc_read_block(out, c, 0, 0), 0);
+  CU_ASSERT_DOUBLE_EQUAL(out->data[69 * 50 + 49], 2 * mc->data[69 * 50 + 49], 1e-12);
+  CU_ASSERT_EQUAL(ooc_read_block(out, c, 1, 0), 1);
+  CU_ASSERT_EQUAL(ooc_close(a), 0);
+  CU_ASSERT_EQUAL(ooc_close(b), 0);
+  CU_ASSERT_EQUAL(ooc_close(c), 0);
+  remove("numc_ooc_a.tiles");
+  remove("numc_ooc_b.tiles");
+  remove("numc_ooc_c.tiles");
+  ooc_set_budget(OOC_DEFAULT_BUDGET);
+  ooc_shutdown();
+  deallocate_matrix(ma);
+  deallocate_matrix(mb);
+  deallocate_matrix(mc);
+  deallocate_matrix(out);
+}
+
+void stats_test(void) {
+  matrix *a = NULL;
+  matrix *b = NULL;
+  matrix *c = NULL;
+  int was = stats_set_enabled(1);
+  stats_reset();
+  CU_ASSERT_EQUAL(allocate_matrix(&a, 40, 30), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&b, 30, 20), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&c, 40, 20), 0);
+  CU_ASSERT_EQUAL(add_matrix(a, a, a), 0);
+  CU_ASSERT_EQUAL(add_matrix(a, a, a), 0);
+  CU_ASSERT_EQUAL(mul_matrix(c, a, b), 0);
+  CU_ASSERT_NOT_EQUAL(add_matrix(a, a, b), 0); // shape mismatches are not counted
+  stats_counter counter;
+  stats_get(STATS_ADD, 1, &counter); // 1200 entries
+  CU_ASSERT_EQUAL(counter.calls, 2);
+  CU_ASSERT_EQUAL(counter.flops, 2 * 1200);
+  CU_ASSERT_EQUAL(counter.bytes_read, 2 * 2 * 1200 * sizeof(double));
+  CU_ASSERT_EQUAL(counter.bytes_written, 2 * 1200 * sizeof(double));
+  CU_ASSERT(counter.max_ns <= counter.ns);
+  stats_get(STATS_GEMM, 1, &counter);
+  CU_ASSERT_EQUAL(counter.calls, 1);
+  CU_ASSERT_EQUAL(counter.flops, 2 * 40 * 20 * 30);
+  CU_ASSERT(counter.alloc_bytes > 0); // the packing buffers
+  stats_get(STATS_ADD, 0, &counter);
+  CU_ASSERT_EQUAL(counter.calls, 0);
+  stats_reset();
+  stats_get(STATS_GEMM, 1, &counter);
+  CU_ASSERT_EQUAL(counter.calls, 0);
+  stats_set_enabled(0);
+  CU_ASSERT_EQUAL(add_matrix(a, a, a), 0);
+  stats_get(STATS_ADD, 1, &counter);
+  CU_ASSERT_EQUAL(counter.calls, 0);
+  stats_set_enabled(was);
+  deallocate_matrix(a);
+  deallocate_matrix(b);
+  deallocate_matrix(c);
+}
+
+void trace_test(void) {
+  matrix *a = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&a, 100, 100), 0);
+  trace_start(3);
+  CU_ASSERT_EQUAL(add_matrix(a, a, a), 0);
+  CU_ASSERT_EQUAL(trace_stop("numc_trace_test.json"), 3); // the add and its 3 tiles, the oldest dropped
+  FILE *f = fopen("numc_trace_test.json", "r");
+  CU_ASSERT_PTR_NOT_NULL(f);
+  if (f != NULL) {
+    char text[4096];
+    size_t n = fread(text, 1, sizeof(text) - 1, f);
+    text[n] = 0;
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\"traceEvents\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\"name\": \"elementwise tile\", \"ph\": \"X\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(text, "\"dropped_events\": 1"));
+    fclose(f);
+  }
+  remove("numc_trace_test.json");
+  CU_ASSERT_EQUAL(add_matrix(a, a, a), 0); // not traced any more
+  CU_ASSERT_EQUAL(trace_stop("/nonexistent/numc_trace_test.json"), -1);
+  deallocate_matrix(a);
+}
+
+void numa_test(void) {
+  numa_policy saved = numa_get_policy();
+  CU_ASSERT(numa_nodes() >= 1);
+  for (int p = NUMA_LOCAL; p <= NUMA_INTERLEAVE; p++) {
+    numa_set_policy((numa_policy)p);
+    CU_ASSERT_EQUAL(numa_get_policy(), p);
+    matrix *a = NULL;
+    CU_ASSERT_EQUAL(allocate_matrix(&a, 512, 512), 0); // 2 MiB, mapped fresh or reused
+    int zero = 1;
+    for (int i = 0; i < 512 * 512; i++) zero &= a -> data[i] == 0;
+    CU_ASSERT(zero);
+    fill_matrix(a, 1);
+    size_t per_node[NUMA_MAX_NODES];
+    int top = numa_node_bytes(a -> data, 512 * 512 * sizeof(double), per_node);
+    size_t total = 0;
+    for (int n = 0; n < top; n++) total += per_node[n];
+    CU_ASSERT(top < 0 || total >= 512 * 512 * sizeof(double)); // -1 without numa_maps
+    deallocate_matrix(a);
+  }
+  numa_set_policy(saved);
+}
+
+/* Operands of the executor_test tasks */
+typedef struct task_args {
+  matrix *result, *a, *b;
+  int *gate; // the task spins until this is set, if not NULL
+  int runs; // times the task ran
+  int fail;
+} task_args;
+
+static int run_add(void *arg) {
+  task_args *t = (task_args *)arg;
+  while (t -> gate != NULL && !__atomic_load_n(t -> gate, __ATOMIC_ACQUIRE)) {
+  }
+  t -> runs++;
+  return t -> fail ? 1 : add_matrix(t -> result, t -> a, t -> b);
+}
+
+void executor_test(void) {
+  matrix *a = NULL, *b = NULL, *c = NULL, *d = NULL;
+  CU_ASSERT_EQUAL(allocate_matrix(&a, 50, 50), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&b, 50, 50), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&c, 50, 50), 0);
+  CU_ASSERT_EQUAL(allocate_matrix(&d, 50, 50), 0);
+  fill_matrix(a, 1);
+  int gate = 0;
+  /* b = a + a waits for the gate, c = b + a after it, d = c + b after both */
+  task_args first = {b, a, a, &gate, 0, 0}, second = {c, b, a, NULL, 0, 0}, third = {d, c, b, NULL, 0, 0};
+  task *t1 = executor_submit(run_add, &first, NULL, 0);
+  task *t2 = executor_submit(run_add, &second, &t1, 1);
+  task *deps[] = {t2, t1};
+  task *t3 = executor_submit(run_add, &third, deps, 2);
+  CU_ASSERT_PTR_NOT_NULL(t3);
+  CU_ASSERT_EQUAL(executor_wait(t3, 0.01), 0);
+  CU_ASSERT(!executor_done(t2));
+  CU_ASSERT_EQUAL(second.runs, 0);
+  __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+  CU_ASSERT(executor_wait(t3, -1));
+  CU_ASSERT(executor_done(t1) && executor_done(t2));
+  CU_ASSERT_EQUAL(executor_status(t3), 0);
+  CU_ASSERT_EQUAL(get(d, 49, 49), 5);
+  executor_release(t1);
+  executor_release(t2);
+  executor_release(t3);
+  /* Tasks depending on a failed task finish without running, even when submitted after it failed */
+  task_args failing = {b, a, a, NULL, 0, 1}, skipped = {c, b, a, NULL, 0, 0}, late = {d, b, a, NULL, 0, 0};
+  t1 = executor_submit(run_add, &failing, NULL, 0);
+  t2 = executor_submit(run_add, &skipped, &t1, 1);
+  CU_ASSERT(executor_wait(t2, -1));
+  t3 = executor_submit(run_add, &late, &t1, 1);
+  CU_ASSERT(executor_wait(t3, -1));
+  CU_ASSERT_EQUAL(executor_status(t1), 1);
+  CU_ASSERT_EQUAL(executor_status(t2), TASK_DEPENDENCY_FAILED);
+  CU_ASSERT_EQUAL(executor_status(t3), TASK_DEPENDENCY_FAILED);
+  CU_ASSERT_EQUAL(skipped.runs + late.runs, 0);
+  CU_ASSERT_EQUAL(executor_pending(), 0);
+  executor_release(t1);
+  executor_release(t2);
+  executor_release(t3);
+  deallocate_matrix(a);
+  deallocate_matrix(b);
+  deallocate_matrix(c);
+  deallocate_matrix(d);
+}
+
 void dealloc_null_test(void) {
   matrix *mat = NULL;
   deallocate_matrix(mat); // Test the null case doesn't crash
@@ -265,6 +743,19 @@ int main (void)
         (CU_add_test(pSuite, "alloc_success_test", alloc_success_test) == NULL) ||
         (CU_add_test(pSuite, "alloc_ref_fail_test", alloc_ref_fail_test) == NULL) ||
         (CU_add_test(pSuite, "alloc_ref_success_test", alloc_ref_success_test) == NULL) ||
+        (CU_add_test(pSuite, "alloc_view_test", alloc_view_test) == NULL) ||
+        (CU_add_test(pSuite, "strided_ops_test", strided_ops_test) == NULL) ||
+        (CU_add_test(pSuite, "alloc_external_test", alloc_external_test) == NULL) ||
+        (CU_add_test(pSuite, "gemm_test", gemm_test) == NULL) ||
+        (CU_add_test(pSuite, "expr_test", expr_test) == NULL) ||
+        (CU_add_test(pSuite, "rand_test", rand_test) == NULL) ||
+        (CU_add_test(pSuite, "pool_test", pool_test) == NULL) ||
+        (CU_add_test(pSuite, "storage_test", storage_test) == NULL) ||
+        (CU_add_test(pSuite, "ooc_test", ooc_test) == NULL) ||
+        (CU_add_test(pSuite, "stats_test", stats_test) == NULL) ||
+        (CU_add_test(pSuite, "trace_test", trace_test) == NULL) ||
+        (CU_add_test(pSuite, "numa_test", numa_test) == NULL) ||
+        (CU_add_test(pSuite, "executor_test", executor_test) == NULL) ||
         (CU_add_test(pSuite, "dealloc_null_test", dealloc_null_test) == NULL) ||
         (CU_add_test(pSuite, "get_test", get_test) == NULL) ||
         (CU_add_test(pSuite, "set_test", set_test) == NULL)
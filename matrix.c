@@ -1,30 +1,22 @@
 #include "matrix.h"
+#include "kernels.h"
+#include "alloc.h"
+#include "threading.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <omp.h>
-
-// Include SSE intrinsics
-#if defined(_MSC_VER)
-#include <intrin.h>
-#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
-#include <immintrin.h>
-#include <x86intrin.h>
-#endif
-
-/* Below are some intel intrinsics that might be useful
- * void _mm256_storeu_pd (double * mem_addr, __m256d a)
- * __m256d _mm256_set1_pd (double a)
- * __m256d _mm256_set_pd (double e3, double e2, double e1, double e0)
- * __m256d _mm256_loadu_pd (double const * mem_addr)
- * __m256d _mm256_add_pd (__m256d a, __m256d b)
- * __m256d _mm256_sub_pd (__m256d a, __m256d b)
- * __m256d _mm256_fmadd_pd (__m256d a, __m256d b, __m256d c)
- * __m256d _mm256_mul_pd (__m256d a, __m256d b)
- * __m256d _mm256_cmp_pd (__m256d a, __m256d b, const int imm8)
- * __m256d _mm256_and_pd (__m256d a, __m256d b)
- * __m256d _mm256_max_pd (__m256d a, __m256d b)
-*/
+#include <string.h>
+
+/* As ELEMENTWISE_CHUNK of threading.h, for matrices that are not contiguous, where the chunks are
+ * gathered through stack buffers */
+#define STRIDED_CHUNK 512
+
+/* Most entries a matrix may have: its size in bytes, and all offsets into it, fit a ptrdiff_t */
+#define MAX_ENTRIES ((int64_t)(PTRDIFF_MAX / sizeof(double)))
 
 /* Generates a random double between low and high */
 double rand_double(double low, double high) {
@@ -33,48 +25,98 @@ double rand_double(double low, double high) {
     return low + (rand() / div);
 }
 
-/* Generates a random matrix */
-void rand_matrix(matrix *result, unsigned int seed, double low, double high) {
+/*
+ * Generates a random matrix from srand(seed) and rand(), entry by entry in row-major order.
+ * This is the original generator, kept so that matrices can be compared with those of
+ * reference implementations that use it; it resets the process-wide C generator and runs on
+ * one thread. rand_matrix is the fast, reproducible one.
+ */
+void rand_matrix_libc(matrix *result, unsigned int seed, double low, double high) {
     srand(seed);
-    for (int i = 0; i < result->rows; i++) {
-        for (int j = 0; j < result->cols; j++) {
+    for (int64_t i = 0; i < result->rows; i++) {
+        for (int64_t j = 0; j < result->cols; j++) {
             set(result, i, j, rand_double(low, high));
         }
     }
 }
 
 /*
- * Allocates space for a matrix struct pointed to by the double pointer mat with
- * `rows` rows and `cols` columns. You should also allocate memory for the data array
- * and initialize all entries to be zeros. `parent` should be set to NULL to indicate that
- * this matrix is not a slice. You should also set `ref_cnt` to 1.
- * You should return -1 if either `rows` or `cols` or both have invalid values, or if any
- * call to allocate memory in this function fails. Return 0 upon success.
+ * Returns nonzero, with an exception set, unless a `rows` x `cols` matrix is possible: both
+ * positive, and rows * cols entries addressable without overflowing.
  */
-int allocate_matrix(matrix **mat, int rows, int cols) {
+static int invalid_shape(int64_t rows, int64_t cols) {
     if (rows < 1 || cols < 1) {
         PyErr_SetString(PyExc_TypeError, "Invalid Dimension");
-        return -1;
+        return 1;
+    }
+    if (rows > MAX_ENTRIES / cols) {
+        PyErr_SetString(PyExc_ValueError, "Matrix is too large");
+        return 1;
     }
+    return 0;
+}
+
+/* Allocates a matrix that owns its data. The data is zeroed if `zero` is set. */
+static int new_matrix(matrix **mat, int64_t rows, int64_t cols, int zero) {
+    if (invalid_shape(rows, cols)) return -1;
+    TRACE_BEGIN(span);
     matrix *ptr = (matrix *)malloc(sizeof(matrix));
     if (ptr == NULL) return -1;
     ptr -> rows = rows; ptr -> cols = cols;
-    ptr -> data = (double *)calloc(rows * cols, sizeof(double));
-    if (ptr -> data == NULL) return -1;
+    ptr -> row_stride = cols; ptr -> col_stride = 1;
+    ptr -> data = alloc_data((size_t)rows * cols, zero);
+    if (ptr -> data == NULL) {
+        free(ptr);
+        return -1;
+    }
+    TRACE_END(span, "allocate_matrix", (long)(rows * cols));
     ptr -> ref_cnt = 1;
     ptr -> parent = NULL;
+    ptr -> release = NULL; ptr -> owner = NULL;
     *mat = ptr;
     return 0;
 }
 
+/*
+ * Allocates space for a matrix struct pointed to by the double pointer mat with
+ * `rows` rows and `cols` columns. You should also allocate memory for the data array
+ * and initialize all entries to be zeros. `parent` should be set to NULL to indicate that
+ * this matrix is not a slice. You should also set `ref_cnt` to 1.
+ * You should return -1 if either `rows` or `cols` or both have invalid values, or if any
+ * call to allocate memory in this function fails. Return 0 upon success.
+ * The data comes from the pooled allocator in alloc.c and is 64-byte aligned.
+ */
+int allocate_matrix(matrix **mat, int64_t rows, int64_t cols) {
+    return new_matrix(mat, rows, cols, 1);
+}
+
+/*
+ * Same as allocate_matrix, but leaves the entries uninitialized. Use it for results whose
+ * every entry is about to be overwritten, so that their data is not zeroed for nothing.
+ */
+int allocate_matrix_uninit(matrix **mat, int64_t rows, int64_t cols) {
+    return new_matrix(mat, rows, cols, 0);
+}
+
 /*
  * Allocates space for a matrix struct pointed to by `mat` with `rows` rows and `cols` columns.
  * Its data should point to the `offset`th entry of `from`'s data (you do not need to allocate memory)
  * for the data field. `parent` should be set to `from` to indicate this matrix is a slice of `from`.
  * You should return -1 if either `rows` or `cols` or both are non-positive or if any
  * call to allocate memory in this function fails. Return 0 upon success.
+ * The slice is laid out contiguously from `offset`; use allocate_matrix_view for anything else.
  */
-int allocate_matrix_ref(matrix **mat, matrix *from, int offset, int rows, int cols) {
+int allocate_matrix_ref(matrix **mat, matrix *from, int64_t offset, int64_t rows, int64_t cols) {
+    return allocate_matrix_view(mat, from, offset, rows, cols, cols, 1);
+}
+
+/*
+ * Like allocate_matrix_ref, but entry (i, j) of the slice is entry
+ * `offset + i * row_stride + j * col_stride` of `from`'s data. Strides may be negative, which
+ * is how reversed slices are represented.
+ */
+int allocate_matrix_view(matrix **mat, matrix *from, int64_t offset, int64_t rows, int64_t cols,
+                         int64_t row_stride, int64_t col_stride) {
     if (rows < 1 || cols < 1) {
         PyErr_SetString(PyExc_TypeError, "Invalid Dimension");
         return -1;
@@ -82,10 +124,33 @@ int allocate_matrix_ref(matrix **mat, matrix *from, int offset, int rows, int co
     matrix *ptr = (matrix *)malloc(sizeof(matrix));
     if (ptr == NULL) return -1;
     ptr -> rows = rows; ptr -> cols = cols;
+    ptr -> row_stride = row_stride; ptr -> col_stride = col_stride;
     ptr -> data = from -> data + offset;
     ptr -> ref_cnt = 1;
-    from -> ref_cnt += 1;
+    __atomic_add_fetch(&from -> ref_cnt, 1, __ATOMIC_RELAXED);
     ptr -> parent = from;
+    ptr -> release = NULL; ptr -> owner = NULL;
+    *mat = ptr;
+    return 0;
+}
+
+/*
+ * Allocates space for a matrix struct pointed to by `mat` with `rows` rows and `cols` columns
+ * whose data is the contiguous memory at `data`, which somebody else allocated. Instead of
+ * freeing the data, deallocate_matrix calls `release(owner)` once the matrix and all its slices
+ * are gone. Return -1 if the dimensions are invalid or the allocation fails, 0 upon success.
+ */
+int allocate_matrix_external(matrix **mat, double *data, int64_t rows, int64_t cols,
+                             void (*release)(void *owner), void *owner) {
+    if (invalid_shape(rows, cols)) return -1;
+    matrix *ptr = (matrix *)malloc(sizeof(matrix));
+    if (ptr == NULL) return -1;
+    ptr -> rows = rows; ptr -> cols = cols;
+    ptr -> row_stride = cols; ptr -> col_stride = 1;
+    ptr -> data = data;
+    ptr -> ref_cnt = 1;
+    ptr -> parent = NULL;
+    ptr -> release = release; ptr -> owner = owner;
     *mat = ptr;
     return 0;
 }
@@ -95,14 +160,16 @@ int allocate_matrix_ref(matrix **mat, matrix *from, int offset, int rows, int co
  * you only free the data if `mat` is not a slice and has no existing slices, or if `mat` is the
  * last existing slice of its parent matrix and its parent matrix has no other references.
  * You cannot assume that mat is not NULL.
+ * Reference counts are updated atomically, so slices of the same matrix can be made and
+ * dropped from several threads at once.
  */
 void deallocate_matrix(matrix *mat) {
     if (mat == NULL) return;
     matrix *ptr;
     while (mat) {
-        mat -> ref_cnt -= 1;
-        if (!mat -> ref_cnt) {
-            if (!mat -> parent) free(mat -> data);
+        if (!__atomic_sub_fetch(&mat -> ref_cnt, 1, __ATOMIC_ACQ_REL)) {
+            if (mat -> release) mat -> release(mat -> owner);
+            else if (!mat -> parent) free_data(mat -> data, (size_t)mat -> rows * mat -> cols);
             ptr = mat -> parent;
             free(mat);
             mat = ptr;
@@ -116,27 +183,322 @@ void deallocate_matrix(matrix *mat) {
  * Returns the double value of the matrix at the given row and column.
  * You may assume `row` and `col` are valid.
  */
-double get(matrix *mat, int row, int col) {
-    return mat -> data[col + row * mat -> cols];
+double get(matrix *mat, int64_t row, int64_t col) {
+    return mat -> data[col * mat -> col_stride + row * mat -> row_stride];
 }
 
 /*
  * Sets the value at the given row and column to val. You may assume `row` and
  * `col` are valid
  */
-void set(matrix *mat, int row, int col, double val) {
-    mat -> data[col + row * mat -> cols] = val;
+void set(matrix *mat, int64_t row, int64_t col, double val) {
+    mat -> data[col * mat -> col_stride + row * mat -> row_stride] = val;
+}
+
+/*
+ * Returns nonzero if the entries of `mat` are laid out row after row without gaps, so that
+ * the element-wise operations can treat its data as one flat array.
+ */
+int is_contiguous(matrix *mat) {
+    return mat -> col_stride == 1 && (mat -> row_stride == mat -> cols || mat -> rows == 1);
+}
+
+/*
+ * Returns a pointer to `n` consecutive entries starting at `src`, which are `stride` apart.
+ * Entries that are not adjacent in memory are gathered into `buf`.
+ */
+static const double *gather(const double *src, int64_t stride, int n, double *buf) {
+    if (stride == 1) return src;
+    for (int i = 0; i < n; i++) {
+        buf[i] = src[i * stride];
+    }
+    return buf;
+}
+
+/* Writes `n` entries from `buf` to `dst`, `stride` apart, unless `buf` already is `dst` */
+static void scatter(double *dst, int64_t stride, int n, const double *buf) {
+    if (buf == dst) return;
+    for (int i = 0; i < n; i++) {
+        dst[i * stride] = buf[i];
+    }
+}
+
+/* Copies `n` doubles; has the signature of a unary kernel so that it can go through apply_unary */
+static void copy_kernel(double *dst, const double *a, int64_t n) {
+    memcpy(dst, a, n * sizeof(double));
+}
+
+static int apply_unary(void (*op)(double *, const double *, int64_t), int threads, matrix *result,
+                       matrix *mat);
+
+/*
+ * Returns nonzero if the memory spanned by the entries of `mat1` and `mat2` overlaps.
+ * This is conservative for strided views: interleaved views that never touch the same
+ * entry are still reported as overlapping.
+ */
+int overlaps(matrix *mat1, matrix *mat2) {
+    const double *lo1 = mat1 -> data, *hi1 = mat1 -> data, *lo2 = mat2 -> data, *hi2 = mat2 -> data;
+    int64_t r1 = (mat1 -> rows - 1) * mat1 -> row_stride, c1 = (mat1 -> cols - 1) * mat1 -> col_stride;
+    int64_t r2 = (mat2 -> rows - 1) * mat2 -> row_stride, c2 = (mat2 -> cols - 1) * mat2 -> col_stride;
+    if (r1 < 0) lo1 += r1; else hi1 += r1;
+    if (c1 < 0) lo1 += c1; else hi1 += c1;
+    if (r2 < 0) lo2 += r2; else hi2 += r2;
+    if (c2 < 0) lo2 += c2; else hi2 += c2;
+    return lo1 <= hi2 && lo2 <= hi1;
+}
+
+/*
+ * Returns nonzero if writing the entries of `result` in order could overwrite entries of `mat`
+ * before they are read, which is the case when the two overlap without being the same view.
+ */
+static int clobbers(matrix *result, matrix *mat) {
+    if (result -> data == mat -> data && result -> row_stride == mat -> row_stride
+            && result -> col_stride == mat -> col_stride) {
+        return 0;
+    }
+    return overlaps(result, mat);
+}
+
+/*
+ * Arguments of the parallel loops of apply_binary, apply_unary and fill_matrix. The flat
+ * bodies run chunk `i` of ELEMENTWISE_CHUNK entries of contiguous matrices, the row bodies run
+ * row `i` in pieces of STRIDED_CHUNK entries.
+ */
+typedef struct elementwise_ctx {
+    void (*binary)(double *, const double *, const double *, int64_t);
+    void (*unary)(double *, const double *, int64_t);
+    void (*fill)(double *, double, int64_t);
+    double val;
+    matrix *result;
+    matrix *mat1;
+    matrix *mat2;
+    int64_t d; // number of entries, for the flat bodies
+} elementwise_ctx;
+
+static void binary_flat(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    TRACE_BEGIN(span);
+    int64_t start = (int64_t)i * ELEMENTWISE_CHUNK;
+    int64_t n = ctx -> d - start < ELEMENTWISE_CHUNK ? ctx -> d - start : ELEMENTWISE_CHUNK;
+    ctx -> binary(&ctx -> result -> data[start], &ctx -> mat1 -> data[start],
+                  &ctx -> mat2 -> data[start], n);
+    TRACE_END(span, "elementwise tile", i);
+}
+
+static void binary_rows(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    TRACE_BEGIN(span);
+    matrix *result = ctx -> result, *mat1 = ctx -> mat1, *mat2 = ctx -> mat2;
+    int64_t r = i, cols = result -> cols;
+    double buf1[STRIDED_CHUNK], buf2[STRIDED_CHUNK], out[STRIDED_CHUNK];
+    for (int64_t c = 0; c < cols; c += STRIDED_CHUNK) {
+        int n = cols - c < STRIDED_CHUNK ? (int)(cols - c) : STRIDED_CHUNK;
+        const double *a = gather(&mat1 -> data[r * mat1 -> row_stride + c * mat1 -> col_stride],
+                                 mat1 -> col_stride, n, buf1);
+        const double *b = gather(&mat2 -> data[r * mat2 -> row_stride + c * mat2 -> col_stride],
+                                 mat2 -> col_stride, n, buf2);
+        double *dst = &result -> data[r * result -> row_stride + c * result -> col_stride];
+        double *tmp = result -> col_stride == 1 ? dst : out;
+        ctx -> binary(tmp, a, b, n);
+        scatter(dst, result -> col_stride, n, tmp);
+    }
+    TRACE_END(span, "elementwise tile", i);
+}
+
+static void unary_flat(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    TRACE_BEGIN(span);
+    int64_t start = (int64_t)i * ELEMENTWISE_CHUNK;
+    int64_t n = ctx -> d - start < ELEMENTWISE_CHUNK ? ctx -> d - start : ELEMENTWISE_CHUNK;
+    ctx -> unary(&ctx -> result -> data[start], &ctx -> mat1 -> data[start], n);
+    TRACE_END(span, "elementwise tile", i);
+}
+
+static void unary_rows(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    TRACE_BEGIN(span);
+    matrix *result = ctx -> result, *mat = ctx -> mat1;
+    int64_t r = i, cols = result -> cols;
+    double buf[STRIDED_CHUNK], out[STRIDED_CHUNK];
+    for (int64_t c = 0; c < cols; c += STRIDED_CHUNK) {
+        int n = cols - c < STRIDED_CHUNK ? (int)(cols - c) : STRIDED_CHUNK;
+        const double *a = gather(&mat -> data[r * mat -> row_stride + c * mat -> col_stride],
+                                 mat -> col_stride, n, buf);
+        double *dst = &result -> data[r * result -> row_stride + c * result -> col_stride];
+        double *tmp = result -> col_stride == 1 ? dst : out;
+        ctx -> unary(tmp, a, n);
+        scatter(dst, result -> col_stride, n, tmp);
+    }
+    TRACE_END(span, "elementwise tile", i);
+}
+
+static void fill_flat(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    int64_t start = (int64_t)i * ELEMENTWISE_CHUNK;
+    int64_t n = ctx -> d - start < ELEMENTWISE_CHUNK ? ctx -> d - start : ELEMENTWISE_CHUNK;
+    ctx -> fill(&ctx -> result -> data[start], ctx -> val, n);
+}
+
+static void fill_rows(void *arg, long i, int slot) {
+    elementwise_ctx *ctx = (elementwise_ctx *)arg;
+    matrix *mat = ctx -> result;
+    double *row = &mat -> data[i * mat -> row_stride];
+    if (mat -> col_stride == 1) {
+        ctx -> fill(row, ctx -> val, mat -> cols);
+    } else {
+        for (int64_t c = 0; c < mat -> cols; c++) {
+            row[c * mat -> col_stride] = ctx -> val;
+        }
+    }
+}
+
+/* Returns the number of ELEMENTWISE_CHUNK chunks `d` entries are split into */
+static long flat_chunks(int64_t d) {
+    return (long)((d + ELEMENTWISE_CHUNK - 1) / ELEMENTWISE_CHUNK);
+}
+
+/*
+ * Applies a binary kernel to every entry. Contiguous operands are split into flat chunks;
+ * otherwise each row is processed in pieces of STRIDED_CHUNK entries, gathering the pieces
+ * that are not adjacent in memory through small buffers. `result` may be one of the operands;
+ * if it only partially overlaps one, the result goes through a temporary matrix. The loops
+ * run on `threads` threads, as planned by plan_elementwise.
+ * Returns nonzero if that temporary cannot be allocated.
+ */
+static int apply_binary(void (*op)(double *, const double *, const double *, int64_t), int threads,
+                        matrix *result, matrix *mat1, matrix *mat2) {
+    if (clobbers(result, mat1) || clobbers(result, mat2)) {
+        matrix *tmp;
+        if (allocate_matrix_uninit(&tmp, result -> rows, result -> cols)) return -1;
+        apply_binary(op, threads, tmp, mat1, mat2);
+        apply_unary(copy_kernel, threads, result, tmp);
+        deallocate_matrix(tmp);
+        return 0;
+    }
+    elementwise_ctx ctx = {op, NULL, NULL, 0, result, mat1, mat2, result -> rows * result -> cols};
+    if (is_contiguous(result) && is_contiguous(mat1) && is_contiguous(mat2)) {
+        pool_parallel_for(flat_chunks(ctx.d), threads, binary_flat, &ctx);
+    } else {
+        pool_parallel_for(result -> rows, threads, binary_rows, &ctx);
+    }
+    return 0;
+}
+
+/* Unary counterpart of apply_binary */
+static int apply_unary(void (*op)(double *, const double *, int64_t), int threads, matrix *result,
+                       matrix *mat) {
+    if (clobbers(result, mat)) {
+        matrix *tmp;
+        if (allocate_matrix_uninit(&tmp, result -> rows, result -> cols)) return -1;
+        apply_unary(op, threads, tmp, mat);
+        apply_unary(copy_kernel, threads, result, tmp);
+        deallocate_matrix(tmp);
+        return 0;
+    }
+    elementwise_ctx ctx = {NULL, op, NULL, 0, result, mat, NULL, result -> rows * result -> cols};
+    if (is_contiguous(result) && is_contiguous(mat)) {
+        pool_parallel_for(flat_chunks(ctx.d), threads, unary_flat, &ctx);
+    } else {
+        pool_parallel_for(result -> rows, threads, unary_rows, &ctx);
+    }
+    return 0;
 }
 
 /*
  * Sets all entries in mat to val
  */
 void fill_matrix(matrix *mat, double val) {
-    for (int r = 0; r < mat -> rows; r++) {
-        for (int c = 0; c < mat -> cols; c++) {
-            mat -> data[c + r * mat -> cols] = val;
-        }
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_FILL);
+    exec_plan plan = plan_elementwise((long)(mat -> rows * mat -> cols));
+    elementwise_ctx ctx = {NULL, NULL, plan.kernels -> fill, val, mat, NULL, NULL,
+                           mat -> rows * mat -> cols};
+    if (is_contiguous(mat)) {
+        pool_parallel_for(flat_chunks(ctx.d), plan.threads, fill_flat, &ctx);
+    } else {
+        pool_parallel_for(mat -> rows, plan.threads, fill_rows, &ctx);
     }
+    STATS_END(scope, ctx.d, 0, ctx.d * sizeof(double), 0);
+}
+
+/* Counter-based generation costs about as much per entry as this many additions */
+#define RANDOM_WORK 8
+
+/* Arguments of the parallel loops of random_fill */
+typedef struct random_ctx {
+    void (*gen)(double *, uint64_t, uint64_t, int64_t, double, double);
+    uint64_t key;
+    double a, b;
+    matrix *mat;
+} random_ctx;
+
+/* Fills chunk `i` of ELEMENTWISE_CHUNK entries of a contiguous matrix */
+static void random_flat(void *arg, long i, int slot) {
+    random_ctx *ctx = (random_ctx *)arg;
+    int64_t d = ctx -> mat -> rows * ctx -> mat -> cols;
+    int64_t start = (int64_t)i * ELEMENTWISE_CHUNK;
+    int64_t n = d - start < ELEMENTWISE_CHUNK ? d - start : ELEMENTWISE_CHUNK;
+    ctx -> gen(&ctx -> mat -> data[start], ctx -> key, (uint64_t)start, n, ctx -> a, ctx -> b);
+}
+
+/* Fills row `i` of a strided matrix */
+static void random_rows(void *arg, long i, int slot) {
+    random_ctx *ctx = (random_ctx *)arg;
+    matrix *mat = ctx -> mat;
+    int64_t r = i;
+    double buf[STRIDED_CHUNK];
+    for (int64_t c = 0; c < mat -> cols; c += STRIDED_CHUNK) {
+        int n = mat -> cols - c < STRIDED_CHUNK ? (int)(mat -> cols - c) : STRIDED_CHUNK;
+        double *dst = &mat -> data[r * mat -> row_stride + c * mat -> col_stride];
+        double *tmp = mat -> col_stride == 1 ? dst : buf;
+        ctx -> gen(tmp, ctx -> key, (uint64_t)r * mat -> cols + c, n, ctx -> a, ctx -> b);
+        scatter(dst, mat -> col_stride, n, tmp);
+    }
+}
+
+/*
+ * Fills `mat` through one of the random kernels. Entry (r, c) always gets the number for the
+ * counter r * cols + c, so the result depends on the seed and the shape only, not on the
+ * strides or on how many threads run.
+ */
+static void random_fill(matrix *mat, int normal, unsigned int seed, double a, double b) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_RAND);
+    exec_plan plan = plan_elementwise((long)(mat -> rows * mat -> cols) * RANDOM_WORK);
+    random_ctx ctx = {normal ? plan.kernels -> normal : plan.kernels -> uniform, seed, a, b, mat};
+    if (is_contiguous(mat)) {
+        pool_parallel_for(flat_chunks(mat -> rows * mat -> cols), plan.threads, random_flat, &ctx);
+    } else {
+        pool_parallel_for(mat -> rows, plan.threads, random_rows, &ctx);
+    }
+    double d = (double)mat -> rows * mat -> cols;
+    STATS_END(scope, d, 0, d * sizeof(double), 0);
+}
+
+/* Fills `result` with numbers drawn uniformly from [low, high) by the generator for `seed` */
+void rand_matrix(matrix *result, unsigned int seed, double low, double high) {
+    random_fill(result, 0, seed, low, high);
+}
+
+/* Fills `result` with normally distributed numbers of mean `mean` and standard deviation `std` */
+void randn_matrix(matrix *result, unsigned int seed, double mean, double std) {
+    random_fill(result, 1, seed, mean, std);
+}
+
+/*
+ * Copies the entries of mat to `result`, which must have the same shape. The two may be
+ * views of the same data; overlapping copies go through a temporary matrix.
+ * Return 0 upon success and a nonzero value upon failure.
+ */
+int copy_matrix(matrix *result, matrix *mat) {
+    if (result -> rows != mat -> rows || result -> cols != mat -> cols) { return 1; }
+    if (!clobbers(result, mat) && result -> data == mat -> data) { return 0; }
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_COPY);
+    double d = (double)mat -> rows * mat -> cols;
+    int failed = apply_unary(copy_kernel, plan_elementwise((long)d).threads, result, mat);
+    STATS_END(scope, d, d * sizeof(double), d * sizeof(double), 0);
+    return failed;
 }
 
 /*
@@ -145,22 +507,13 @@ void fill_matrix(matrix *mat, double val) {
  */
 int add_matrix(matrix *result, matrix *mat1, matrix *mat2) {
     if (mat1 -> rows != mat2 -> rows || mat1 -> cols != mat2 -> cols) { return 1; }
-    int d = mat1 -> rows * mat1 -> cols;
-    #pragma omp parallel for
-    for (int i = 0; i < d / 8 * 8; i += 8) {
-        result -> data[i] = mat1 -> data[i] + mat2 -> data[i];
-        result -> data[i + 1] = mat1 -> data[i + 1] + mat2 -> data[i + 1];
-        result -> data[i + 2] = mat1 -> data[i + 2] + mat2 -> data[i + 2];
-        result -> data[i + 3] = mat1 -> data[i + 3] + mat2 -> data[i + 3];
-        result -> data[i + 4] = mat1 -> data[i + 4] + mat2 -> data[i + 4];
-        result -> data[i + 5] = mat1 -> data[i + 5] + mat2 -> data[i + 5];
-        result -> data[i + 6] = mat1 -> data[i + 6] + mat2 -> data[i + 6];
-        result -> data[i + 7] = mat1 -> data[i + 7] + mat2 -> data[i + 7];
-    }
-    for (int i = d / 8 * 8; i < d; i += 1) {
-        result -> data[i] = mat1 -> data[i] + mat2 -> data[i];
-    }
-    return 0;
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_ADD);
+    double d = (double)mat1 -> rows * mat1 -> cols;
+    exec_plan plan = plan_elementwise((long)d);
+    int failed = apply_binary(plan.kernels -> add, plan.threads, result, mat1, mat2);
+    STATS_END(scope, d, 2 * d * sizeof(double), d * sizeof(double), d);
+    return failed;
 }
 
 /*
@@ -169,137 +522,258 @@ int add_matrix(matrix *result, matrix *mat1, matrix *mat2) {
  */
 int sub_matrix(matrix *result, matrix *mat1, matrix *mat2) {
     if (mat1 -> rows != mat2 -> rows || mat1 -> cols != mat2 -> cols) { return 1; }
-    int d = mat1 -> rows * mat1 -> cols;
-    #pragma omp parallel for
-    for (int i = 0; i < d / 8 * 8; i += 8) {
-        result -> data[i] = mat1 -> data[i] - mat2 -> data[i];
-        result -> data[i + 1] = mat1 -> data[i + 1] - mat2 -> data[i + 1];
-        result -> data[i + 2] = mat1 -> data[i + 2] - mat2 -> data[i + 2];
-        result -> data[i + 3] = mat1 -> data[i + 3] - mat2 -> data[i + 3];
-        result -> data[i + 4] = mat1 -> data[i + 4] - mat2 -> data[i + 4];
-        result -> data[i + 5] = mat1 -> data[i + 5] - mat2 -> data[i + 5];
-        result -> data[i + 6] = mat1 -> data[i + 6] - mat2 -> data[i + 6];
-        result -> data[i + 7] = mat1 -> data[i + 7] - mat2 -> data[i + 7];
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_SUB);
+    double d = (double)mat1 -> rows * mat1 -> cols;
+    exec_plan plan = plan_elementwise((long)d);
+    int failed = apply_binary(plan.kernels -> sub, plan.threads, result, mat1, mat2);
+    STATS_END(scope, d, 2 * d * sizeof(double), d * sizeof(double), d);
+    return failed;
+}
+
+/*
+ * Blocking parameters for the matrix multiplication. A MC x KC block of mat1 is packed so
+ * that it stays in L2, a KC x NC panel of mat2 is packed so that it stays in L3, and every
+ * mr x nr tile of the result is computed by the micro kernel of the active kernel table out
+ * of L1. MC and NC are multiples of every register tile size in kernels.c.
+ */
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+/*
+ * Packs the mc x kc block of A starting at `a` (strides `rsa` and `csa`) into `ap` as a
+ * sequence of mr-row slivers. Each sliver is stored column by column so that the micro kernel
+ * reads it sequentially. Rows past `mc` are padded with zeros.
+ */
+static void pack_a(int mc, int kc, const double *a, int64_t rsa, int64_t csa, double *ap, int mr) {
+    for (int i = 0; i < mc; i += mr) {
+        int m = mc - i < mr ? mc - i : mr;
+        for (int k = 0; k < kc; k++) {
+            for (int ii = 0; ii < m; ii++) {
+                ap[ii] = a[(i + ii) * rsa + k * csa];
+            }
+            for (int ii = m; ii < mr; ii++) {
+                ap[ii] = 0;
+            }
+            ap += mr;
+        }
     }
-    for (int i = d / 8 * 8; i < d; i += 1) {
-        result -> data[i] = mat1 -> data[i] - mat2 -> data[i];
+}
+
+/*
+ * Packs the nr-column sliver `j` of the kc x nc panel of B starting at `b` (strides `rsb` and
+ * `csb`) into `bp` row by row. Columns past `nc` are padded with zeros.
+ */
+static void pack_b_sliver(int kc, int nc, int j, const double *b, int64_t rsb, int64_t csb,
+                          double *bp, int nr) {
+    int n = nc - j < nr ? nc - j : nr;
+    bp += j * kc;
+    for (int k = 0; k < kc; k++) {
+        for (int jj = 0; jj < n; jj++) {
+            bp[jj] = b[k * rsb + (j + jj) * csb];
+        }
+        for (int jj = n; jj < nr; jj++) {
+            bp[jj] = 0;
+        }
+        bp += nr;
     }
-    return 0;
 }
 
 /*
- * Store the result of multiplying mat1 and mat2 to result`.
+ * Multiplies the packed mc x kc block of A with the packed kc x nc panel of B and stores
+ * `alpha` times the product plus `beta` times the old contents to the mc x nc block `c` of
+ * the result.
+ */
+static void macro_kernel(const kernel_table *kt, int mc, int nc, int kc, const double *ap,
+                         const double *bp, double *c, int64_t ldc, double alpha, double beta) {
+    int mr = kt -> mr; int nr = kt -> nr;
+    for (int j = 0; j < nc; j += nr) {
+        int n = nc - j < nr ? nc - j : nr;
+        for (int i = 0; i < mc; i += mr) {
+            int m = mc - i < mr ? mc - i : mr;
+            kt -> micro_kernel(kc, &ap[i * kc], &bp[j * kc], &c[i * ldc + j], ldc, m, n, alpha, beta);
+        }
+    }
+}
+
+/*
+ * Returns a copy of the struct of `mat` that describes its transpose, by swapping the
+ * dimensions and the strides. The copy shares the data but holds no reference to it, so it is
+ * only good for the duration of the call that made it.
+ */
+static matrix transposed(matrix *mat) {
+    matrix t = *mat;
+    t.rows = mat -> cols; t.cols = mat -> rows;
+    t.row_stride = mat -> col_stride; t.col_stride = mat -> row_stride;
+    return t;
+}
+
+/* Arguments of the parallel loops of gemm_matrix for one KC x NC panel of op(mat2) */
+typedef struct gemm_ctx {
+    const kernel_table *kt;
+    const matrix *a; // op(mat1)
+    const matrix *b; // op(mat2)
+    matrix *result;
+    double alpha;
+    double beta; // only the first KC panel applies beta; the later ones add to what it stored
+    int64_t jc, pc; // position of the panel
+    int nc, kc; // size of the panel
+    double *bp; // the packed panel
+    double *ap_all; // one MC x KC buffer per slot
+} gemm_ctx;
+
+/* Packs sliver `i`, the `nr` columns starting at column i * nr of the panel */
+static void gemm_pack_b(void *arg, long i, int slot) {
+    gemm_ctx *ctx = (gemm_ctx *)arg;
+    TRACE_BEGIN(span);
+    const matrix *b = ctx -> b;
+    const double *panel = &b -> data[ctx -> pc * b -> row_stride + ctx -> jc * b -> col_stride];
+    pack_b_sliver(ctx -> kc, ctx -> nc, (int)i * ctx -> kt -> nr, panel, b -> row_stride,
+                  b -> col_stride, ctx -> bp, ctx -> kt -> nr);
+    TRACE_END(span, "gemm pack B", i);
+}
+
+/* Packs row block `i` of op(mat1) into the buffer of `slot` and multiplies it with the panel */
+static void gemm_block(void *arg, long i, int slot) {
+    gemm_ctx *ctx = (gemm_ctx *)arg;
+    TRACE_BEGIN(span);
+    const matrix *a = ctx -> a;
+    int64_t ic = (int64_t)i * GEMM_MC;
+    int mc = a -> rows - ic < GEMM_MC ? (int)(a -> rows - ic) : GEMM_MC;
+    int64_t ldc = ctx -> result -> row_stride;
+    double *ap = &ctx -> ap_all[(size_t)slot * GEMM_MC * GEMM_KC];
+    pack_a(mc, ctx -> kc, &a -> data[ic * a -> row_stride + ctx -> pc * a -> col_stride],
+           a -> row_stride, a -> col_stride, ap, ctx -> kt -> mr);
+    macro_kernel(ctx -> kt, mc, ctx -> nc, ctx -> kc, ap, ctx -> bp,
+                 &ctx -> result -> data[ic * ldc + ctx -> jc], ldc, ctx -> alpha, ctx -> beta);
+    TRACE_END(span, "gemm block", i);
+}
+
+/*
+ * Stores alpha * op(mat1) * op(mat2) + beta * result to `result`, where op(X) is X, or the
+ * transpose of X if `trans_a` (for mat1) or `trans_b` (for mat2) is set. Transposed operands
+ * are read in place through swapped strides, and the scaling and accumulation happen in the
+ * write-back of the micro kernels, so nothing but the result is ever written. If `beta` is 0
+ * the old entries of `result` are not read.
  * Return 0 upon success and a nonzero value upon failure.
- * Remember that matrix multiplication is not the same as multiplying individual elements.
+ * The product is computed block by block: the loops over NC columns of op(mat2) and KC
+ * columns of op(mat1) pack a panel of op(mat2) once, and the MC row blocks of op(mat1) are
+ * then distributed over the threads of the pool, each packing its own block into the buffer
+ * of its slot.
  */
-int mul_matrix(matrix *result, matrix *mat1, matrix *mat2) {
-    if (mat1 -> cols != mat2 -> rows) {
+static int gemm(matrix *result, double alpha, int trans_a, matrix *mat1, int trans_b, matrix *mat2,
+               double beta) {
+    matrix a = trans_a ? transposed(mat1) : *mat1;
+    matrix b = trans_b ? transposed(mat2) : *mat2;
+    if (a.cols != b.rows || result -> rows != a.rows || result -> cols != b.cols) {
         return -1;
     }
-    int rows = mat1 -> rows; int cols = mat2 -> cols; int n = mat1 -> cols; int s = n >> 2; int sl = (n + 3) >> 2;
-    __m256d _res, _res1; __m256d colt[sl], colt1[sl], mat1t[rows]; double arr[4], arr1[4];
-    int t = n % 4;
-    __m256d vec1 = _mm256_set_pd(4, 3, 2, 1);
-    __m256d vec2 = _mm256_set_pd(t, t, t, t);
-    __m256d msk = _mm256_cmp_pd(vec2, vec1, 5);
-    #pragma omp parallel for
-    for (int r = 0; r < rows; r++) {
-        mat1t[r] = _mm256_and_pd(_mm256_loadu_pd(&(mat1 -> data[r * n + s * 4])), msk);
+    if (result -> col_stride != 1 || overlaps(result, &a) || overlaps(result, &b)) {
+        /* The micro kernels write rows of the result directly, so go through a fresh matrix */
+        matrix *tmp;
+        if (allocate_matrix_uninit(&tmp, result -> rows, result -> cols)) return -1;
+        int failed = (beta != 0 && copy_matrix(tmp, result))
+            || gemm(tmp, alpha, 0, &a, 0, &b, beta) || copy_matrix(result, tmp);
+        deallocate_matrix(tmp);
+        return failed;
     }
-    #pragma omp parallel for private(_res, _res1, colt, colt1, arr, arr1)
-    for (int c = 0; c < cols / 2 * 2; c += 2) {
-        int c1 = c + 1;
-        for (int i = 0; i < sl; i += 1) {
-            int k = 4 * i;
-            colt[i] = _mm256_set_pd(mat2 -> data[c + (k + 3) * cols], mat2 -> data[c + (k + 2) * cols],
-                                    mat2 -> data[c + (k + 1) * cols],mat2 -> data[c + k * cols]);
-            colt1[i] = _mm256_set_pd(mat2 -> data[c1 + (k + 3) * cols], mat2 -> data[c1 + (k + 2) * cols],
-                                    mat2 -> data[c1 + (k + 1) * cols],mat2 -> data[c1 + k * cols]);
-        }
-        if (t) {
-            colt[s] = _mm256_and_pd(colt[s], msk);
-            colt1[s] = _mm256_and_pd(colt1[s], msk);
-        }
-        for (int r = 0; r < rows; r++) {
-            _res = _mm256_set1_pd(0);
-            _res1 = _mm256_set1_pd(0);
-            int k = r * n;
-            for (int i = 0; i < s; i += 1) {
-                _res = _mm256_fmadd_pd(_mm256_loadu_pd(&(mat1 -> data[i * 4 + k])), colt[i], _res);
-                _res1 = _mm256_fmadd_pd(_mm256_loadu_pd(&(mat1 -> data[i * 4 + k])), colt1[i], _res1);
-            }
-            if (t) {
-                _res = _mm256_fmadd_pd(mat1t[r], colt[s], _res);
-                _res1 = _mm256_fmadd_pd(mat1t[r], colt1[s], _res1);
-            }
-            _mm256_storeu_pd(&arr[0], _res);
-            _mm256_storeu_pd(&arr1[0], _res1);
-            result -> data[c + r * cols] = arr[0] + arr[1] + arr[2] + arr[3];;
-            result -> data[c1 + r * cols] = arr1[0] + arr1[1] + arr1[2] + arr1[3];;
-        }
+    int64_t m = a.rows, n = b.cols, k = a.cols;
+    exec_plan plan = plan_gemm((double)m * n * k);
+    const kernel_table *kt = plan.kernels;
+    int nthreads = plan.threads;
+    size_t bp_size = (size_t)GEMM_KC * (GEMM_NC + KERNEL_MAX_NR);
+    size_t ap_size = (size_t)nthreads * GEMM_MC * GEMM_KC;
+    double *bp = alloc_data(bp_size, 0);
+    double *ap_all = alloc_data(ap_size, 0);
+    if (bp == NULL || ap_all == NULL) {
+        free_data(bp, bp_size);
+        free_data(ap_all, ap_size);
+        return -1;
     }
-    for (int c = cols / 2 * 2; c < cols; c++) {
-        for (int i = 0; i < sl; i += 1) {
-            int k = 4 * i;
-            colt[i] = _mm256_set_pd(mat2 -> data[c + (k + 3) * cols], mat2 -> data[c + (k + 2) * cols],
-                                    mat2 -> data[c + (k + 1) * cols],mat2 -> data[c + k * cols]);
-        }
-        if (t) {
-            colt[s] = _mm256_and_pd(colt[s], msk);
-        }
-        for (int r = 0; r < rows; r++) {
-            _res = _mm256_set1_pd(0);
-            int k = r * n;
-            for (int i = 0; i < s; i += 1) {
-                _res = _mm256_fmadd_pd(_mm256_loadu_pd(&(mat1 -> data[i * 4 + k])), colt[i], _res);
-            }
-            if (t) {
-                _res = _mm256_fmadd_pd(mat1t[r], colt[s], _res);
-            }
-            _mm256_storeu_pd(&arr[0], _res);
-            result -> data[c + r * cols] = arr[0] + arr[1] + arr[2] + arr[3];;
+    for (int64_t jc = 0; jc < n; jc += GEMM_NC) {
+        int nc = n - jc < GEMM_NC ? (int)(n - jc) : GEMM_NC;
+        for (int64_t pc = 0; pc < k; pc += GEMM_KC) {
+            int kc = k - pc < GEMM_KC ? (int)(k - pc) : GEMM_KC;
+            gemm_ctx ctx = {kt, &a, &b, result, alpha, pc > 0 ? 1 : beta, jc, pc, nc, kc, bp, ap_all};
+            pool_parallel_for((nc + kt -> nr - 1) / kt -> nr, nthreads, gemm_pack_b, &ctx);
+            pool_parallel_for((long)((m + GEMM_MC - 1) / GEMM_MC), nthreads, gemm_block, &ctx);
         }
     }
+    free_data(bp, bp_size);
+    free_data(ap_all, ap_size);
     return 0;
 }
 
+/* Runs gemm as one counted call; see gemm for what it computes */
+int gemm_matrix(matrix *result, double alpha, int trans_a, matrix *mat1, int trans_b, matrix *mat2,
+                double beta) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_GEMM);
+    int failed = gemm(result, alpha, trans_a, mat1, trans_b, mat2, beta);
+    double m = result -> rows, n = result -> cols, k = trans_a ? mat1 -> rows : mat1 -> cols;
+    double entries = m * k > k * n ? m * k : k * n;
+    STATS_END(scope, entries > m * n ? entries : m * n,
+              (m * k + k * n + (beta != 0 ? m * n : 0)) * sizeof(double), m * n * sizeof(double),
+              2 * m * n * k);
+    return failed;
+}
+
+/*
+ * Store the result of multiplying mat1 and mat2 to result`.
+ * Return 0 upon success and a nonzero value upon failure.
+ * Remember that matrix multiplication is not the same as multiplying individual elements.
+ */
+int mul_matrix(matrix *result, matrix *mat1, matrix *mat2) {
+    if (mat1 -> cols != mat2 -> rows) {
+        return -1;
+    }
+    return gemm_matrix(result, 1, 0, mat1, 0, mat2, 0);
+}
+
 /*
  * Store the result of raising mat to the (pow)th power to `result`.
  * Return 0 upon success and a nonzero value upon failure.
  * Remember that pow is defined with matrix multiplication, not element-wise multiplication.
  */
 int pow_matrix(matrix *result, matrix *mat, int pow) {
-    int rows = mat -> rows; int cols = mat -> cols;
+    int64_t rows = mat -> rows, cols = mat -> cols;
     if (rows != cols || pow < 0) return -1;
-    int size = rows * cols;
-    matrix *res, *mat0;
-    allocate_matrix(&res, rows, cols);
-    allocate_matrix(&mat0, rows, cols);
-    for (int i = 0; i < size; i++) {
-        result -> data[i] = 0;
-        mat0 -> data[i] = mat -> data[i];
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_POW);
+    int products = 0;
+    matrix *res, *mat0, *swap;
+    if (allocate_matrix_uninit(&res, rows, cols)) {
+        STATS_END(scope, (double)rows * cols, 0, 0, 0);
+        return -1;
+    }
+    if (allocate_matrix_uninit(&mat0, rows, cols)) {
+        deallocate_matrix(res);
+        STATS_END(scope, (double)rows * cols, 0, 0, 0);
+        return -1;
     }
-    for (int i = 0; i < mat -> rows; i++) {
-        result -> data[i + i * mat -> cols] = 1;
+    int failed = copy_matrix(mat0, mat);
+    fill_matrix(result, 0);
+    for (int64_t i = 0; i < rows; i++) {
+        set(result, i, i, 1);
     }
-    while (pow > 0) {
+    while (pow > 0 && !failed) {
         if (pow % 2 == 0) {
-            mul_matrix(res, mat0, mat0);
-            for  (int i = 0; i < size; i++) {
-                mat0 -> data[i] = res -> data[i];
-            }
+            failed = mul_matrix(res, mat0, mat0);
+            products++;
+            swap = mat0; mat0 = res; res = swap;
             pow >>= 1;
         } else {
-            for (int i = 0; i < size; i++) {
-                res -> data[i] = result -> data[i];
-            }
-            mul_matrix(result, res, mat0);
+            products++;
+            failed = copy_matrix(res, result) || mul_matrix(result, res, mat0);
             pow--;
         }
     }
     deallocate_matrix(res);
     deallocate_matrix(mat0);
-    return 0;
+    double d = (double)rows * cols;
+    STATS_END(scope, d, d * sizeof(double), d * sizeof(double), 2 * d * cols * products);
+    return failed ? -1 : 0;
 }
 
 /*
@@ -307,25 +781,28 @@ int pow_matrix(matrix *result, matrix *mat, int pow) {
  * Return 0 upon success and a nonzero value upon failure.
  */
 int neg_matrix(matrix *result, matrix *mat) {
-    int d = result -> rows * result -> cols;
-    #pragma omp parallel for
-    for (int i = 0; i < d; i++) {
-        result -> data[i] = -mat -> data[i];
-    }
-    return 0;
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_NEG);
+    double d = (double)mat -> rows * mat -> cols;
+    exec_plan plan = plan_elementwise((long)d);
+    int failed = apply_unary(plan.kernels -> neg, plan.threads, result, mat);
+    STATS_END(scope, d, d * sizeof(double), d * sizeof(double), d);
+    return failed;
 }
 
+
 /*
  * Store the result of taking the absolute value element-wise to `result`.
  * Return 0 upon success and a nonzero value upon failure.
  */
 int abs_matrix(matrix *result, matrix *mat) {
-    int d = mat -> rows * mat -> cols;
-    #pragma omp parallel for
-    for (int i = 0; i < d; i++) {
-        double k = mat -> data[i];
-        result -> data[i] = k >= 0 ? k : -k;
-    }
-    return 0;
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_ABS);
+    double d = (double)mat -> rows * mat -> cols;
+    exec_plan plan = plan_elementwise((long)d);
+    int failed = apply_unary(plan.kernels -> abs, plan.threads, result, mat);
+    STATS_END(scope, d, d * sizeof(double), d * sizeof(double), d);
+    return failed;
 }
 
+
@@ -1,24 +1,50 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
 #include <Python.h>
+#include <stdint.h>
 
+/*
+ * Shapes, strides and offsets are 64-bit, so a matrix may hold more than 2^31 entries. Every
+ * index computed from them (r * row_stride + c * col_stride and the like) is 64-bit too.
+ */
 typedef struct matrix {
-    int rows; // number of rows
-    int cols; // number of columns
+    int64_t rows; // number of rows
+    int64_t cols; // number of columns
+    int64_t row_stride; // distance in doubles between the starts of two consecutive rows
+    int64_t col_stride; // distance in doubles between two consecutive entries of a row
     double* data; // pointer to rows * columns doubles
     int ref_cnt; // How many slices/matrices are referring to this matrix's data
     struct matrix *parent; // NULL if matrix is not a slice, else the parent matrix of the slice
+    void (*release)(void *owner); // if not NULL, called with `owner` instead of freeing data
+    void *owner; // whatever `release` needs to give the data back to where it came from
 } matrix;
 
 double rand_double(double low, double high);
 void rand_matrix(matrix *result, unsigned int seed, double low, double high);
-int allocate_matrix(matrix **mat, int rows, int cols);
-int allocate_matrix_ref(matrix **mat, matrix *from, int offset, int rows, int cols);
+void randn_matrix(matrix *result, unsigned int seed, double mean, double std);
+void rand_matrix_libc(matrix *result, unsigned int seed, double low, double high);
+int allocate_matrix(matrix **mat, int64_t rows, int64_t cols);
+int allocate_matrix_uninit(matrix **mat, int64_t rows, int64_t cols);
+int allocate_matrix_ref(matrix **mat, matrix *from, int64_t offset, int64_t rows, int64_t cols);
+int allocate_matrix_view(matrix **mat, matrix *from, int64_t offset, int64_t rows, int64_t cols,
+                         int64_t row_stride, int64_t col_stride);
+int allocate_matrix_external(matrix **mat, double *data, int64_t rows, int64_t cols,
+                             void (*release)(void *owner), void *owner);
 void deallocate_matrix(matrix *mat);
-double get(matrix *mat, int row, int col);
-void set(matrix *mat, int row, int col, double val);
+int is_contiguous(matrix *mat);
+double get(matrix *mat, int64_t row, int64_t col);
+void set(matrix *mat, int64_t row, int64_t col, double val);
 void fill_matrix(matrix *mat, double val);
+int copy_matrix(matrix *result, matrix *mat);
 int add_matrix(matrix *result, matrix *mat1, matrix *mat2);
 int sub_matrix(matrix *result, matrix *mat1, matrix *mat2);
 int mul_matrix(matrix *result, matrix *mat1, matrix *mat2);
+int gemm_matrix(matrix *result, double alpha, int trans_a, matrix *mat1, int trans_b, matrix *mat2,
+                double beta);
 int pow_matrix(matrix *result, matrix *mat, int pow);
 int neg_matrix(matrix *result, matrix *mat);
 int abs_matrix(matrix *result, matrix *mat);
+int overlaps(matrix *mat1, matrix *mat2);
+
+#endif
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE // syscall
+
+#include "numa.h"
+#include "threading.h"
+#include "pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* MPOL_INTERLEAVE of <linux/mempolicy.h>, for mbind */
+#define MPOL_INTERLEAVE_MODE 3
+
+/* Longest line of /proc/self/maps or numa_maps looked at; the rest of a longer line is skipped */
+#define LINE_BYTES 512
+
+/* Most mappings one buffer is looked up in */
+#define MAX_MAPPINGS 64
+
+static numa_policy policy = NUMA_PARTITIONED;
+static int nodes = 1;
+static unsigned long node_mask = 1; // online nodes below the number of bits of a long
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Reads a line of `f` into `buf`, dropping whatever does not fit. Returns 0 at the end of the
+ * file.
+ */
+static int read_line(FILE *f, char *buf) {
+    if (fgets(buf, LINE_BYTES, f) == NULL) return 0;
+    size_t len = strlen(buf);
+    if (len > 0 && buf[len - 1] != '\n') {
+        int c;
+        while ((c = fgetc(f)) != EOF && c != '\n') {
+        }
+    }
+    return 1;
+}
+
+/*
+ * Reads the online nodes from sysfs (a list like "0-1,3") and the policy from the
+ * NUMC_NUMA environment variable ("local", "partitioned" or "interleave").
+ */
+static void init(void) {
+    const char *env = getenv("NUMC_NUMA");
+    if (env != NULL && !strcmp(env, "local")) policy = NUMA_LOCAL;
+    if (env != NULL && !strcmp(env, "interleave")) policy = NUMA_INTERLEAVE;
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    char buf[LINE_BYTES];
+    if (f == NULL) return;
+    if (read_line(f, buf)) {
+        unsigned long mask = 0;
+        int count = 0;
+        for (char *p = buf; *p >= '0' && *p <= '9';) {
+            long first = strtol(p, &p, 10), last = first;
+            if (*p == '-') last = strtol(p + 1, &p, 10);
+            for (long n = first; n <= last; n++) {
+                count++;
+                if (n < (long)(8 * sizeof(mask))) mask |= 1UL << n;
+            }
+            if (*p == ',') p++;
+        }
+        if (count > 0) {
+            nodes = count;
+            node_mask = mask;
+        }
+    }
+    fclose(f);
+}
+
+void numa_set_policy(numa_policy p) {
+    pthread_once(&init_once, init);
+    policy = p;
+}
+
+numa_policy numa_get_policy(void) {
+    pthread_once(&init_once, init);
+    return policy;
+}
+
+/* Returns the number of online NUMA nodes, 1 if the kernel does not say */
+int numa_nodes(void) {
+    pthread_once(&init_once, init);
+    return nodes;
+}
+
+/*
+ * Sets the placement of `bytes` bytes of fresh, untouched memory at `block`, a page-aligned
+ * mapping. Only NUMA_INTERLEAVE needs to do anything; if the kernel refuses, the pages are
+ * placed on first touch as usual.
+ */
+void numa_place(void *block, size_t bytes) {
+    pthread_once(&init_once, init);
+    if (policy != NUMA_INTERLEAVE || nodes < 2) return;
+    syscall(SYS_mbind, block, bytes, MPOL_INTERLEAVE_MODE, &node_mask,
+            (unsigned long)(8 * sizeof(node_mask)), 0);
+}
+
+/* Arguments of the parallel loop of numa_zero */
+typedef struct zero_ctx {
+    double *data;
+    size_t n;
+} zero_ctx;
+
+static void zero_chunk(void *arg, long i, int slot) {
+    zero_ctx *ctx = (zero_ctx *)arg;
+    size_t start = (size_t)i * ELEMENTWISE_CHUNK;
+    size_t n = ctx -> n - start < ELEMENTWISE_CHUNK ? ctx -> n - start : ELEMENTWISE_CHUNK;
+    memset(&ctx -> data[start], 0, n * sizeof(double));
+}
+
+/*
+ * Zeroes `bytes` bytes (a whole number of doubles) at `block`. With NUMA_PARTITIONED the
+ * entries are split into the same chunks, over the same number of threads, as the flat loops
+ * of the element-wise kernels on a matrix of that size, so each thread clears the part it will
+ * work on.
+ */
+void numa_zero(void *block, size_t bytes) {
+    pthread_once(&init_once, init);
+    size_t n = bytes / sizeof(double);
+    exec_plan plan = plan_elementwise((long)n);
+    if (policy != NUMA_PARTITIONED || plan.threads < 2) {
+        memset(block, 0, bytes);
+        return;
+    }
+    zero_ctx ctx = {(double *)block, n};
+    pool_parallel_for((long)((n + ELEMENTWISE_CHUNK - 1) / ELEMENTWISE_CHUNK), plan.threads,
+                      zero_chunk, &ctx);
+}
+
+/*
+ * Stores to `per_node` (NUMA_MAX_NODES entries) how many bytes of the mappings holding the
+ * `bytes` bytes at `addr` are resident on each node, according to /proc/self/numa_maps.
+ * Neighbouring memory that shares a mapping is counted too. Returns one more than the highest
+ * node seen, or -1 if the kernel has no numa_maps.
+ */
+int numa_node_bytes(const void *addr, size_t bytes, size_t *per_node) {
+    unsigned long lo = (unsigned long)addr, hi = lo + bytes;
+    unsigned long starts[MAX_MAPPINGS];
+    int mappings = 0;
+    char line[LINE_BYTES];
+    FILE *f = fopen("/proc/self/maps", "r");
+    if (f == NULL) return -1;
+    while (read_line(f, line)) {
+        unsigned long start, end;
+        if (sscanf(line, "%lx-%lx", &start, &end) == 2 && start < hi && end > lo
+                && mappings < MAX_MAPPINGS) {
+            starts[mappings++] = start;
+        }
+    }
+    fclose(f);
+    memset(per_node, 0, NUMA_MAX_NODES * sizeof(size_t));
+    f = fopen("/proc/self/numa_maps", "r");
+    if (f == NULL) return -1;
+    int top = 0;
+    while (read_line(f, line)) {
+        unsigned long start;
+        int found = 0;
+        if (sscanf(line, "%lx", &start) != 1) continue;
+        for (int m = 0; m < mappings; m++) found |= starts[m] == start;
+        if (!found) continue;
+        size_t page = 4096;
+        char *kb = strstr(line, "kernelpagesize_kB=");
+        if (kb != NULL) page = (size_t)strtoul(kb + strlen("kernelpagesize_kB="), NULL, 10) << 10;
+        char *save;
+        for (char *tok = strtok_r(line, " \n", &save); tok != NULL; tok = strtok_r(NULL, " \n", &save)) {
+            int node;
+            unsigned long count;
+            if (sscanf(tok, "N%d=%lu", &node, &count) == 2 && node >= 0 && node < NUMA_MAX_NODES) {
+                per_node[node] += count * page;
+                if (node + 1 > top) top = node + 1;
+            }
+        }
+    }
+    fclose(f);
+    return top;
+}
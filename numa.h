@@ -0,0 +1,34 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+/*
+ * Page placement of large matrix buffers on machines with several NUMA nodes. Linux puts a
+ * page on the node of the thread that first touches it, so a buffer zeroed by the thread that
+ * allocated it ends up on a single node, and the threads of the next parallel loop on the other
+ * nodes read it across the interconnect. Buffers of at least NUMA_MIN_BYTES are therefore
+ * mapped fresh from the system, where their pages are already zero and stay untouched until
+ * the kernel writing the matrix touches them, each thread its own part; reused buffers that
+ * must be zeroed are zeroed in parallel with the same partition the element-wise kernels use.
+ * Everything goes through system calls and /proc, so no libnuma is needed.
+ */
+#define NUMA_MIN_BYTES ((size_t)1 << 20)
+
+typedef enum numa_policy {
+    NUMA_LOCAL, // pages go wherever they are first touched, reused buffers are zeroed by the caller
+    NUMA_PARTITIONED, // the default: as NUMA_LOCAL, but reused buffers are zeroed by partition
+    NUMA_INTERLEAVE // fresh buffers are interleaved page by page over all nodes
+} numa_policy;
+
+/* Most nodes numa_node_bytes reports on */
+#define NUMA_MAX_NODES 64
+
+void numa_set_policy(numa_policy policy);
+numa_policy numa_get_policy(void);
+int numa_nodes(void);
+void numa_place(void *block, size_t bytes);
+void numa_zero(void *block, size_t bytes);
+int numa_node_bytes(const void *addr, size_t bytes, size_t *per_node);
+
+#endif
@@ -1,93 +1,376 @@
 #include "numc.h"
+#include "kernels.h"
+#include "alloc.h"
+#include "threading.h"
+#include "pool.h"
+#include "storage.h"
+#include "ooc.h"
+#include "stats.h"
+#include "trace.h"
+#include "numa.h"
+#include "executor.h"
 #include <structmember.h>
 
 static PyTypeObject Matrix61cType;
 
 /* Helper functions for initalization of matrices and vectors */
-/* Matrix(rows, cols, low, high). Fill a matrix random double values */
-static int init_rand(PyObject *self, int rows, int cols, unsigned int seed, double low, double high) {
+/*
+ * Matrix(rows, cols, rand=True, ...). Fill a matrix random double values: uniform ones in
+ * [a, b), or normal ones of mean a and standard deviation b if `normal` is set. `libc` selects
+ * the original srand/rand generator instead of the counter-based one.
+ */
+static int init_rand(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, unsigned int seed, int normal,
+                     int libc, double a, double b) {
     matrix *new_mat;
-    int alloc_failed = allocate_matrix(&new_mat, rows, cols);
+    int alloc_failed = allocate_matrix_uninit(&new_mat, rows, cols);
     if (alloc_failed)
         return alloc_failed;
-    rand_matrix(new_mat, seed, low, high);
+    if (libc)
+        rand_matrix_libc(new_mat, seed, a, b);
+    else if (normal)
+        randn_matrix(new_mat, seed, a, b);
+    else
+        rand_matrix(new_mat, seed, a, b);
     ((Matrix61c *)self)->mat = new_mat;
-    ((Matrix61c *)self)->shape = PyTuple_Pack(2, PyLong_FromLong(rows), PyLong_FromLong(cols));
+    ((Matrix61c *)self)->shape = Py_BuildValue("(nn)", rows, cols);
     return 0;
 }
 
 /* Matrix(rows, cols, val). Fill a matrix of dimension rows * cols with val*/
-static int init_fill(PyObject *self, int rows, int cols, double val) {
+static int init_fill(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, double val) {
     matrix *new_mat;
-    int alloc_failed = allocate_matrix(&new_mat, rows, cols);
+    int alloc_failed = allocate_matrix_uninit(&new_mat, rows, cols);
     if (alloc_failed)
         return alloc_failed;
     else {
         fill_matrix(new_mat, val);
         ((Matrix61c *)self)->mat = new_mat;
-        ((Matrix61c *)self)->shape = PyTuple_Pack(2, PyLong_FromLong(rows), PyLong_FromLong(cols));
+        ((Matrix61c *)self)->shape = Py_BuildValue("(nn)", rows, cols);
     }
     return 0;
 }
 
-/* Matrix(rows, cols, 1d_list). Fill a matrix with dimension rows * cols with 1d_list values */
-static int init_1d(PyObject *self, int rows, int cols, PyObject *lst) {
-    if (rows * cols != PyList_Size(lst)) {
-        PyErr_SetString(PyExc_TypeError, "Incorrect number of elements in list");
+/* BULK CONSTRUCTION */
+
+/*
+ * The constructors copy their entries in bulk. A buffer (array.array, bytes, a NumPy array,
+ * another numc.Matrix) of up to two dimensions is converted straight from its memory, with
+ * memcpy when it holds contiguous float64, and without the GIL. Any other source goes through
+ * the fast sequence protocol, which hands out the item array of a list or tuple as is and
+ * materializes anything else once. That array is converted in parallel: the workers only read
+ * the value of exact floats, which needs no Python call, and count the other items, which a
+ * second pass on the calling thread converts with PyFloat_AsDouble.
+ */
+
+/* Items per iteration of the parallel conversion loops */
+#define CONVERT_CHUNK 4096
+
+/* Arguments of the parallel conversion loops */
+typedef struct convert_ctx {
+    const char *src; // buffer sources: the first item
+    char format; // buffer sources: struct module code of the items
+    Py_ssize_t row_stride, col_stride; // buffer sources: strides in bytes
+    PyObject ***items; // sequence sources: the items of each row, NULL for rows already done
+    Py_ssize_t *left; // sequence sources: items of each row that are not exact floats
+    Py_ssize_t rows, cols; // sequence sources of one dimension are split into rows of CONVERT_CHUNK
+    Py_ssize_t n; // number of items
+    Py_ssize_t chunks; // chunks per row
+    double *dst;
+} convert_ctx;
+
+/* Returns the struct module code of the items of `view`, or 0 if they are not numbers we read */
+static char buffer_format(Py_buffer *view) {
+    const char *f = view->format ? view->format : "B";
+    if (*f == '@')
+        f++;
+    if (f[0] == 0 || f[1] != 0)
+        return 0;
+    switch (f[0]) {
+    case 'b': case 'B': case '?': return view->itemsize == 1 ? f[0] : 0;
+    case 'h': case 'H': return view->itemsize == sizeof(short) ? f[0] : 0;
+    case 'i': case 'I': return view->itemsize == sizeof(int) ? f[0] : 0;
+    case 'l': case 'L': return view->itemsize == sizeof(long) ? f[0] : 0;
+    case 'q': case 'Q': return view->itemsize == sizeof(long long) ? f[0] : 0;
+    case 'n': case 'N': return view->itemsize == sizeof(size_t) ? f[0] : 0;
+    case 'f': return view->itemsize == sizeof(float) ? f[0] : 0;
+    case 'd': return view->itemsize == sizeof(double) ? f[0] : 0;
+    default: return 0;
+    }
+}
+
+#define CONVERT_CASE(code, type)                                            \
+    case code:                                                              \
+        for (Py_ssize_t k = 0; k < len; k++) {                              \
+            dst[k] = (double)*(const type *)(src + k * ctx->col_stride);    \
+        }                                                                   \
+        break;
+
+/* Converts chunk `t` of a buffer, counting chunks row by row */
+static void convert_buffer_body(void *arg, long t, int slot) {
+    convert_ctx *ctx = (convert_ctx *)arg;
+    Py_ssize_t r = t / ctx->chunks;
+    Py_ssize_t c = t % ctx->chunks * CONVERT_CHUNK;
+    Py_ssize_t len = ctx->cols - c < CONVERT_CHUNK ? ctx->cols - c : CONVERT_CHUNK;
+    const char *src = ctx->src + r * ctx->row_stride + c * ctx->col_stride;
+    double *dst = ctx->dst + r * ctx->cols + c;
+    if (ctx->format == 'd' && ctx->col_stride == sizeof(double)) {
+        memcpy(dst, src, len * sizeof(double));
+        return;
+    }
+    switch (ctx->format) {
+    CONVERT_CASE('b', signed char)
+    CONVERT_CASE('B', unsigned char)
+    CONVERT_CASE('?', _Bool)
+    CONVERT_CASE('h', short)
+    CONVERT_CASE('H', unsigned short)
+    CONVERT_CASE('i', int)
+    CONVERT_CASE('I', unsigned int)
+    CONVERT_CASE('l', long)
+    CONVERT_CASE('L', unsigned long)
+    CONVERT_CASE('q', long long)
+    CONVERT_CASE('Q', unsigned long long)
+    CONVERT_CASE('n', Py_ssize_t)
+    CONVERT_CASE('N', size_t)
+    CONVERT_CASE('f', float)
+    CONVERT_CASE('d', double)
+    }
+}
+
+/*
+ * Gets a buffer of one or two dimensions of numbers from `obj` into `view`. Returns 1 if it
+ * did, or 0 with no exception set if `obj` has no such buffer.
+ */
+static int get_number_buffer(PyObject *obj, Py_buffer *view) {
+    if (!PyObject_CheckBuffer(obj))
+        return 0;
+    if (PyObject_GetBuffer(obj, view, PyBUF_RECORDS_RO)) {
+        PyErr_Clear();
+        return 0;
+    }
+    if (view->ndim < 1 || view->ndim > 2 || !buffer_format(view)) {
+        PyBuffer_Release(view);
+        return 0;
+    }
+    return 1;
+}
+
+/* Converts the items of `view`, in row-major order, to `dst` */
+static void convert_buffer(Py_buffer *view, double *dst) {
+    convert_ctx ctx = {0};
+    ctx.src = (const char *)view->buf;
+    ctx.format = buffer_format(view);
+    ctx.rows = view->ndim == 2 ? view->shape[0] : 1;
+    ctx.cols = view->shape[view->ndim - 1];
+    ctx.row_stride = view->ndim == 2 ? view->strides[0] : 0;
+    ctx.col_stride = view->strides[view->ndim - 1];
+    ctx.chunks = (ctx.cols + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+    ctx.dst = dst;
+    exec_plan plan = plan_elementwise((long)(ctx.rows * ctx.cols));
+    PyThreadState *state = release_gil((double)ctx.rows * ctx.cols);
+    pool_parallel_for(ctx.rows * ctx.chunks, plan.threads, convert_buffer_body, &ctx);
+    restore_gil(state);
+}
+
+/* Converts the exact floats of row `r` and counts the other items */
+static void convert_items_body(void *arg, long r, int slot) {
+    convert_ctx *ctx = (convert_ctx *)arg;
+    PyObject **items = ctx->items[r];
+    if (items == NULL)
+        return;
+    Py_ssize_t begin = r * ctx->cols;
+    Py_ssize_t len = ctx->n - begin < ctx->cols ? ctx->n - begin : ctx->cols;
+    Py_ssize_t left = 0;
+    for (Py_ssize_t k = 0; k < len; k++) {
+        if (PyFloat_CheckExact(items[k]))
+            ctx->dst[begin + k] = PyFloat_AS_DOUBLE(items[k]);
+        else
+            left++;
+    }
+    ctx->left[r] = left;
+}
+
+/*
+ * Converts `rows` rows of items to `dst`; row r holds `cols` items (the last one possibly
+ * fewer, `n` in total) and goes to dst[r * cols]. Rows whose items are NULL are skipped.
+ * Returns 0, or -1 with an exception set if an item is not a number.
+ */
+static int convert_items(PyObject ***items, Py_ssize_t rows, Py_ssize_t cols, Py_ssize_t n,
+                         double *dst) {
+    Py_ssize_t *left = (Py_ssize_t *)PyMem_Calloc(rows, sizeof(Py_ssize_t));
+    if (left == NULL) {
+        PyErr_NoMemory();
         return -1;
     }
-    matrix *new_mat;
-    int alloc_failed = allocate_matrix(&new_mat, rows, cols);
-    if (alloc_failed)
-        return alloc_failed;
-    int count = 0;
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            set(new_mat, i, j, PyFloat_AsDouble(PyList_GetItem(lst, count)));
-            count++;
+    convert_ctx ctx = {0};
+    ctx.items = items; ctx.left = left;
+    ctx.rows = rows; ctx.cols = cols; ctx.n = n;
+    ctx.dst = dst;
+    pool_parallel_for(rows, plan_elementwise((long)n).threads, convert_items_body, &ctx);
+    for (Py_ssize_t r = 0; r < rows; r++) {
+        Py_ssize_t begin = r * cols;
+        for (Py_ssize_t k = 0; left[r] > 0; k++) {
+            PyObject *item = items[r][k];
+            if (PyFloat_CheckExact(item))
+                continue;
+            double val = PyLong_CheckExact(item) ? PyLong_AsDouble(item) : PyFloat_AsDouble(item);
+            if (val == -1 && PyErr_Occurred()) {
+                PyMem_Free(left);
+                return -1;
+            }
+            dst[begin + k] = val;
+            left[r]--;
         }
     }
-    ((Matrix61c *)self)->mat = new_mat;
-    ((Matrix61c *)self)->shape = PyTuple_Pack(2, PyLong_FromLong(rows), PyLong_FromLong(cols));
+    PyMem_Free(left);
     return 0;
 }
 
-/* Matrix(2d_list). Fill a matrix with dimension len(2d_list) * len(2d_list[0]) */
-static int init_2d(PyObject *self, PyObject *lst) {
-    int rows = PyList_Size(lst);
-    if (rows == 0) {
-        PyErr_SetString(PyExc_TypeError, "Cannot initialize numc.Matrix with an empty list");
-        return -1;
-    }
-    int cols;
-    if (!PyList_Check(PyList_GetItem(lst, 0))) {
-        PyErr_SetString(PyExc_TypeError, "List values not valid");
-        return -1;
+/*
+ * Matrix(rows, cols, values). Fill a matrix with dimension rows * cols with the values of a
+ * sequence or buffer of rows * cols numbers, in row-major order.
+ */
+static int init_1d(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, PyObject *lst) {
+    Py_buffer view;
+    int is_buffer = get_number_buffer(lst, &view);
+    PyObject *fast = NULL;
+    Py_ssize_t n;
+    if (is_buffer) {
+        n = view.ndim == 2 ? view.shape[0] * view.shape[1] : view.shape[0];
     } else {
-        cols = PyList_Size(PyList_GetItem(lst, 0));
+        fast = PySequence_Fast(lst, "List values not valid");
+        if (fast == NULL)
+            return -1;
+        n = PySequence_Fast_GET_SIZE(fast);
     }
-    for (int i = 0; i < rows; i++) {
-        if (!PyList_Check(PyList_GetItem(lst, i)) || PyList_Size(PyList_GetItem(lst, i)) != cols) {
-            PyErr_SetString(PyExc_TypeError, "List values not valid");
+    if (cols == 0 ? n != 0 : n % cols != 0 || n / cols != rows) { // rows * cols != n, without overflow
+        PyErr_SetString(PyExc_TypeError, "Incorrect number of elements in list");
+        goto fail;
+    }
+    matrix *new_mat;
+    if (allocate_matrix_uninit(&new_mat, rows, cols))
+        goto fail;
+    if (is_buffer) {
+        convert_buffer(&view, new_mat->data);
+        PyBuffer_Release(&view);
+    } else {
+        Py_ssize_t chunks = (n + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+        PyObject ***items = (PyObject ***)PyMem_Malloc(chunks * sizeof(PyObject **));
+        int failed = items == NULL;
+        if (failed) {
+            PyErr_NoMemory();
+        } else {
+            for (Py_ssize_t c = 0; c < chunks; c++) {
+                items[c] = PySequence_Fast_ITEMS(fast) + c * CONVERT_CHUNK;
+            }
+            failed = convert_items(items, chunks, CONVERT_CHUNK, n, new_mat->data);
+        }
+        PyMem_Free(items);
+        Py_DECREF(fast);
+        if (failed) {
+            deallocate_matrix(new_mat);
             return -1;
         }
     }
+    ((Matrix61c *)self)->mat = new_mat;
+    ((Matrix61c *)self)->shape = Py_BuildValue("(nn)", rows, cols);
+    return 0;
+fail:
+    if (is_buffer)
+        PyBuffer_Release(&view);
+    Py_XDECREF(fast);
+    return -1;
+}
+
+/*
+ * Matrix(2d_values). Fill a matrix with dimension len(2d_values) * len(2d_values[0]) from a
+ * sequence of rows, each a sequence or buffer of numbers, or from a two-dimensional buffer.
+ */
+static int init_2d(PyObject *self, PyObject *lst) {
     matrix *new_mat;
-    int alloc_failed = allocate_matrix(&new_mat, rows, cols);
-    if (alloc_failed)
-        return alloc_failed;
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            set(new_mat, i, j, PyFloat_AsDouble(PyList_GetItem(PyList_GetItem(lst, i), j)));
+    Py_buffer view;
+    if (get_number_buffer(lst, &view)) {
+        if (view.ndim != 2 || view.shape[0] < 1 || view.shape[1] < 1) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_TypeError, "List values not valid");
+            return -1;
+        }
+        int failed = allocate_matrix_uninit(&new_mat, view.shape[0], view.shape[1]);
+        if (!failed)
+            convert_buffer(&view, new_mat->data);
+        PyBuffer_Release(&view);
+        if (failed)
+            return -1;
+    } else {
+        PyObject *fast = PySequence_Fast(lst, "List values not valid");
+        if (fast == NULL)
+            return -1;
+        Py_ssize_t rows = PySequence_Fast_GET_SIZE(fast);
+        if (rows == 0) {
+            Py_DECREF(fast);
+            PyErr_SetString(PyExc_TypeError, "Cannot initialize numc.Matrix with an empty list");
+            return -1;
+        }
+        /* The rows that are sequences, kept alive until their items are converted */
+        PyObject **row_seqs = (PyObject **)PyMem_Calloc(rows, sizeof(PyObject *));
+        PyObject ***items = (PyObject ***)PyMem_Calloc(rows, sizeof(PyObject **));
+        Py_ssize_t cols = -1;
+        int failed = row_seqs == NULL || items == NULL;
+        if (failed)
+            PyErr_NoMemory();
+        new_mat = NULL;
+        for (Py_ssize_t r = 0; r < rows && !failed; r++) {
+            PyObject *row = PySequence_Fast_GET_ITEM(fast, r);
+            Py_ssize_t len;
+            int is_buffer = !PyLong_Check(row) && !PyFloat_Check(row) && get_number_buffer(row, &view);
+            if (is_buffer) {
+                len = view.ndim == 1 ? view.shape[0] : -1;
+            } else {
+                row_seqs[r] = PySequence_Check(row) ? PySequence_Fast(row, "List values not valid") : NULL;
+                if (row_seqs[r] == NULL) {
+                    PyErr_Clear();
+                    PyErr_SetString(PyExc_TypeError, "List values not valid");
+                    failed = 1;
+                    break;
+                }
+                len = PySequence_Fast_GET_SIZE(row_seqs[r]);
+                items[r] = PySequence_Fast_ITEMS(row_seqs[r]);
+            }
+            if (cols < 0)
+                cols = len;
+            if (len != cols || cols < 1 || (new_mat == NULL && allocate_matrix_uninit(&new_mat, rows, cols))) {
+                if (len != cols || cols < 1)
+                    PyErr_SetString(PyExc_TypeError, "List values not valid");
+                failed = 1;
+            } else if (is_buffer) {
+                convert_buffer(&view, &new_mat->data[r * cols]);
+            }
+            if (is_buffer)
+                PyBuffer_Release(&view);
+        }
+        if (!failed)
+            failed = convert_items(items, rows, cols, rows * cols, new_mat->data);
+        for (Py_ssize_t r = 0; row_seqs != NULL && r < rows; r++) {
+            Py_XDECREF(row_seqs[r]);
+        }
+        PyMem_Free(row_seqs);
+        PyMem_Free(items);
+        Py_DECREF(fast);
+        if (failed) {
+            deallocate_matrix(new_mat);
+            return -1;
         }
     }
     ((Matrix61c *)self)->mat = new_mat;
-    ((Matrix61c *)self)->shape = PyTuple_Pack(2, PyLong_FromLong(rows), PyLong_FromLong(cols));
+    ((Matrix61c *)self)->shape = Py_BuildValue("(nn)", (Py_ssize_t)new_mat->rows, (Py_ssize_t)new_mat->cols);
     return 0;
 }
 
 /* This deallocation function is called when reference count is 0*/
 static void Matrix61c_dealloc(Matrix61c *self) {
+    if (self->expr) {
+        unlink_pending(self);
+        expr_release(self->expr);
+    }
     deallocate_matrix(self->mat);
     Py_TYPE(self)->tp_free(self);
 }
@@ -120,9 +403,61 @@ static int Matrix61c_init(PyObject *self, PyObject *args, PyObject *kwds) {
         PyObject *low = PyDict_GetItemString(kwds, "low");
         PyObject *high = PyDict_GetItemString(kwds, "high");
         PyObject *seed = PyDict_GetItemString(kwds, "seed");
+        PyObject *normal = PyDict_GetItemString(kwds, "normal");
+        PyObject *mean = PyDict_GetItemString(kwds, "mean");
+        PyObject *std = PyDict_GetItemString(kwds, "std");
+        PyObject *rng = PyDict_GetItemString(kwds, "rng");
         double double_low = 0;
         double double_high = 1;
+        double double_mean = 0;
+        double double_std = 1;
         unsigned int unsigned_seed = 0;
+        int libc = 0;
+
+        /* normal=True draws from a normal distribution of the given mean and std instead */
+        if (normal && !PyBool_Check(normal)) {
+            PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+            return -1;
+        }
+        if (mean) {
+            if (PyFloat_Check(mean)) {
+                double_mean = PyFloat_AsDouble(mean);
+            } else if (PyLong_Check(mean)) {
+                double_mean = PyLong_AsLong(mean);
+            }
+        }
+        if (std) {
+            if (PyFloat_Check(std)) {
+                double_std = PyFloat_AsDouble(std);
+            } else if (PyLong_Check(std)) {
+                double_std = PyLong_AsLong(std);
+            }
+        }
+        if (double_std < 0) {
+            PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+            return -1;
+        }
+
+        /* rng="libc" reproduces the matrices of the original srand/rand generator */
+        if (rng) {
+            if (!PyUnicode_Check(rng)) {
+                PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+                return -1;
+            }
+            const char *name = PyUnicode_AsUTF8(rng);
+            if (name == NULL)
+                return -1;
+            if (strcmp(name, "libc") == 0) {
+                libc = 1;
+            } else if (strcmp(name, "philox") != 0) {
+                PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+                return -1;
+            }
+        }
+        if (libc && normal == Py_True) {
+            PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+            return -1;
+        }
 
         if (low) {
             if (PyFloat_Check(low)) {
@@ -156,7 +491,11 @@ static int Matrix61c_init(PyObject *self, PyObject *args, PyObject *kwds) {
         PyObject *cols = NULL;
         if (PyArg_UnpackTuple(args, "args", 2, 2, &rows, &cols)) {
             if (rows && cols && PyLong_Check(rows) && PyLong_Check(cols)) {
-                return init_rand(self, PyLong_AsLong(rows), PyLong_AsLong(cols), unsigned_seed, double_low, double_high);
+                if (normal == Py_True)
+                    return init_rand(self, PyLong_AsSsize_t(rows), PyLong_AsSsize_t(cols), unsigned_seed, 1, 0,
+                                     double_mean, double_std);
+                return init_rand(self, PyLong_AsSsize_t(rows), PyLong_AsSsize_t(cols), unsigned_seed, 0, libc,
+                                 double_low, double_high);
             }
         } else {
             PyErr_SetString(PyExc_TypeError, "Invalid arguments");
@@ -170,19 +509,21 @@ static int Matrix61c_init(PyObject *self, PyObject *args, PyObject *kwds) {
         /* arguments are (rows, cols, val) */
         if (arg1 && arg2 && arg3 && PyLong_Check(arg1) && PyLong_Check(arg2) && (PyLong_Check(arg3) || PyFloat_Check(arg3))) {
             if (PyLong_Check(arg3)) {
-                return init_fill(self, PyLong_AsLong(arg1), PyLong_AsLong(arg2), PyLong_AsLong(arg3));
+                return init_fill(self, PyLong_AsSsize_t(arg1), PyLong_AsSsize_t(arg2), PyLong_AsLong(arg3));
             }
             else
-                return init_fill(self, PyLong_AsLong(arg1), PyLong_AsLong(arg2), PyFloat_AsDouble(arg3));
-        } else if (arg1 && arg2 && arg3 && PyLong_Check(arg1) && PyLong_Check(arg2) && PyList_Check(arg3)) {
-            /* Matrix(rows, cols, 1D list) */
-            return init_1d(self, PyLong_AsLong(arg1), PyLong_AsLong(arg2), arg3);
-        } else if (arg1 && PyList_Check(arg1) && arg2 == NULL && arg3 == NULL) {
-            /* Matrix(rows, cols, 1D list) */
+                return init_fill(self, PyLong_AsSsize_t(arg1), PyLong_AsSsize_t(arg2), PyFloat_AsDouble(arg3));
+        } else if (arg1 && arg2 && arg3 && PyLong_Check(arg1) && PyLong_Check(arg2)
+                   && (PySequence_Check(arg3) || PyObject_CheckBuffer(arg3))) {
+            /* Matrix(rows, cols, 1D sequence or buffer) */
+            return init_1d(self, PyLong_AsSsize_t(arg1), PyLong_AsSsize_t(arg2), arg3);
+        } else if (arg1 && (PySequence_Check(arg1) || PyObject_CheckBuffer(arg1)) && arg2 == NULL
+                   && arg3 == NULL) {
+            /* Matrix(2D sequence or buffer) */
             return init_2d(self, arg1);
         } else if (arg1 && arg2 && PyLong_Check(arg1) && PyLong_Check(arg2) && arg3 == NULL) {
             /* Matrix(rows, cols, 1D list) */
-            return init_fill(self, PyLong_AsLong(arg1), PyLong_AsLong(arg2), 0);
+            return init_fill(self, PyLong_AsSsize_t(arg1), PyLong_AsSsize_t(arg2), 0);
         } else {
             PyErr_SetString(PyExc_TypeError, "Invalid arguments");
             return -1;
@@ -195,13 +536,15 @@ static int Matrix61c_init(PyObject *self, PyObject *args, PyObject *kwds) {
 
 /* List of lists representations for matrices */
 static PyObject *Matrix61c_to_list(Matrix61c *self) {
-    int rows = self->mat->rows;
-    int cols = self->mat->cols;
+    if (evaluate(self))
+        return NULL;
+    Py_ssize_t rows = self->mat->rows;
+    Py_ssize_t cols = self->mat->cols;
     PyObject *py_lst = PyList_New(rows);
-    for (int i = 0; i < rows; i++) {
+    for (Py_ssize_t i = 0; i < rows; i++) {
         PyList_SetItem(py_lst, i, PyList_New(cols));
         PyObject *curr_row = PyList_GetItem(py_lst, i);
-        for (int j = 0; j < cols; j++) {
+        for (Py_ssize_t j = 0; j < cols; j++) {
             PyList_SetItem(curr_row, j, PyFloat_FromDouble(get(self->mat, i, j)));
         }
     }
@@ -223,264 +566,1613 @@ static PyObject *Matrix61c_class_to_list(Matrix61c *self, PyObject *args) {
     }
 }
 
-/* Add class methods */
-static PyMethodDef Matrix61c_class_methods[] = {
-    {"to_list", (PyCFunction)Matrix61c_class_to_list, METH_VARARGS, "Returns a list representation of numc.Matrix"},
-    {NULL, NULL, 0, NULL}
-};
-
-/* Matrix61c string representation. For printing purposes. */
-static PyObject *Matrix61c_repr(PyObject *self) {
-    PyObject *py_lst = Matrix61c_to_list((Matrix61c *)self);
-    return PyObject_Repr(py_lst);
+/* Name of the instruction set variant of the kernels picked at import time */
+static PyObject *Matrix61c_backend(PyObject *self, PyObject *args) {
+    return PyUnicode_FromString(active_kernels()->name);
 }
 
-/* For __getitem__. (e.g. mat[0]) */
-static PyObject *Matrix61c_subscript(Matrix61c* self, PyObject* key) {
-    if (!PyLong_Check(key)) {
-        PyErr_SetString(PyExc_TypeError, "Key is not valid");
+/*
+ * numc.memory_stats(). Returns a dict with the counters of the data allocator: bytes held by
+ * live matrices, bytes of freed blocks cached for reuse, the cache limit, and the number and
+ * fraction of allocations served from the cache. huge_mapped counts the bytes of all blocks
+ * mapped for huge pages so far, and huge_resident the bytes the kernel actually backs with huge
+ * pages right now (None where it does not tell).
+ */
+static PyObject *numc_memory_stats(PyObject *self, PyObject *args) {
+    alloc_stats stats;
+    alloc_get_stats(&stats);
+    size_t total = stats.hits + stats.misses;
+    long long resident = alloc_huge_resident();
+    PyObject *huge_resident = resident < 0 ? Py_None : PyLong_FromLongLong(resident);
+    if (huge_resident == NULL)
         return NULL;
-    }
-    int index = PyLong_AsLong(key);
-    if (index >= self->mat->rows || index < 0) {
-        PyErr_SetString(PyExc_IndexError, "Index out of range");
+    PyObject *result = Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:d,s:n,s:O}",
+                                     "bytes_live", (Py_ssize_t)stats.bytes_live,
+                                     "bytes_cached", (Py_ssize_t)stats.bytes_cached,
+                                     "cache_limit", (Py_ssize_t)stats.cache_limit,
+                                     "hits", (Py_ssize_t)stats.hits,
+                                     "misses", (Py_ssize_t)stats.misses,
+                                     "hit_rate", total ? (double)stats.hits / total : 0.0,
+                                     "huge_mapped", (Py_ssize_t)stats.huge_mapped,
+                                     "huge_resident", huge_resident);
+    if (resident >= 0)
+        Py_DECREF(huge_resident);
+    return result;
+}
+
+/* Names of the modes of huge_mode, in its order */
+static const char *huge_mode_names[] = {"off", "transparent", "hugetlbfs"};
+
+/*
+ * numc.set_huge_pages(min_bytes=None, mode=None). Sets from which size matrix data is mapped
+ * for huge pages (8 MiB by default, or NUMC_HUGE_BYTES) and how: "transparent", the default,
+ * aligns the mapping to 2 MiB and advises the kernel to use transparent huge pages,
+ * "hugetlbfs" takes them from the reserved pool (vm.nr_hugepages) while it lasts, and "off"
+ * uses normal pages. Returns the settings.
+ */
+static PyObject *numc_set_huge_pages(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"min_bytes", "mode", NULL};
+    Py_ssize_t min_bytes = -1;
+    const char *name = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nz", kwlist, &min_bytes, &name))
         return NULL;
+    alloc_stats stats;
+    alloc_get_stats(&stats);
+    int mode = name != NULL ? -1 : (int)stats.huge;
+    for (int m = HUGE_OFF; name != NULL && m <= HUGE_HUGETLBFS; m++) {
+        if (!strcmp(name, huge_mode_names[m]))
+            mode = m;
     }
-    if (self->mat->cols == 1) { // if one single number, unwrap from list
-        return PyFloat_FromDouble(get(self->mat, index, 0));
-    }
-    matrix *new_mat;
-    int ref_failed = allocate_matrix_ref(&new_mat, self->mat, index * self->mat->cols, self->mat->cols, 1);
-    if (ref_failed) {
+    if (mode < 0) {
+        PyErr_SetString(PyExc_ValueError, "mode must be 'off', 'transparent' or 'hugetlbfs'");
         return NULL;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(1));
-    return (PyObject*)rv;
+    alloc_set_huge_pages(min_bytes >= 0 ? (size_t)min_bytes : stats.huge_min_bytes, (huge_mode)mode);
+    alloc_get_stats(&stats);
+    return Py_BuildValue("{s:n,s:s}", "min_bytes", (Py_ssize_t)stats.huge_min_bytes,
+                         "mode", huge_mode_names[stats.huge]);
 }
 
-/* For __setitem__ (e.g. mat[0] = 1) */
-static int Matrix61c_set_subscript(Matrix61c* self, PyObject *key, PyObject *v) {
-    if (!PyLong_Check(key)) {
-        PyErr_SetString(PyExc_TypeError, "Key is not valid");
-        return -1;
-    }
-    int index = PyLong_AsLong(key);
-    if (index >= self->mat->rows || index < 0) {
-        PyErr_SetString(PyExc_IndexError, "Index out of range");
-        return -1;
-    }
-    int cols = self->mat->cols;
-    if (cols == 1) {
-        if (!PyFloat_Check(v) && !PyLong_Check(v)) {
-            PyErr_SetString(PyExc_TypeError, "Value is not valid");
-            return -1;
-        }
-        double val = PyFloat_AsDouble(v);
-        set(self->mat, index, 0, val);
-        return 0;
-    } else {
-        if (!PyList_Check(v)) {
-            PyErr_SetString(PyExc_TypeError, "Value is not valid");
-            return -1;
-        }
-        for (int i = 0; i < cols; i++) {
-            if (!PyFloat_Check(PyList_GetItem(v, i)) && !PyLong_Check(PyList_GetItem(v, i))) {
-                PyErr_SetString(PyExc_TypeError, "Value is not valid");
-                return -1;
+/* numc.memory_trim(). Releases all cached blocks to the system and returns how many bytes that freed */
+static PyObject *numc_memory_trim(PyObject *self, PyObject *args) {
+    return PyLong_FromSize_t(alloc_trim());
+}
+
+/*
+ * numc.stats(). Returns the per-operation counters of stats.h, summed over all threads, as a
+ * dict from operation names ("add", "gemm", ..., "Matrix.__add__", ...) to dicts from shape
+ * buckets ("<=1K", ..., ">64M") to the counters. Only buckets with calls are included.
+ */
+static PyObject *numc_stats(PyObject *self, PyObject *args) {
+    PyObject *result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+    for (int op = 0; op < STATS_OPS; op++) {
+        PyObject *buckets = NULL;
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            stats_counter c;
+            stats_get(op, b, &c);
+            if (c.calls == 0)
+                continue;
+            if (buckets == NULL) {
+                buckets = PyDict_New();
+                if (buckets == NULL || PyDict_SetItemString(result, stats_op_name(op), buckets)) {
+                    Py_XDECREF(buckets);
+                    Py_DECREF(result);
+                    return NULL;
+                }
+                Py_DECREF(buckets);
             }
-            set(self->mat, index, i, PyFloat_AsDouble(PyList_GetItem(v, i)));
+            PyObject *counter = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+                                              "calls", (unsigned long long)c.calls,
+                                              "ns", (unsigned long long)c.ns,
+                                              "max_ns", (unsigned long long)c.max_ns,
+                                              "bytes_read", (unsigned long long)c.bytes_read,
+                                              "bytes_written", (unsigned long long)c.bytes_written,
+                                              "flops", (unsigned long long)c.flops,
+                                              "alloc_bytes", (unsigned long long)c.alloc_bytes);
+            if (counter == NULL || PyDict_SetItemString(buckets, stats_bucket_name(b), counter)) {
+                Py_XDECREF(counter);
+                Py_DECREF(result);
+                return NULL;
+            }
+            Py_DECREF(counter);
         }
-        return 0;
     }
-    return -1;
+    return result;
 }
 
-static PyMappingMethods Matrix61c_mapping = {
-    NULL,
-    (binaryfunc) Matrix61c_subscript,
-    (objobjargproc) Matrix61c_set_subscript,
-};
-
-/* NUMBER METHODS */
+/* numc.reset_stats(). Zeroes the counters of numc.stats() */
+static PyObject *numc_reset_stats(PyObject *self, PyObject *args) {
+    stats_reset();
+    Py_RETURN_NONE;
+}
 
 /*
- * Adds two numc.Matrix (Matrix61c) objects together. The first operand is self, and
- * the second operand can be obtained by casting `args`.
- * You will have to check if the arguments' dimensions match and if the second operand is an
- * instance of Matrix61c, and throw a type error if anything is violated.
+ * numc.set_stats(flag). Turns the counters of numc.stats() on or off and returns whether they
+ * were on before. They start out on if NUMC_STATS=1 was set at import. In a build with
+ * -DNUMC_NO_STATS nothing is ever counted.
  */
-static PyObject *Matrix61c_add(Matrix61c* self, PyObject* args) {
-    if (!PyObject_TypeCheck(args, &Matrix61cType)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
-        return NULL;
-    }
-    Matrix61c* mat61c = (Matrix61c*) args;
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, self->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
-        return NULL;
-    }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int add_failed = add_matrix(new_mat, self->mat, mat61c->mat);
-    if (add_failed) {
-        PyErr_SetString(PyExc_TypeError, "Add Error");
+static PyObject *numc_set_stats(PyObject *self, PyObject *args) {
+    int flag;
+    if (!PyArg_ParseTuple(args, "p", &flag))
         return NULL;
-    }
-    return (PyObject*)rv;
+    return PyBool_FromLong(stats_set_enabled(flag));
 }
 
 /*
- * Subtracts the second numc.Matrix (Matrix61c) object from the first one. The first operand is
- * self, and the second operand can be obtained by casting `args`.
- * You will have to check if the arguments' dimensions match and if the second operand is an
- * instance of Matrix61c, and throw a type error if anything is violated.
+ * numc.trace_start(events_per_thread=65536). Starts recording spans of kernels, methods,
+ * allocations and the tiles of the parallel loops (trace.h), keeping the last
+ * `events_per_thread` of every thread. Starting again discards what was recorded so far.
  */
-static PyObject *Matrix61c_sub(Matrix61c* self, PyObject* args) {
-    if (!PyObject_TypeCheck(args, &Matrix61cType)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
-        return NULL;
-    }
-    Matrix61c* mat61c = (Matrix61c*) args;
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, self->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+static PyObject *numc_trace_start(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"events_per_thread", NULL};
+    Py_ssize_t events = TRACE_DEFAULT_EVENTS;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &events))
         return NULL;
-    }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int sub_failed = sub_matrix(new_mat, self->mat, mat61c->mat);
-    if (sub_failed) {
-        PyErr_SetString(PyExc_TypeError, "Subtraction Error");
+    if (events < 1) {
+        PyErr_SetString(PyExc_ValueError, "events_per_thread must be positive");
         return NULL;
     }
-    return (PyObject*)rv;
+    trace_start((size_t)events);
+    Py_RETURN_NONE;
 }
 
 /*
- * Multiplies two numc.Matrix (Matrix61c) objects together. The first operand is self, and
- * the second operand can be obtained by casting `args`.
- * You will have to check if the arguments' dimensions are valid and if the second operand is an
- * instance of Matrix61c, and throw a type error if anything is violated.
+ * numc.trace_stop(path). Stops recording and writes the spans as Chrome trace-event JSON to
+ * `path`, for Perfetto or chrome://tracing. Returns the number of spans written.
  */
-static PyObject *Matrix61c_multiply(Matrix61c* self, PyObject *args) {
-    if (!PyObject_TypeCheck(args, &Matrix61cType)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
-        return NULL;
-    }
-    Matrix61c* mat61c = (Matrix61c*) args;
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, mat61c->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+static PyObject *numc_trace_stop(PyObject *self, PyObject *args) {
+    PyObject *path;
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
         return NULL;
     }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int mul_failed = mul_matrix(new_mat, self->mat, mat61c->mat);
-    if (mul_failed) {
-        PyErr_SetString(PyExc_TypeError, "Multiplication Error");
+    if (!trace_enabled) {
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "No trace is running");
         return NULL;
     }
-    return (PyObject*)rv;
+    const char *name = PyBytes_AS_STRING(path);
+    PyThreadState *state = PyEval_SaveThread();
+    long written = trace_stop(name);
+    PyEval_RestoreThread(state);
+    if (written < 0)
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, name);
+    Py_DECREF(path);
+    return written < 0 ? NULL : PyLong_FromLong(written);
 }
 
 /*
- * Negates the given numc.Matrix (Matrix61c).
+ * numc.set_threading(max_threads=None, serial_elements=None, elements_per_thread=None,
+ * flops_per_thread=None, pin_workers=None). Changes the given settings of the cost model in
+ * threading.c, which decides how many threads each kernel call uses, and returns all of them as
+ * a dict. Negative values leave a setting unchanged; a max_threads of 0 means one thread per
+ * core. pin_workers pins each worker of the thread pool in pool.c to a core of its own, of
+ * those the process may run on; OSError is raised, with the workers left unpinned, if that fails.
  */
-static PyObject *Matrix61c_neg(Matrix61c* self) {
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, self->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+static PyObject *numc_set_threading(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"max_threads", "serial_elements", "elements_per_thread",
+                             "flops_per_thread", "pin_workers", NULL};
+    threading_config config = {-1, -1, -1, -1, -1};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$illlp", kwlist, &config.max_threads,
+                                     &config.serial_elements, &config.elements_per_thread,
+                                     &config.flops_per_thread, &config.pin_workers))
         return NULL;
-    }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int neg_failed = neg_matrix(new_mat, self->mat);
-    if (neg_failed) {
-        PyErr_SetString(PyExc_TypeError, "Error when negating matrices");
-        return NULL;
-    }
-    return (PyObject*)rv;
+    if (set_threading(&config))
+        return PyErr_SetFromErrno(PyExc_OSError);
+    get_threading(&config);
+    return Py_BuildValue("{s:i,s:l,s:l,s:l,s:O}",
+                         "max_threads", config.max_threads,
+                         "serial_elements", config.serial_elements,
+                         "elements_per_thread", config.elements_per_thread,
+                         "flops_per_thread", config.flops_per_thread,
+                         "pin_workers", config.pin_workers ? Py_True : Py_False);
 }
 
+/* Names of the policies of numa.h, in the order of numa_policy */
+static const char *numa_policy_names[] = {"local", "partitioned", "interleave"};
+
 /*
- * Take the element-wise absolute value of this numc.Matrix (Matrix61c).
+ * numc.set_numa_policy(policy=None, bind=None). Sets how the pages of large matrices are placed
+ * on the NUMA nodes (numa.h): "partitioned", the default, has each thread touch first the part
+ * of a matrix the element-wise kernels give it, "interleave" spreads new matrices page by page
+ * over all nodes, and "local" leaves reused matrices to be zeroed by the allocating thread. bind
+ * is the pin_workers setting of numc.set_threading, which keeps each worker of the thread pool
+ * on a core, and so on a node, of its own. Returns the settings with the number of nodes.
  */
-static PyObject *Matrix61c_abs(Matrix61c *self) {
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, self->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+static PyObject *numc_set_numa_policy(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"policy", "bind", NULL};
+    const char *name = NULL;
+    PyObject *bind = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zO", kwlist, &name, &bind))
         return NULL;
+    int policy = -1;
+    for (int p = 0; name != NULL && p < 3; p++) {
+        if (!strcmp(name, numa_policy_names[p]))
+            policy = p;
     }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int abs_failed = abs_matrix(new_mat, self->mat);
-    if (abs_failed) {
-        PyErr_SetString(PyExc_TypeError, "Error when abs matrices");
+    if (name != NULL && policy < 0) {
+        PyErr_SetString(PyExc_ValueError, "policy must be 'local', 'partitioned' or 'interleave'");
         return NULL;
     }
-    return (PyObject*)rv;
+    threading_config config = {-1, -1, -1, -1, -1};
+    if (bind != Py_None && (config.pin_workers = PyObject_IsTrue(bind)) < 0)
+        return NULL;
+    if (policy >= 0)
+        numa_set_policy((numa_policy)policy);
+    if (set_threading(&config))
+        return PyErr_SetFromErrno(PyExc_OSError);
+    get_threading(&config);
+    return Py_BuildValue("{s:s,s:O,s:i}",
+                         "policy", numa_policy_names[numa_get_policy()],
+                         "bind", config.pin_workers ? Py_True : Py_False,
+                         "nodes", numa_nodes());
 }
 
 /*
- * Raise numc.Matrix (Matrix61c) to the `pow`th power. You can ignore the argument `optional`.
+ * numc.numa_node_bytes(m). Returns a dict from NUMA node to the number of bytes resident on it
+ * of the memory mappings holding the data of m, read from /proc/self/numa_maps. Pages never
+ * touched are on no node yet. Small matrices share their mapping with other allocations, which
+ * are counted too. Raises OSError where the kernel has no numa_maps.
  */
-static PyObject *Matrix61c_pow(Matrix61c *self, PyObject *pow, PyObject *optional) {
-    if (!PyObject_TypeCheck(pow, &PyLong_Type)) {
-        PyErr_SetString(PyExc_TypeError, "Exp must be an integer");
-        return NULL;
-    }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix *new_mat;
-    int ref_failed = allocate_matrix(&new_mat, self->mat->rows, self->mat->cols);
-    if (ref_failed) {
-        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+static PyObject *numc_numa_node_bytes(PyObject *self, PyObject *args) {
+    Matrix61c *m;
+    if (!PyArg_ParseTuple(args, "O!", &Matrix61cType, &m)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
         return NULL;
     }
-    rv->mat = new_mat;
-    rv->shape = PyTuple_Pack(2, PyLong_FromLong(new_mat->rows), PyLong_FromLong(new_mat->cols));
-    int pow_failed = pow_matrix(new_mat, self->mat, PyLong_AsLong(pow));
-    if (pow_failed) {
-        PyErr_SetString(PyExc_TypeError, "Matrix Exponential Failture");
+    if (evaluate(m))
         return NULL;
+    matrix *mat = m->mat;
+    size_t span = mat->rows > 0 && mat->cols > 0
+        ? ((size_t)(mat->rows - 1) * mat->row_stride + (size_t)(mat->cols - 1) * mat->col_stride + 1)
+        : 0;
+    size_t per_node[NUMA_MAX_NODES];
+    int top = numa_node_bytes(mat->data, span * sizeof(double), per_node);
+    if (top < 0)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, "/proc/self/numa_maps");
+    PyObject *result = PyDict_New();
+    for (int node = 0; result != NULL && node < top; node++) {
+        if (per_node[node] == 0)
+            continue;
+        PyObject *key = PyLong_FromLong(node);
+        PyObject *value = PyLong_FromSize_t(per_node[node]);
+        if (key == NULL || value == NULL || PyDict_SetItem(result, key, value))
+            Py_CLEAR(result);
+        Py_XDECREF(key);
+        Py_XDECREF(value);
     }
-    return (PyObject*)rv;
+    return result;
+}
+
+/* Add class methods */
+static PyMethodDef Matrix61c_class_methods[] = {
+    {"to_list", (PyCFunction)Matrix61c_class_to_list, METH_VARARGS, "Returns a list representation of numc.Matrix"},
+    {"backend", (PyCFunction)Matrix61c_backend, METH_NOARGS, "Returns the name of the active kernel variant"},
+    {"add", (PyCFunction)numc_add, METH_VARARGS | METH_KEYWORDS, "add(a, b, out=None): a + b, written to out if given"},
+    {"sub", (PyCFunction)numc_sub, METH_VARARGS | METH_KEYWORDS, "sub(a, b, out=None): a - b, written to out if given"},
+    {"mul", (PyCFunction)numc_mul, METH_VARARGS | METH_KEYWORDS, "mul(a, b, out=None): a * b, written to out if given"},
+    {"neg", (PyCFunction)numc_neg, METH_VARARGS | METH_KEYWORDS, "neg(a, out=None): -a, written to out if given"},
+    {"abs", (PyCFunction)numc_abs, METH_VARARGS | METH_KEYWORDS, "abs(a, out=None): abs(a), written to out if given"},
+    {"gemm", (PyCFunction)numc_gemm, METH_VARARGS | METH_KEYWORDS,
+     "gemm(a, b, c=None, alpha=1.0, beta=0.0, trans_a=False, trans_b=False): alpha * op(a) * op(b) + beta * c, written to c"},
+    {"memory_stats", (PyCFunction)numc_memory_stats, METH_NOARGS, "Returns the counters of the matrix data allocator"},
+    {"memory_trim", (PyCFunction)numc_memory_trim, METH_NOARGS, "Releases cached matrix data to the system"},
+    {"set_huge_pages", (PyCFunction)numc_set_huge_pages, METH_VARARGS | METH_KEYWORDS,
+     "set_huge_pages(min_bytes=None, mode=None): sets which matrices get huge pages and how; returns the settings"},
+    {"stats", (PyCFunction)numc_stats, METH_NOARGS, "Returns the per-operation call, time, traffic and allocation counters"},
+    {"reset_stats", (PyCFunction)numc_reset_stats, METH_NOARGS, "Zeroes the per-operation counters"},
+    {"set_stats", (PyCFunction)numc_set_stats, METH_VARARGS, "Turns the per-operation counters on or off"},
+    {"trace_start", (PyCFunction)numc_trace_start, METH_VARARGS | METH_KEYWORDS,
+     "trace_start(events_per_thread=65536): starts recording spans of kernels and parallel loops"},
+    {"trace_stop", (PyCFunction)numc_trace_stop, METH_VARARGS,
+     "trace_stop(path): stops recording and writes the spans to path as Chrome trace-event JSON"},
+    {"set_threading", (PyCFunction)numc_set_threading, METH_VARARGS | METH_KEYWORDS,
+     "Tunes how many threads kernels use depending on their size; returns the settings"},
+    {"set_numa_policy", (PyCFunction)numc_set_numa_policy, METH_VARARGS | METH_KEYWORDS,
+     "set_numa_policy(policy=None, bind=None): sets the NUMA page placement of large matrices; returns the settings"},
+    {"numa_node_bytes", (PyCFunction)numc_numa_node_bytes, METH_VARARGS,
+     "numa_node_bytes(m): bytes of the mappings holding m resident on each NUMA node"},
+    {"set_lazy", (PyCFunction)numc_set_lazy, METH_VARARGS, "Turns lazy evaluation of element-wise operators on or off"},
+    {"submit", (PyCFunction)numc_submit, METH_VARARGS,
+     "submit(op, *args): queues op on a background thread and returns a numc.Future of its result"},
+    {"set_executor", (PyCFunction)numc_set_executor, METH_VARARGS | METH_KEYWORDS,
+     "set_executor(threads=None): sets how many threads run submitted operations; returns the settings"},
+    {"pow", (PyCFunction)numc_pow, METH_VARARGS | METH_KEYWORDS, "pow(a, n, out=None): a ** n, written to out if given"},
+    {"set_printoptions", (PyCFunction)numc_set_printoptions, METH_VARARGS | METH_KEYWORDS,
+     "Sets the size above which the repr of a matrix is summarized; returns the settings"},
+    {"save", (PyCFunction)numc_save, METH_VARARGS, "save(path, m): writes m to a binary file at path"},
+    {"load", (PyCFunction)numc_load, METH_VARARGS | METH_KEYWORDS,
+     "load(path, mmap=True, verify=None): reads a matrix written by save, mapping the file if mmap is set"},
+    {"tiled_add", (PyCFunction)numc_tiled_add, METH_VARARGS, "tiled_add(a, b, out): out = a + b on numc.TiledMatrix objects"},
+    {"tiled_mul", (PyCFunction)numc_tiled_mul, METH_VARARGS, "tiled_mul(a, b, out): out = a * b on numc.TiledMatrix objects"},
+    {"set_tile_cache", (PyCFunction)numc_set_tile_cache, METH_VARARGS | METH_KEYWORDS,
+     "Sets the byte budget of the numc.TiledMatrix tile cache; returns it with the cache counters"},
+    {NULL, NULL, 0, NULL}
+};
+
+/* REPRESENTATION */
+
+/*
+ * The repr is formatted in C straight from the matrix data, the same way repr() formats the
+ * nested list of to_list, but without creating a Python object per entry. Matrices with more
+ * than `print_threshold` entries are summarized: only the first and last `print_edgeitems`
+ * rows are printed, and of those only the first and last `print_edgeitems` entries, with "..."
+ * standing in for the rest. Both are set by numc.set_printoptions.
+ */
+static Py_ssize_t print_threshold = 1000;
+static Py_ssize_t print_edgeitems = 3;
+
+/* Text being built by the repr */
+typedef struct text {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed; // set once an allocation failed; later appends do nothing
+} text;
+
+static void text_append(text *t, const char *str, size_t n) {
+    if (t->failed)
+        return;
+    if (t->len + n > t->cap) {
+        size_t cap = t->cap ? 2 * t->cap : 256;
+        while (cap < t->len + n)
+            cap *= 2;
+        char *data = (char *)PyMem_Realloc(t->data, cap);
+        if (data == NULL) {
+            t->failed = 1;
+            return;
+        }
+        t->data = data;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, str, n);
+    t->len += n;
+}
+
+static void text_append_str(text *t, const char *str) {
+    text_append(t, str, strlen(str));
+}
+
+/* Appends `val` formatted like repr(float) */
+static void text_append_double(text *t, double val) {
+    char *str = PyOS_double_to_string(val, 'r', 0, Py_DTSF_ADD_DOT_0, NULL);
+    if (str == NULL) {
+        t->failed = 1;
+        return;
+    }
+    text_append_str(t, str);
+    PyMem_Free(str);
+}
+
+/* Returns the index printed after `i` out of `len`, skipping the middle if `summarize` is set */
+static Py_ssize_t next_printed(Py_ssize_t i, Py_ssize_t len, int summarize) {
+    if (summarize && len > 2 * print_edgeitems && i == print_edgeitems - 1)
+        return len - print_edgeitems;
+    return i + 1;
+}
+
+/* Matrix61c string representation. For printing purposes. */
+static PyObject *Matrix61c_repr(PyObject *self) {
+    if (evaluate((Matrix61c *)self))
+        return NULL;
+    matrix *mat = ((Matrix61c *)self)->mat;
+    int summarize = (Py_ssize_t)mat->rows * mat->cols > print_threshold;
+    text t = {NULL, 0, 0, 0};
+    text_append_str(&t, "[");
+    for (Py_ssize_t i = 0, prev_i = -1; i < mat->rows; prev_i = i, i = next_printed(i, mat->rows, summarize)) {
+        if (i > 0)
+            text_append_str(&t, i == prev_i + 1 ? ", " : ", ..., ");
+        text_append_str(&t, "[");
+        for (Py_ssize_t j = 0, prev_j = -1; j < mat->cols; prev_j = j, j = next_printed(j, mat->cols, summarize)) {
+            if (j > 0)
+                text_append_str(&t, j == prev_j + 1 ? ", " : ", ..., ");
+            text_append_double(&t, get(mat, i, j));
+        }
+        text_append_str(&t, "]");
+    }
+    text_append_str(&t, "]");
+    PyObject *repr = t.failed ? PyErr_NoMemory() : PyUnicode_FromStringAndSize(t.data, t.len);
+    PyMem_Free(t.data);
+    return repr;
+}
+
+/*
+ * numc.set_printoptions(threshold=None, edgeitems=None). Changes when the repr of a matrix is
+ * summarized and how many rows and columns it keeps on each side, and returns both settings
+ * as a dict. Negative values leave a setting unchanged.
+ */
+static PyObject *numc_set_printoptions(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"threshold", "edgeitems", NULL};
+    Py_ssize_t threshold = -1, edgeitems = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$nn", kwlist, &threshold, &edgeitems))
+        return NULL;
+    if (edgeitems == 0) {
+        PyErr_SetString(PyExc_TypeError, "edgeitems must be at least 1");
+        return NULL;
+    }
+    if (threshold >= 0)
+        print_threshold = threshold;
+    if (edgeitems > 0)
+        print_edgeitems = edgeitems;
+    return Py_BuildValue("{s:n,s:n}", "threshold", print_threshold, "edgeitems", print_edgeitems);
+}
+
+/*
+ * Iterator returned by Matrix.rows(). Each step builds the list of one row only, so a matrix
+ * can be converted to Python in bounded memory.
+ */
+typedef struct RowIterator {
+    PyObject_HEAD
+    Matrix61c *matrix;
+    Py_ssize_t row; // next row to yield
+} RowIterator;
+
+static void RowIterator_dealloc(RowIterator *self) {
+    Py_XDECREF(self->matrix);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *RowIterator_next(RowIterator *self) {
+    if (evaluate(self->matrix))
+        return NULL;
+    matrix *mat = self->matrix->mat;
+    if (self->row >= mat->rows)
+        return NULL;
+    PyObject *row = PyList_New(mat->cols);
+    if (row == NULL)
+        return NULL;
+    for (Py_ssize_t j = 0; j < mat->cols; j++) {
+        PyObject *val = PyFloat_FromDouble(get(mat, self->row, j));
+        if (val == NULL) {
+            Py_DECREF(row);
+            return NULL;
+        }
+        PyList_SET_ITEM(row, j, val);
+    }
+    self->row++;
+    return row;
+}
+
+static PyTypeObject RowIteratorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "numc.RowIterator",
+    .tp_basicsize = sizeof(RowIterator),
+    .tp_dealloc = (destructor)RowIterator_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Iterator over the rows of a numc.Matrix, as lists",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)RowIterator_next,
+};
+
+/* m.rows(). Returns an iterator yielding the rows of `self` as lists, one at a time */
+static PyObject *Matrix61c_rows(Matrix61c *self, PyObject *args) {
+    RowIterator *it = PyObject_New(RowIterator, &RowIteratorType);
+    if (it == NULL)
+        return NULL;
+    Py_INCREF(self);
+    it->matrix = self;
+    it->row = 0;
+    return (PyObject *)it;
+}
+
+/* Wraps `mat` in a new numc.Matrix object, which takes over the reference to it */
+static PyObject *Matrix61c_from_matrix(matrix *mat) {
+    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
+    if (rv == NULL) {
+        deallocate_matrix(mat);
+        return NULL;
+    }
+    rv->mat = mat;
+    rv->shape = Py_BuildValue("(nn)", (Py_ssize_t)mat->rows, (Py_ssize_t)mat->cols);
+    return (PyObject*)rv;
+}
+
+/*
+ * Parses one component of a subscript key for a dimension of length `len`. An integer
+ * selects a single entry, a slice selects `count` entries starting at `start`, `step` apart.
+ * Returns -1 and sets an exception if the component is not valid.
+ */
+static int parse_index(PyObject *index, Py_ssize_t len, Py_ssize_t *start, Py_ssize_t *step,
+                       Py_ssize_t *count) {
+    if (PyLong_Check(index)) {
+        Py_ssize_t i = PyLong_AsSsize_t(index);
+        if (i >= len || i < 0) {
+            PyErr_SetString(PyExc_IndexError, "Index out of range");
+            return -1;
+        }
+        *start = i; *step = 1; *count = 1;
+        return 0;
+    }
+    if (PySlice_Check(index)) {
+        Py_ssize_t stop;
+        if (PySlice_Unpack(index, start, &stop, step) < 0)
+            return -1;
+        *count = PySlice_AdjustIndices(len, start, &stop, *step);
+        if (*count < 1) {
+            PyErr_SetString(PyExc_ValueError, "Slice is empty");
+            return -1;
+        }
+        return 0;
+    }
+    PyErr_SetString(PyExc_TypeError, "Key is not valid");
+    return -1;
+}
+
+/*
+ * Makes a view of the entries of `self` selected by a slice of rows or by a (rows, cols)
+ * tuple whose components are integers or slices. The view shares `self`'s data. `scalar`
+ * is set if both components of a tuple are integers. Returns NULL and sets an exception if
+ * the key is not valid.
+ */
+static matrix *subscript_view(Matrix61c *self, PyObject *key, int *scalar) {
+    matrix *mat = self->mat;
+    PyObject *row_key = key, *col_key = NULL;
+    Py_ssize_t r0 = 0, rstep = 1, rows = mat->rows, c0 = 0, cstep = 1, cols = mat->cols;
+    if (PyTuple_Check(key)) {
+        if (PyTuple_GET_SIZE(key) != 2) {
+            PyErr_SetString(PyExc_TypeError, "Key is not valid");
+            return NULL;
+        }
+        row_key = PyTuple_GET_ITEM(key, 0);
+        col_key = PyTuple_GET_ITEM(key, 1);
+    }
+    if (parse_index(row_key, mat->rows, &r0, &rstep, &rows))
+        return NULL;
+    if (col_key && parse_index(col_key, mat->cols, &c0, &cstep, &cols))
+        return NULL;
+    *scalar = col_key && PyLong_Check(row_key) && PyLong_Check(col_key);
+    matrix *view;
+    if (allocate_matrix_view(&view, mat, r0 * mat->row_stride + c0 * mat->col_stride, rows, cols,
+                             rstep * mat->row_stride, cstep * mat->col_stride)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+        return NULL;
+    }
+    return view;
+}
+
+/*
+ * Number of entries of `self`, which may be pending. Calls of the numc.Matrix methods go into
+ * the shape bucket of numc.stats() for the size of their left operand.
+ */
+static double stats_entries(Matrix61c *self) {
+    if (self->expr)
+        return (double)self->expr->rows * self->expr->cols;
+    return self->mat ? (double)self->mat->rows * self->mat->cols : 0;
+}
+
+/* For __getitem__. (e.g. mat[0], mat[1:3], mat[0:2, 1], mat[::2, ::-1]) */
+static PyObject *get_subscript(Matrix61c* self, PyObject* key) {
+    if (evaluate(self))
+        return NULL;
+    if (PySlice_Check(key) || PyTuple_Check(key)) {
+        int scalar;
+        matrix *view = subscript_view(self, key, &scalar);
+        if (view == NULL)
+            return NULL;
+        if (scalar) {
+            double val = get(view, 0, 0);
+            deallocate_matrix(view);
+            return PyFloat_FromDouble(val);
+        }
+        return Matrix61c_from_matrix(view);
+    }
+    if (!PyLong_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Key is not valid");
+        return NULL;
+    }
+    Py_ssize_t index = PyLong_AsSsize_t(key);
+    if (index >= self->mat->rows || index < 0) {
+        PyErr_SetString(PyExc_IndexError, "Index out of range");
+        return NULL;
+    }
+    if (self->mat->cols == 1) { // if one single number, unwrap from list
+        return PyFloat_FromDouble(get(self->mat, index, 0));
+    }
+    matrix *new_mat;
+    int ref_failed = allocate_matrix_view(&new_mat, self->mat, index * self->mat->row_stride,
+                                          self->mat->cols, 1, self->mat->col_stride, 1);
+    if (ref_failed) {
+        return NULL;
+    }
+    return Matrix61c_from_matrix(new_mat);
+}
+
+/*
+ * Writes `v` to every entry of the view `mat`. `v` can be a number, a numc.Matrix of the same
+ * shape, a list of lists matching the shape, or a flat list if the view has a single row or
+ * column. Returns -1 and sets an exception if `v` does not fit.
+ */
+static int assign_view(matrix *mat, PyObject *v) {
+    if (PyFloat_Check(v) || PyLong_Check(v)) {
+        fill_matrix(mat, PyFloat_AsDouble(v));
+        return 0;
+    }
+    if (PyObject_TypeCheck(v, &Matrix61cType)) {
+        if (evaluate((Matrix61c *)v))
+            return -1;
+        matrix *src = ((Matrix61c *)v)->mat;
+        if (src->rows != mat->rows || src->cols != mat->cols) {
+            PyErr_SetString(PyExc_ValueError, "Shape of value does not match");
+            return -1;
+        }
+        if (copy_matrix(mat, src)) {
+            PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+            return -1;
+        }
+        return 0;
+    }
+    if (!PyList_Check(v)) {
+        PyErr_SetString(PyExc_TypeError, "Value is not valid");
+        return -1;
+    }
+    int flat = (mat->rows == 1 || mat->cols == 1) && PyList_GET_SIZE(v) == mat->rows * mat->cols;
+    if (!flat && PyList_GET_SIZE(v) != mat->rows) {
+        PyErr_SetString(PyExc_ValueError, "Shape of value does not match");
+        return -1;
+    }
+    /* Check everything before writing so that a bad value leaves the matrix untouched */
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(v); i++) {
+        PyObject *item = PyList_GET_ITEM(v, i);
+        if (flat) {
+            if (!PyFloat_Check(item) && !PyLong_Check(item)) {
+                PyErr_SetString(PyExc_TypeError, "Value is not valid");
+                return -1;
+            }
+            continue;
+        }
+        if (!PyList_Check(item) || PyList_GET_SIZE(item) != mat->cols) {
+            PyErr_SetString(PyExc_ValueError, "Shape of value does not match");
+            return -1;
+        }
+        for (Py_ssize_t j = 0; j < mat->cols; j++) {
+            PyObject *val = PyList_GET_ITEM(item, j);
+            if (!PyFloat_Check(val) && !PyLong_Check(val)) {
+                PyErr_SetString(PyExc_TypeError, "Value is not valid");
+                return -1;
+            }
+        }
+    }
+    for (Py_ssize_t i = 0; i < mat->rows; i++) {
+        for (Py_ssize_t j = 0; j < mat->cols; j++) {
+            PyObject *val = flat ? PyList_GET_ITEM(v, i * mat->cols + j)
+                                 : PyList_GET_ITEM(PyList_GET_ITEM(v, i), j);
+            set(mat, i, j, PyFloat_AsDouble(val));
+        }
+    }
+    return 0;
+}
+
+/* For __setitem__ (e.g. mat[0] = 1, mat[1:3, 0] = [1, 2], mat[::2] = 0) */
+static int set_subscript(Matrix61c* self, PyObject *key, PyObject *v) {
+    if (v == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete entries of a numc.Matrix");
+        return -1;
+    }
+    if (evaluate(self) || flush_pending(self->mat))
+        return -1;
+    if (PySlice_Check(key) || PyTuple_Check(key)) {
+        int scalar;
+        matrix *view = subscript_view(self, key, &scalar);
+        if (view == NULL)
+            return -1;
+        int failed = assign_view(view, v);
+        deallocate_matrix(view);
+        return failed;
+    }
+    if (!PyLong_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Key is not valid");
+        return -1;
+    }
+    Py_ssize_t index = PyLong_AsSsize_t(key);
+    if (index >= self->mat->rows || index < 0) {
+        PyErr_SetString(PyExc_IndexError, "Index out of range");
+        return -1;
+    }
+    Py_ssize_t cols = self->mat->cols;
+    if (cols == 1) {
+        if (!PyFloat_Check(v) && !PyLong_Check(v)) {
+            PyErr_SetString(PyExc_TypeError, "Value is not valid");
+            return -1;
+        }
+        double val = PyFloat_AsDouble(v);
+        set(self->mat, index, 0, val);
+        return 0;
+    } else {
+        if (!PyList_Check(v)) {
+            PyErr_SetString(PyExc_TypeError, "Value is not valid");
+            return -1;
+        }
+        for (Py_ssize_t i = 0; i < cols; i++) {
+            if (!PyFloat_Check(PyList_GetItem(v, i)) && !PyLong_Check(PyList_GetItem(v, i))) {
+                PyErr_SetString(PyExc_TypeError, "Value is not valid");
+                return -1;
+            }
+            set(self->mat, index, i, PyFloat_AsDouble(PyList_GetItem(v, i)));
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static PyObject *Matrix61c_subscript(Matrix61c* self, PyObject* key) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_GETITEM);
+    PyObject *rv = get_subscript(self, key);
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+static int Matrix61c_set_subscript(Matrix61c* self, PyObject *key, PyObject *v) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_SETITEM);
+    int rv = set_subscript(self, key, v);
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+static PyMappingMethods Matrix61c_mapping = {
+    NULL,
+    (binaryfunc) Matrix61c_subscript,
+    (objobjargproc) Matrix61c_set_subscript,
+};
+
+/* NUMBER METHODS */
+
+/*
+ * Kernels doing less work than this (in entries written or multiply-adds) keep the GIL, since
+ * handing it over costs more than they take. Larger ones release it so that other Python
+ * threads, including ones running numc operations of their own, can proceed meanwhile.
+ */
+#define GIL_RELEASE_WORK 16384
+
+/*
+ * Releases the GIL if a kernel doing `work` is worth it. Returns the thread state to pass to
+ * restore_gil, or NULL if the GIL is still held. The kernels must not touch Python objects.
+ */
+static PyThreadState *release_gil(double work) {
+    return work >= GIL_RELEASE_WORK ? PyEval_SaveThread() : NULL;
+}
+
+/* Reacquires the GIL released by release_gil */
+static void restore_gil(PyThreadState *state) {
+    if (state)
+        PyEval_RestoreThread(state);
+}
+
+/* LAZY EVALUATION */
+
+/*
+ * In lazy mode (numc.set_lazy(True), or NUMC_LAZY=1 at import) the element-wise operators +,
+ * - and abs() do not compute anything. They return a pending numc.Matrix holding an expression
+ * tree (expr.h) over their operands, and operators applied to pending matrices extend the tree.
+ * The entries are computed in one fused pass the first time they are looked at; the shape is
+ * known right away. Writes to a matrix first evaluate every pending result that reads it, so
+ * lazy results always have the value the operands had when the operator ran. Writes through
+ * a buffer exported before the operator ran are not noticed, though.
+ */
+static int lazy_mode = 0;
+
+/* All pending numc.Matrix objects, so that writes can find the ones reading what they overwrite */
+static Matrix61c *pending_head = NULL;
+
+static void link_pending(Matrix61c *self) {
+    self->prev_pending = NULL;
+    self->next_pending = pending_head;
+    if (pending_head)
+        pending_head->prev_pending = self;
+    pending_head = self;
+}
+
+static void unlink_pending(Matrix61c *self) {
+    if (self->prev_pending)
+        self->prev_pending->next_pending = self->next_pending;
+    else
+        pending_head = self->next_pending;
+    if (self->next_pending)
+        self->next_pending->prev_pending = self->prev_pending;
+    self->prev_pending = self->next_pending = NULL;
+}
+
+/*
+ * Computes the entries of `self` if it is pending. Every function that looks at the data of a
+ * numc.Matrix calls this first. Returns -1 and sets an exception on failure.
+ */
+static int evaluate(Matrix61c *self) {
+    expr *e = self->expr;
+    if (e == NULL)
+        return 0;
+    matrix *mat;
+    if (allocate_matrix_uninit(&mat, e->rows, e->cols)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+        return -1;
+    }
+    unlink_pending(self);
+    self->expr = NULL;
+    self->mat = mat;
+    PyThreadState *state = release_gil((double)e->rows * e->cols * e->nodes);
+    int failed = expr_evaluate(mat, e);
+    restore_gil(state);
+    expr_release(e);
+    if (failed) {
+        PyErr_SetString(PyExc_RuntimeError, "Evaluation Error");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Evaluates every pending result that reads data shared with `mat`, after waiting for the
+ * submitted operations reading it. Called before anything is written to `mat`. Returns -1 and
+ * sets an exception on failure.
+ */
+static int flush_pending(matrix *mat) {
+    wait_futures(mat);
+    Matrix61c *p = pending_head;
+    while (p != NULL) {
+        if (!expr_reads(p->expr, mat)) {
+            p = p->next_pending;
+            continue;
+        }
+        Py_INCREF(p);
+        int failed = evaluate(p);
+        Py_DECREF(p);
+        if (failed)
+            return -1;
+        p = pending_head; // the list may have changed while the GIL was released
+    }
+    return 0;
+}
+
+/* Stores the shape of `self`, which may be pending, to `rows` and `cols` */
+static void shape_of(Matrix61c *self, Py_ssize_t *rows, Py_ssize_t *cols) {
+    *rows = self->expr ? self->expr->rows : self->mat->rows;
+    *cols = self->expr ? self->expr->cols : self->mat->cols;
+}
+
+/*
+ * Returns a pending numc.Matrix computing `op` of `a` and, for a binary `op`, `b`. Pending
+ * operands are fused into the new tree, unless it would grow past EXPR_MAX_NODES, in which
+ * case they are evaluated first.
+ */
+static PyObject *lazy_operation(expr_op op, Matrix61c *a, Matrix61c *b) {
+    int nodes = (a->expr ? a->expr->nodes : 1) + (b == NULL ? 0 : b->expr ? b->expr->nodes : 1);
+    if (nodes + 1 > EXPR_MAX_NODES && (evaluate(a) || (b != NULL && evaluate(b))))
+        return NULL;
+    expr *leaf_a = NULL, *leaf_b = NULL, *e = NULL;
+    expr *ea = a->expr ? a->expr : (leaf_a = expr_leaf(a->mat));
+    expr *eb = b == NULL ? NULL : b->expr ? b->expr : (leaf_b = expr_leaf(b->mat));
+    if (ea != NULL && (b == NULL || eb != NULL))
+        e = b == NULL ? expr_unary(op, ea) : expr_binary(op, ea, eb);
+    expr_release(leaf_a);
+    expr_release(leaf_b);
+    if (e == NULL)
+        return PyErr_NoMemory();
+    Matrix61c *rv = (Matrix61c *)Matrix61c_new(&Matrix61cType, NULL, NULL);
+    if (rv == NULL) {
+        expr_release(e);
+        return NULL;
+    }
+    rv->expr = e;
+    rv->shape = Py_BuildValue("(nn)", (Py_ssize_t)e->rows, (Py_ssize_t)e->cols);
+    link_pending(rv);
+    return (PyObject *)rv;
+}
+
+/* numc.set_lazy(flag). Turns lazy mode on or off and returns whether it was on before */
+static PyObject *numc_set_lazy(PyObject *self, PyObject *args) {
+    int flag;
+    if (!PyArg_ParseTuple(args, "p", &flag))
+        return NULL;
+    int was_lazy = lazy_mode;
+    lazy_mode = flag;
+    return PyBool_FromLong(was_lazy);
+}
+
+/*
+ * Returns the numc.Matrix a rows x cols result is written to: `out` if it is given, after
+ * checking its type and shape, or else a new matrix. The contents of a new matrix are
+ * unspecified, since every kernel overwrites all of them. Returns a new reference, or NULL with
+ * an exception set.
+ */
+static Matrix61c *result_matrix(PyObject *out, Py_ssize_t rows, Py_ssize_t cols) {
+    if (out != NULL && out != Py_None) {
+        if (!PyObject_TypeCheck(out, &Matrix61cType)) {
+            PyErr_SetString(PyExc_TypeError, "out must of type numc.Matrix!");
+            return NULL;
+        }
+        if (evaluate((Matrix61c *)out))
+            return NULL;
+        if (((Matrix61c *)out)->mat->rows != rows || ((Matrix61c *)out)->mat->cols != cols) {
+            PyErr_SetString(PyExc_ValueError, "out has the wrong shape");
+            return NULL;
+        }
+        if (flush_pending(((Matrix61c *)out)->mat))
+            return NULL;
+        Py_INCREF(out);
+        return (Matrix61c *)out;
+    }
+    matrix *new_mat;
+    if (allocate_matrix_uninit(&new_mat, rows, cols)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+        return NULL;
+    }
+    return (Matrix61c *)Matrix61c_from_matrix(new_mat);
+}
+
+/*
+ * Runs the kernel of a binary operation on `self` and `other` and writes the result to `out`,
+ * or to a new matrix if `out` is NULL. `product` selects the shape rules of matrix
+ * multiplication instead of the element-wise ones. `error` is the message raised if the
+ * operands do not fit. In lazy mode, element-wise operations without `out` return a pending
+ * result instead.
+ */
+static PyObject *binary_operation(int (*kernel)(matrix *, matrix *, matrix *), Matrix61c *self,
+                                  PyObject *other, PyObject *out, int product, const char *error) {
+    if (!PyObject_TypeCheck(other, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+        return NULL;
+    }
+    Matrix61c *rhs = (Matrix61c *)other;
+    int lazy = lazy_mode && !product && (out == NULL || out == Py_None);
+    if (!lazy && (evaluate(self) || evaluate(rhs)))
+        return NULL;
+    Py_ssize_t rows1, cols1, rows2, cols2;
+    shape_of(self, &rows1, &cols1);
+    shape_of(rhs, &rows2, &cols2);
+    if (product ? cols1 != rows2 : rows1 != rows2 || cols1 != cols2) {
+        PyErr_SetString(PyExc_TypeError, error);
+        return NULL;
+    }
+    if (lazy)
+        return lazy_operation(kernel == add_matrix ? EXPR_ADD : EXPR_SUB, self, rhs);
+    matrix *mat1 = self->mat, *mat2 = rhs->mat;
+    Py_ssize_t cols = product ? mat2->cols : mat1->cols;
+    Matrix61c *rv = result_matrix(out, mat1->rows, cols);
+    if (rv == NULL)
+        return NULL;
+    PyThreadState *state = release_gil((double)mat1->rows * cols * (product ? mat1->cols : 1));
+    int failed = kernel(rv->mat, mat1, mat2);
+    restore_gil(state);
+    if (failed) {
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_RuntimeError, error);
+        return NULL;
+    }
+    return (PyObject*)rv;
+}
+
+/* Unary counterpart of binary_operation */
+static PyObject *unary_operation(int (*kernel)(matrix *, matrix *), Matrix61c *self,
+                                 PyObject *out, const char *error) {
+    if (lazy_mode && (out == NULL || out == Py_None))
+        return lazy_operation(kernel == neg_matrix ? EXPR_NEG : EXPR_ABS, self, NULL);
+    if (evaluate(self))
+        return NULL;
+    Matrix61c *rv = result_matrix(out, self->mat->rows, self->mat->cols);
+    if (rv == NULL)
+        return NULL;
+    PyThreadState *state = release_gil((double)self->mat->rows * self->mat->cols);
+    int failed = kernel(rv->mat, self->mat);
+    restore_gil(state);
+    if (failed) {
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_RuntimeError, error);
+        return NULL;
+    }
+    return (PyObject*)rv;
+}
+
+/* Raises `self` to the power `pow` and writes the result to `out`, or to a new matrix */
+static PyObject *pow_operation(Matrix61c *self, PyObject *pow, PyObject *out) {
+    if (!PyObject_TypeCheck(pow, &PyLong_Type)) {
+        PyErr_SetString(PyExc_TypeError, "Exp must be an integer");
+        return NULL;
+    }
+    long exp = PyLong_AsLong(pow);
+    if (evaluate(self))
+        return NULL;
+    if (exp < 0 || exp > INT_MAX || self->mat->rows != self->mat->cols) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_TypeError, "Matrix Exponential Failture");
+        return NULL;
+    }
+    Matrix61c *rv = result_matrix(out, self->mat->rows, self->mat->cols);
+    if (rv == NULL)
+        return NULL;
+    PyThreadState *state = release_gil((double)self->mat->rows * self->mat->cols * self->mat->cols);
+    int failed = pow_matrix(rv->mat, self->mat, exp);
+    restore_gil(state);
+    if (failed) {
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_RuntimeError, "Matrix Exponential Failture");
+        return NULL;
+    }
+    return (PyObject*)rv;
+}
+
+/*
+ * Adds two numc.Matrix (Matrix61c) objects together. The first operand is self, and
+ * the second operand can be obtained by casting `args`.
+ * You will have to check if the arguments' dimensions match and if the second operand is an
+ * instance of Matrix61c, and throw a type error if anything is violated.
+ */
+static PyObject *Matrix61c_add(Matrix61c* self, PyObject* args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_ADD);
+    PyObject *rv = binary_operation(add_matrix, self, args, NULL, 0, "Add Error");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * Subtracts the second numc.Matrix (Matrix61c) object from the first one. The first operand is
+ * self, and the second operand can be obtained by casting `args`.
+ * You will have to check if the arguments' dimensions match and if the second operand is an
+ * instance of Matrix61c, and throw a type error if anything is violated.
+ */
+static PyObject *Matrix61c_sub(Matrix61c* self, PyObject* args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_SUB);
+    PyObject *rv = binary_operation(sub_matrix, self, args, NULL, 0, "Subtraction Error");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * Multiplies two numc.Matrix (Matrix61c) objects together. The first operand is self, and
+ * the second operand can be obtained by casting `args`.
+ * You will have to check if the arguments' dimensions are valid and if the second operand is an
+ * instance of Matrix61c, and throw a type error if anything is violated.
+ */
+static PyObject *Matrix61c_multiply(Matrix61c* self, PyObject *args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_MUL);
+    PyObject *rv = binary_operation(mul_matrix, self, args, NULL, 1, "Multiplication Error");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * Negates the given numc.Matrix (Matrix61c).
+ */
+static PyObject *Matrix61c_neg(Matrix61c* self) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_NEG);
+    PyObject *rv = unary_operation(neg_matrix, self, NULL, "Error when negating matrices");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * Take the element-wise absolute value of this numc.Matrix (Matrix61c).
+ */
+static PyObject *Matrix61c_abs(Matrix61c *self) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_ABS);
+    PyObject *rv = unary_operation(abs_matrix, self, NULL, "Error when abs matrices");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * Raise numc.Matrix (Matrix61c) to the `pow`th power. You can ignore the argument `optional`.
+ */
+static PyObject *Matrix61c_pow(Matrix61c *self, PyObject *pow, PyObject *optional) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_POW);
+    PyObject *rv = pow_operation(self, pow, NULL);
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+/*
+ * The in-place operators (+=, -=, *=, **=) write the result into the data of `self`, which
+ * views of `self` therefore see as well. The element-wise kernels work in place directly;
+ * multiplication and powers go through a temporary inside the kernel. A product whose shape
+ * differs from `self` cannot be stored there, so `*=` then returns a new matrix instead.
+ */
+static PyObject *Matrix61c_inplace_add(Matrix61c* self, PyObject* args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_IADD);
+    PyObject *rv = binary_operation(add_matrix, self, args, (PyObject *)self, 0, "Add Error");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+static PyObject *Matrix61c_inplace_sub(Matrix61c* self, PyObject* args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_ISUB);
+    PyObject *rv = binary_operation(sub_matrix, self, args, (PyObject *)self, 0, "Subtraction Error");
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+static PyObject *Matrix61c_inplace_multiply(Matrix61c* self, PyObject *args) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_IMUL);
+    PyObject *rv = NULL;
+    /* Both shapes are looked at here, so pending operands are evaluated first */
+    if (!evaluate(self) && (!PyObject_TypeCheck(args, &Matrix61cType) || !evaluate((Matrix61c *)args))) {
+        int fits = PyObject_TypeCheck(args, &Matrix61cType)
+            && ((Matrix61c *)args)->mat->cols == self->mat->cols;
+        rv = binary_operation(mul_matrix, self, args, fits ? (PyObject *)self : NULL, 1,
+                              "Multiplication Error");
+    }
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
+}
+
+static PyObject *Matrix61c_inplace_pow(Matrix61c *self, PyObject *pow, PyObject *optional) {
+    STATS_SCOPE(scope);
+    STATS_BEGIN(scope, STATS_PY_IPOW);
+    PyObject *rv = pow_operation(self, pow, (PyObject *)self);
+    STATS_END(scope, stats_entries(self), 0, 0, 0);
+    return rv;
 }
 
 /*
  * Create a PyNumberMethods struct for overloading operators with all the number methods you have
  * define. You might find this link helpful: https://docs.python.org/3.6/c-api/typeobj.html
  */
-static PyNumberMethods Matrix61c_as_number = {
-    .nb_add = (binaryfunc) Matrix61c_add,
-    .nb_subtract = (binaryfunc) Matrix61c_sub,
-    .nb_multiply = (binaryfunc) Matrix61c_multiply,
-    .nb_power = (ternaryfunc) Matrix61c_pow,
-    .nb_negative = (unaryfunc) Matrix61c_neg,
-    .nb_absolute = (unaryfunc) Matrix61c_abs,
+static PyNumberMethods Matrix61c_as_number = {
+    .nb_add = (binaryfunc) Matrix61c_add,
+    .nb_subtract = (binaryfunc) Matrix61c_sub,
+    .nb_multiply = (binaryfunc) Matrix61c_multiply,
+    .nb_power = (ternaryfunc) Matrix61c_pow,
+    .nb_negative = (unaryfunc) Matrix61c_neg,
+    .nb_absolute = (unaryfunc) Matrix61c_abs,
+    .nb_inplace_add = (binaryfunc) Matrix61c_inplace_add,
+    .nb_inplace_subtract = (binaryfunc) Matrix61c_inplace_sub,
+    .nb_inplace_multiply = (binaryfunc) Matrix61c_inplace_multiply,
+    .nb_inplace_power = (ternaryfunc) Matrix61c_inplace_pow,
+};
+
+
+/*
+ * MODULE FUNCTIONS
+ * numc.add(a, b, out=None), numc.sub, numc.mul, numc.neg(a, out=None), numc.abs and
+ * numc.pow(a, n, out=None) compute the same results as the operators, but write them into the
+ * numc.Matrix `out` if one is given instead of allocating a new matrix. `out` may be one of
+ * the operands or a view. The result is returned.
+ */
+static PyObject *numc_binary(PyObject *args, PyObject *kwds, int (*kernel)(matrix *, matrix *, matrix *),
+                             int product, const char *error) {
+    static char *kwlist[] = {"a", "b", "out", NULL};
+    PyObject *a, *b, *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", kwlist, &a, &b, &out))
+        return NULL;
+    if (!PyObject_TypeCheck(a, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+        return NULL;
+    }
+    return binary_operation(kernel, (Matrix61c *)a, b, out, product, error);
+}
+
+static PyObject *numc_unary(PyObject *args, PyObject *kwds, int (*kernel)(matrix *, matrix *),
+                            const char *error) {
+    static char *kwlist[] = {"a", "out", NULL};
+    PyObject *a, *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &a, &out))
+        return NULL;
+    if (!PyObject_TypeCheck(a, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+        return NULL;
+    }
+    return unary_operation(kernel, (Matrix61c *)a, out, error);
+}
+
+static PyObject *numc_add(PyObject *self, PyObject *args, PyObject *kwds) {
+    return numc_binary(args, kwds, add_matrix, 0, "Add Error");
+}
+
+static PyObject *numc_sub(PyObject *self, PyObject *args, PyObject *kwds) {
+    return numc_binary(args, kwds, sub_matrix, 0, "Subtraction Error");
+}
+
+static PyObject *numc_mul(PyObject *self, PyObject *args, PyObject *kwds) {
+    return numc_binary(args, kwds, mul_matrix, 1, "Multiplication Error");
+}
+
+static PyObject *numc_neg(PyObject *self, PyObject *args, PyObject *kwds) {
+    return numc_unary(args, kwds, neg_matrix, "Error when negating matrices");
+}
+
+static PyObject *numc_abs(PyObject *self, PyObject *args, PyObject *kwds) {
+    return numc_unary(args, kwds, abs_matrix, "Error when abs matrices");
+}
+
+static PyObject *numc_pow(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"a", "n", "out", NULL};
+    PyObject *a, *n, *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", kwlist, &a, &n, &out))
+        return NULL;
+    if (!PyObject_TypeCheck(a, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+        return NULL;
+    }
+    return pow_operation((Matrix61c *)a, n, out);
+}
+
+/*
+ * numc.gemm(a, b, c=None, alpha=1.0, beta=0.0, trans_a=False, trans_b=False). Computes
+ * alpha * op(a) * op(b) + beta * c into `c` and returns it, where op(x) is x, or its transpose if
+ * the trans_ flag is set. Transposes are never materialized, and the scaling and accumulation
+ * happen while the product is written, so this takes a single pass over `c`. Without `c`, a new
+ * matrix is returned and `beta` is ignored.
+ */
+static PyObject *numc_gemm(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"a", "b", "c", "alpha", "beta", "trans_a", "trans_b", NULL};
+    PyObject *a, *b, *c = NULL;
+    double alpha = 1, beta = 0;
+    int trans_a = 0, trans_b = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|Oddpp", kwlist, &a, &b, &c, &alpha, &beta,
+                                     &trans_a, &trans_b))
+        return NULL;
+    if (!PyObject_TypeCheck(a, &Matrix61cType) || !PyObject_TypeCheck(b, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+        return NULL;
+    }
+    if (evaluate((Matrix61c *)a) || evaluate((Matrix61c *)b))
+        return NULL;
+    matrix *mat1 = ((Matrix61c *)a)->mat, *mat2 = ((Matrix61c *)b)->mat;
+    Py_ssize_t rows = trans_a ? mat1->cols : mat1->rows, inner = trans_a ? mat1->rows : mat1->cols;
+    Py_ssize_t cols = trans_b ? mat2->rows : mat2->cols;
+    if (inner != (trans_b ? mat2->cols : mat2->rows)) {
+        PyErr_SetString(PyExc_TypeError, "Multiplication Error");
+        return NULL;
+    }
+    if (c == NULL || c == Py_None)
+        beta = 0;
+    Matrix61c *rv = result_matrix(c, rows, cols);
+    if (rv == NULL)
+        return NULL;
+    PyThreadState *state = release_gil((double)rows * cols * inner);
+    int failed = gemm_matrix(rv->mat, alpha, trans_a, mat1, trans_b, mat2, beta);
+    restore_gil(state);
+    if (failed) {
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_RuntimeError, "Multiplication Error");
+        return NULL;
+    }
+    return (PyObject *)rv;
+}
+
+/* ASYNCHRONOUS EXECUTION */
+
+/*
+ * numc.submit(op, *args) queues an operation on the executor of executor.h and returns a
+ * numc.Future right away. `op` is "add", "sub", "mul", "neg", "abs" or "pow", or the numc
+ * function of that name, and `args` are the arguments of that function without `out`. Operands
+ * may be futures themselves: the task then starts once the tasks computing them have finished,
+ * while tasks that do not depend on each other run at the same time. Shapes are checked and
+ * the result is allocated on submission, so submit raises the errors of the operators itself.
+ * Writes to a matrix first wait for the submitted tasks reading it, as they evaluate the lazy
+ * results reading it. A future that is dropped waits for its task.
+ */
+
+/* An operation numc.submit runs */
+typedef struct async_op {
+    const char *name;
+    PyCFunction function; // the numc function of that name
+    int (*binary)(matrix *, matrix *, matrix *); // NULL unless the operation takes two matrices
+    int (*unary)(matrix *, matrix *); // NULL unless it takes one; pow has neither
+    int product; // shape rules of the multiplication instead of the element-wise ones
+    const char *error;
+} async_op;
+
+static const async_op async_ops[] = {
+    {"add", (PyCFunction)numc_add, add_matrix, NULL, 0, "Add Error"},
+    {"sub", (PyCFunction)numc_sub, sub_matrix, NULL, 0, "Subtraction Error"},
+    {"mul", (PyCFunction)numc_mul, mul_matrix, NULL, 1, "Multiplication Error"},
+    {"neg", (PyCFunction)numc_neg, NULL, neg_matrix, 0, "Error when negating matrices"},
+    {"abs", (PyCFunction)numc_abs, NULL, abs_matrix, 0, "Error when abs matrices"},
+    {"pow", (PyCFunction)numc_pow, NULL, NULL, 0, "Matrix Exponential Failture"},
+};
+
+typedef struct Future {
+    PyObject_HEAD
+    task *task; // NULL until submitted
+    const async_op *op;
+    matrix *args[2]; // the operands the task reads, NULL past the arity of `op`
+    matrix *out; // the data of `result`, which the task writes
+    int exp; // pow: the exponent
+    Matrix61c *result; // handed out once the task has finished
+    PyObject *operands; // the numc.Matrix objects behind `args`, kept alive for the task
+    struct Future *prev_future, *next_future; // links of the list of submitted futures
+} Future;
+
+static PyTypeObject FutureType;
+
+/* All submitted futures, so that writes can find the tasks reading what they overwrite */
+static Future *future_head = NULL;
+
+static void unlink_future(Future *self) {
+    if (self->prev_future)
+        self->prev_future->next_future = self->next_future;
+    else if (future_head == self)
+        future_head = self->next_future;
+    if (self->next_future)
+        self->next_future->prev_future = self->prev_future;
+    self->prev_future = self->next_future = NULL;
+}
+
+/* Runs the operation of a numc.Future on an executor thread */
+static int run_future(void *arg) {
+    Future *f = (Future *)arg;
+    if (f->op->binary)
+        return f->op->binary(f->out, f->args[0], f->args[1]);
+    if (f->op->unary)
+        return f->op->unary(f->out, f->args[0]);
+    return pow_matrix(f->out, f->args[0], f->exp);
+}
+
+/*
+ * Waits with the GIL released until the task of `self` has finished, for at most `timeout`
+ * seconds unless it is negative. Returns nonzero if it has.
+ */
+static int wait_future(Future *self, double timeout) {
+    if (self->task == NULL || executor_done(self->task))
+        return 1;
+    PyThreadState *state = PyEval_SaveThread();
+    int done = executor_wait(self->task, timeout);
+    PyEval_RestoreThread(state);
+    return done;
+}
+
+/*
+ * Waits for every submitted task that reads data shared with `mat`. Called before anything is
+ * written to `mat`.
+ */
+static void wait_futures(matrix *mat) {
+    Future *f = future_head;
+    while (f != NULL) {
+        int reads = overlaps(f->args[0], mat) || (f->args[1] && overlaps(f->args[1], mat));
+        if (!reads || executor_done(f->task)) {
+            f = f->next_future;
+            continue;
+        }
+        Py_INCREF(f);
+        wait_future(f, -1);
+        Py_DECREF(f);
+        f = future_head; // the list may have changed while the GIL was released
+    }
+}
+
+static void Future_dealloc(Future *self) {
+    wait_future(self, -1); // the task works on the operands and the result
+    unlink_future(self);
+    if (self->task)
+        executor_release(self->task);
+    Py_XDECREF(self->result);
+    Py_XDECREF(self->operands);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * f.result(timeout=None). Waits for the task of `self` and returns its result, a numc.Matrix.
+ * Raises TimeoutError if it has not finished after `timeout` seconds, and RuntimeError if it
+ * or one of the tasks it depends on failed.
+ */
+static PyObject *Future_result(Future *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout))
+        return NULL;
+    double secs = -1;
+    if (timeout != Py_None) {
+        secs = PyFloat_AsDouble(timeout);
+        if (secs == -1 && PyErr_Occurred())
+            return NULL;
+        if (secs < 0)
+            secs = 0;
+    }
+    if (!wait_future(self, secs)) {
+        PyErr_SetString(PyExc_TimeoutError, "The operation has not finished");
+        return NULL;
+    }
+    int status = executor_status(self->task);
+    if (status) {
+        PyErr_SetString(PyExc_RuntimeError, status == TASK_DEPENDENCY_FAILED
+                        ? "An operand of this operation failed" : self->op->error);
+        return NULL;
+    }
+    Py_INCREF(self->result);
+    return (PyObject *)self->result;
+}
+
+/* f.done(). Returns True if the task of `self` has finished, without waiting */
+static PyObject *Future_done(Future *self, PyObject *args) {
+    return PyBool_FromLong(executor_done(self->task));
+}
+
+/*
+ * await f. Waits for the result on a thread of the default executor of the running asyncio
+ * loop, so that the loop runs other coroutines meanwhile.
+ */
+static PyObject *Future_await(Future *self) {
+    PyObject *asyncio = PyImport_ImportModule("asyncio");
+    if (asyncio == NULL)
+        return NULL;
+    PyObject *loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+    Py_DECREF(asyncio);
+    if (loop == NULL)
+        return NULL;
+    PyObject *result = PyObject_GetAttrString((PyObject *)self, "result");
+    PyObject *waiter = NULL;
+    if (result != NULL)
+        waiter = PyObject_CallMethod(loop, "run_in_executor", "OO", Py_None, result);
+    Py_DECREF(loop);
+    Py_XDECREF(result);
+    if (waiter == NULL)
+        return NULL;
+    PyObject *it = PyObject_CallMethod(waiter, "__await__", NULL);
+    Py_DECREF(waiter);
+    return it;
+}
+
+static PyMethodDef Future_methods[] = {
+    {"result", (PyCFunction)Future_result, METH_VARARGS | METH_KEYWORDS,
+     "result(timeout=None): waits for the operation and returns its numc.Matrix"},
+    {"done", (PyCFunction)Future_done, METH_NOARGS, "Returns True if the operation has finished"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyAsyncMethods Future_as_async = {
+    .am_await = (unaryfunc)Future_await,
+};
+
+static PyTypeObject FutureType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "numc.Future",
+    .tp_basicsize = sizeof(Future),
+    .tp_dealloc = (destructor)Future_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "The pending result of an operation queued by numc.submit",
+    .tp_methods = Future_methods,
+    .tp_as_async = &Future_as_async,
 };
 
+/* Returns the operation named by `op`, a name or a numc function, or NULL with an exception */
+static const async_op *find_async_op(PyObject *op) {
+    for (size_t i = 0; i < sizeof(async_ops) / sizeof(async_ops[0]); i++) {
+        if (PyUnicode_Check(op) ? PyUnicode_CompareWithASCIIString(op, async_ops[i].name) == 0
+                : PyCFunction_Check(op) && PyCFunction_GET_FUNCTION(op) == async_ops[i].function)
+            return &async_ops[i];
+    }
+    if (PyUnicode_Check(op) || PyCallable_Check(op))
+        PyErr_SetString(PyExc_ValueError, "Unknown operation");
+    else
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+    return NULL;
+}
+
+/* numc.submit(op, *args). Queues `op` on `args` and returns a numc.Future of its result */
+static PyObject *numc_submit(PyObject *self, PyObject *args) {
+    Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+    if (nargs < 1) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    const async_op *op = find_async_op(PyTuple_GET_ITEM(args, 0));
+    if (op == NULL)
+        return NULL;
+    int arity = op->binary ? 2 : 1, is_pow = !op->binary && !op->unary;
+    if (nargs != 1 + arity + is_pow) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    Future *f = PyObject_New(Future, &FutureType);
+    if (f == NULL)
+        return NULL;
+    f->task = NULL;
+    f->op = op;
+    f->args[0] = f->args[1] = f->out = NULL;
+    f->exp = 0;
+    f->result = NULL;
+    f->prev_future = f->next_future = NULL;
+    f->operands = PyTuple_New(arity);
+    if (f->operands == NULL)
+        goto fail;
+    task *deps[EXECUTOR_MAX_DEPS];
+    int ndeps = 0;
+    for (int i = 0; i < arity; i++) {
+        PyObject *arg = PyTuple_GET_ITEM(args, 1 + i);
+        Matrix61c *mat;
+        if (PyObject_TypeCheck(arg, &FutureType)) {
+            mat = ((Future *)arg)->result;
+            deps[ndeps++] = ((Future *)arg)->task;
+        } else if (PyObject_TypeCheck(arg, &Matrix61cType)) {
+            mat = (Matrix61c *)arg;
+            if (evaluate(mat))
+                goto fail;
+        } else {
+            PyErr_SetString(PyExc_TypeError, "Argument must of type numc.Matrix!");
+            goto fail;
+        }
+        Py_INCREF(mat);
+        PyTuple_SET_ITEM(f->operands, i, (PyObject *)mat);
+        f->args[i] = mat->mat;
+    }
+    matrix *a = f->args[0], *b = f->args[1];
+    Py_ssize_t rows = a->rows, cols = a->cols;
+    if (op->binary) {
+        if (op->product ? a->cols != b->rows : a->rows != b->rows || a->cols != b->cols) {
+            PyErr_SetString(PyExc_TypeError, op->error);
+            goto fail;
+        }
+        cols = b->cols;
+    } else if (is_pow) {
+        PyObject *pow = PyTuple_GET_ITEM(args, 2);
+        if (!PyObject_TypeCheck(pow, &PyLong_Type)) {
+            PyErr_SetString(PyExc_TypeError, "Exp must be an integer");
+            goto fail;
+        }
+        long exp = PyLong_AsLong(pow);
+        if (exp < 0 || exp > INT_MAX || rows != cols) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, op->error);
+            goto fail;
+        }
+        f->exp = (int)exp;
+    }
+    f->result = result_matrix(NULL, rows, cols);
+    if (f->result == NULL)
+        goto fail;
+    f->out = f->result->mat;
+    f->task = executor_submit(run_future, f, deps, ndeps);
+    if (f->task == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Cannot start the executor");
+        goto fail;
+    }
+    f->next_future = future_head;
+    if (future_head)
+        future_head->prev_future = f;
+    future_head = f;
+    return (PyObject *)f;
+fail:
+    Py_DECREF(f);
+    return NULL;
+}
+
+/*
+ * numc.set_executor(threads=None). Sets how many threads run submitted operations, if given.
+ * Lowering it first finishes the operations already submitted. Returns the number of threads
+ * and of operations still pending.
+ */
+static PyObject *numc_set_executor(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"threads", NULL};
+    PyObject *threads = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &threads))
+        return NULL;
+    if (threads != Py_None) {
+        long count = PyLong_Check(threads) ? PyLong_AsLong(threads) : -1;
+        if (PyErr_Occurred())
+            return NULL;
+        if (count < 1 || count > EXECUTOR_MAX_THREADS) {
+            PyErr_Format(PyExc_ValueError, "threads must be between 1 and %d", EXECUTOR_MAX_THREADS);
+            return NULL;
+        }
+        executor_set_threads((int)count);
+    }
+    return Py_BuildValue("{s:i,s:i}", "threads", executor_threads(), "pending", executor_pending());
+}
+
 
 /* INSTANCE METHODS */
 /*
- * Given a numc.Matrix self, parse `args` to (int) row, (int) col, and (double) val.
+ * Given a numc.Matrix self, parse `args` to (Py_ssize_t) row, (Py_ssize_t) col, and (double) val.
  * This function should return None in Python.
  */
 static PyObject *Matrix61c_set_value(Matrix61c *self, PyObject* args) {
-    int row, col; double val;
-    if (PyArg_ParseTuple(args, "iid", &row, &col, &val)) {
+    Py_ssize_t row, col; double val;
+    if (evaluate(self) || flush_pending(self->mat))
+        return NULL;
+    if (PyArg_ParseTuple(args, "nnd", &row, &col, &val)) {
         if (row < self->mat->rows && col < self->mat->cols) {
             set(self->mat, row, col, val);
             return Py_None;
@@ -494,13 +2186,15 @@ static PyObject *Matrix61c_set_value(Matrix61c *self, PyObject* args) {
 }
 
 /*
- * Given a numc.Matrix `self`, parse `args` to (int) row and (int) col.
+ * Given a numc.Matrix `self`, parse `args` to (Py_ssize_t) row and (Py_ssize_t) col.
  * This function should return the value at the `row`th row and `col`th column, which is a Python
  * float.
  */
 static PyObject *Matrix61c_get_value(Matrix61c *self, PyObject* args) {
-    int row, col;
-    if (PyArg_ParseTuple(args, "ii", &row, &col)) {
+    Py_ssize_t row, col;
+    if (evaluate(self))
+        return NULL;
+    if (PyArg_ParseTuple(args, "nn", &row, &col)) {
         if (row < self->mat->rows && col < self->mat->cols) {
             double val = get(self->mat, row, col);
             return PyFloat_FromDouble(val);
@@ -513,6 +2207,442 @@ static PyObject *Matrix61c_get_value(Matrix61c *self, PyObject* args) {
     }
 }
 
+/* BUFFER PROTOCOL */
+
+/*
+ * Exports the matrix data as a 2-D buffer of doubles, e.g. for memoryview or numpy.asarray.
+ * Views are exported with their strides, so consumers that cannot handle strides only get
+ * contiguous matrices. The exporter reference in `view` keeps the matrix alive, and its data
+ * never moves, so nothing has to be done when the buffer is released. Since the consumer may
+ * write to the buffer, pending lazy results reading the matrix are evaluated first.
+ */
+static int Matrix61c_getbuffer(Matrix61c *self, Py_buffer *view, int flags) {
+    if (evaluate(self) || flush_pending(self->mat)) {
+        view->obj = NULL;
+        return -1;
+    }
+    matrix *mat = self->mat;
+    int c_contiguous = is_contiguous(mat);
+    int f_contiguous = (mat->cols == 1 || mat->col_stride == mat->rows)
+        && (mat->row_stride == 1 || mat->rows == 1);
+    if (((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS && !c_contiguous)
+            || ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS && !f_contiguous)
+            || ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS && !c_contiguous && !f_contiguous)
+            || ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && !c_contiguous)) {
+        PyErr_SetString(PyExc_BufferError, "numc.Matrix is not contiguous");
+        view->obj = NULL;
+        return -1;
+    }
+    self->buffer_shape[0] = mat->rows;
+    self->buffer_shape[1] = mat->cols;
+    self->buffer_strides[0] = mat->row_stride * (Py_ssize_t)sizeof(double);
+    self->buffer_strides[1] = mat->col_stride * (Py_ssize_t)sizeof(double);
+    view->buf = mat->data;
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->len = (Py_ssize_t)mat->rows * mat->cols * sizeof(double);
+    view->readonly = 0;
+    view->itemsize = sizeof(double);
+    view->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->buffer_shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->buffer_strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyBufferProcs Matrix61c_as_buffer = {
+    .bf_getbuffer = (getbufferproc) Matrix61c_getbuffer,
+};
+
+/* Gives an imported buffer back to its exporter once the matrix wrapping it is gone */
+static void release_imported_buffer(void *owner) {
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyBuffer_Release((Py_buffer *)owner);
+    PyMem_RawFree(owner);
+    PyGILState_Release(gil);
+}
+
+/*
+ * Matrix.frombuffer(obj, rows, cols). Wraps the writable, C-contiguous float64 buffer of `obj`
+ * (a numpy array, array.array('d'), ...) in a numc.Matrix without copying. The matrix
+ * holds on to the buffer, and through it to `obj`, until it and all its slices are gone.
+ */
+static PyObject *Matrix61c_frombuffer(PyTypeObject *type, PyObject *args) {
+    PyObject *obj;
+    Py_ssize_t rows, cols;
+    if (!PyArg_ParseTuple(args, "Onn", &obj, &rows, &cols)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    Py_buffer *view = PyMem_RawMalloc(sizeof(Py_buffer));
+    if (view == NULL)
+        return PyErr_NoMemory();
+    if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0) {
+        PyMem_RawFree(view);
+        return NULL;
+    }
+    const char *format = view->format ? view->format : "B";
+    if (format[0] == '@' || format[0] == '=' || format[0] == '<')
+        format++;
+    if (strcmp(format, "d") != 0) {
+        PyErr_SetString(PyExc_TypeError, "Buffer must hold float64 values");
+        goto fail;
+    }
+    if (rows < 1 || cols < 1 || cols > view->len / (Py_ssize_t)sizeof(double) / rows
+            || rows * cols * (Py_ssize_t)sizeof(double) != view->len) {
+        PyErr_SetString(PyExc_ValueError, "Buffer size does not match the dimensions");
+        goto fail;
+    }
+    if ((uintptr_t)view->buf % sizeof(double)) {
+        PyErr_SetString(PyExc_ValueError, "Buffer is not aligned to 8 bytes");
+        goto fail;
+    }
+    matrix *new_mat;
+    if (allocate_matrix_external(&new_mat, view->buf, rows, cols, release_imported_buffer, view)) {
+        PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+        goto fail;
+    }
+    return Matrix61c_from_matrix(new_mat);
+fail:
+    PyBuffer_Release(view);
+    PyMem_RawFree(view);
+    return NULL;
+}
+
+/* FILES */
+
+/* Raises the exception for a matrix_save or matrix_load of `path` that failed with `status` */
+static void set_storage_error(storage_status status, const char *path) {
+    switch (status) {
+    case STORAGE_IO:
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        break;
+    case STORAGE_FORMAT:
+        PyErr_Format(PyExc_ValueError, "%s is not a numc matrix file this version can read", path);
+        break;
+    case STORAGE_CHECKSUM:
+        PyErr_Format(PyExc_ValueError, "%s is corrupted: checksum mismatch", path);
+        break;
+    default:
+        PyErr_NoMemory();
+    }
+}
+
+/*
+ * numc.save(path, m). Writes `m` to `path` in the format of storage.h: a versioned header
+ * followed by the raw entries, 64-byte aligned. Slices are written as contiguous matrices.
+ */
+static PyObject *numc_save(PyObject *self, PyObject *args) {
+    PyObject *path;
+    Matrix61c *m;
+    if (!PyArg_ParseTuple(args, "O&O!", PyUnicode_FSConverter, &path, &Matrix61cType, &m)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    if (evaluate(m)) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    const char *name = PyBytes_AS_STRING(path);
+    PyThreadState *state = release_gil((double)m->mat->rows * m->mat->cols);
+    storage_status status = matrix_save(name, m->mat);
+    restore_gil(state);
+    if (status != STORAGE_OK)
+        set_storage_error(status, name);
+    Py_DECREF(path);
+    if (status != STORAGE_OK)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/*
+ * numc.load(path, mmap=True, verify=None). Reads a matrix written by numc.save. With mmap the
+ * matrix is backed by a private mapping of the file, so loading is instant whatever the size
+ * and pages are only read once touched; writes to it stay in memory. The mapping is unmapped
+ * once the matrix and all its slices are gone. verify checks the data against its checksum,
+ * which reads the whole file; by default it is done only when the file is read without mmap,
+ * where it costs next to nothing. The header is always checked.
+ */
+static PyObject *numc_load(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"path", "mmap", "verify", NULL};
+    PyObject *path;
+    int use_mmap = 1;
+    PyObject *verify_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|pO", kwlist, PyUnicode_FSConverter, &path,
+                                     &use_mmap, &verify_obj)) {
+        return NULL;
+    }
+    int verify = verify_obj == Py_None ? !use_mmap : PyObject_IsTrue(verify_obj);
+    if (verify < 0) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    const char *name = PyBytes_AS_STRING(path);
+    matrix *mat = NULL;
+    PyThreadState *state = PyEval_SaveThread();
+    storage_status status = matrix_load(&mat, name, use_mmap, verify);
+    PyEval_RestoreThread(state);
+    if (status != STORAGE_OK)
+        set_storage_error(status, name);
+    Py_DECREF(path);
+    if (status != STORAGE_OK)
+        return NULL;
+    return Matrix61c_from_matrix(mat);
+}
+
+/* OUT-OF-CORE MATRICES */
+
+/* numc.TiledMatrix: a matrix kept in a tiled file by ooc.c rather than in memory */
+typedef struct TiledMatrix {
+    PyObject_HEAD
+    ooc_matrix *mat; // NULL once closed
+} TiledMatrix;
+
+static PyTypeObject TiledMatrixType;
+
+/* Returns the out-of-core matrix of `self`, or NULL with an exception if it was closed */
+static ooc_matrix *tiled_matrix(TiledMatrix *self) {
+    if (self->mat == NULL)
+        PyErr_SetString(PyExc_ValueError, "TiledMatrix is closed");
+    return self->mat;
+}
+
+/* Closes the file of `self`, writing back its changed tiles. Returns -1 with an exception on failure. */
+static int tiled_close(TiledMatrix *self) {
+    if (self->mat == NULL)
+        return 0;
+    ooc_matrix *mat = self->mat;
+    self->mat = NULL;
+    PyThreadState *state = PyEval_SaveThread();
+    int failed = ooc_close(mat);
+    PyEval_RestoreThread(state);
+    if (failed) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+
+static void TiledMatrix_dealloc(TiledMatrix *self) {
+    if (tiled_close(self))
+        PyErr_WriteUnraisable((PyObject *)self);
+    Py_TYPE(self)->tp_free(self);
+}
+
+/*
+ * numc.TiledMatrix(path, rows, cols, tile=256) creates a rows x cols matrix of zeros in a new
+ * file at `path`, cut into tile x tile tiles; numc.TiledMatrix(path) opens one created before.
+ * Only the tiles in use are in memory, in the tile cache of ooc.c, so rows * cols may be far
+ * larger than memory.
+ */
+static int TiledMatrix_init(TiledMatrix *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"path", "rows", "cols", "tile", NULL};
+    PyObject *path;
+    long long rows = -1, cols = -1;
+    int tile = 256;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|LLi", kwlist, PyUnicode_FSConverter, &path,
+                                     &rows, &cols, &tile)) {
+        return -1;
+    }
+    const char *name = PyBytes_AS_STRING(path);
+    storage_status status;
+    if (tiled_close(self)) {
+        Py_DECREF(path);
+        return -1;
+    }
+    if (rows == -1 && cols == -1) {
+        status = ooc_open(&self->mat, name);
+    } else if (rows < 1 || cols < 1 || tile < 1 || tile > OOC_MAX_TILE) {
+        PyErr_SetString(PyExc_TypeError, "Invalid Dimension");
+        Py_DECREF(path);
+        return -1;
+    } else {
+        status = ooc_create(&self->mat, name, rows, cols, tile);
+    }
+    if (status != STORAGE_OK) {
+        self->mat = NULL;
+        set_storage_error(status, name);
+    }
+    Py_DECREF(path);
+    return status == STORAGE_OK ? 0 : -1;
+}
+
+/* t.read(row, col, rows, cols). Returns the rows x cols block starting at (row, col) as a numc.Matrix */
+static PyObject *TiledMatrix_read(TiledMatrix *self, PyObject *args) {
+    long long row, col;
+    Py_ssize_t rows, cols;
+    if (!PyArg_ParseTuple(args, "LLnn", &row, &col, &rows, &cols)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    ooc_matrix *mat = tiled_matrix(self);
+    if (mat == NULL)
+        return NULL;
+    matrix *block;
+    if (allocate_matrix_uninit(&block, rows, cols)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Matrix Allocation Failure");
+        return NULL;
+    }
+    PyThreadState *state = PyEval_SaveThread();
+    int status = ooc_read_block(block, mat, row, col);
+    PyEval_RestoreThread(state);
+    if (status) {
+        if (status > 0)
+            PyErr_SetString(PyExc_IndexError, "Index out of range");
+        else
+            PyErr_SetFromErrno(PyExc_OSError);
+        deallocate_matrix(block);
+        return NULL;
+    }
+    return Matrix61c_from_matrix(block);
+}
+
+/* t.write(row, col, m). Writes the numc.Matrix m to the entries starting at (row, col) */
+static PyObject *TiledMatrix_write(TiledMatrix *self, PyObject *args) {
+    long long row, col;
+    Matrix61c *m;
+    if (!PyArg_ParseTuple(args, "LLO!", &row, &col, &Matrix61cType, &m)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    ooc_matrix *mat = tiled_matrix(self);
+    if (mat == NULL || evaluate(m))
+        return NULL;
+    PyThreadState *state = PyEval_SaveThread();
+    int status = ooc_write_block(mat, row, col, m->mat);
+    PyEval_RestoreThread(state);
+    if (status) {
+        if (status > 0)
+            PyErr_SetString(PyExc_IndexError, "Index out of range");
+        else
+            PyErr_SetFromErrno(PyExc_OSError);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/* t.flush(). Writes the changed tiles of t that are still in the cache to its file */
+static PyObject *TiledMatrix_flush(TiledMatrix *self, PyObject *args) {
+    ooc_matrix *mat = tiled_matrix(self);
+    if (mat == NULL)
+        return NULL;
+    PyThreadState *state = PyEval_SaveThread();
+    int failed = ooc_flush(mat);
+    PyEval_RestoreThread(state);
+    if (failed)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+}
+
+/* t.close(). Flushes t and closes its file; also done when t is garbage collected */
+static PyObject *TiledMatrix_close(TiledMatrix *self, PyObject *args) {
+    if (tiled_close(self))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *TiledMatrix_get_shape(TiledMatrix *self, void *closure) {
+    ooc_matrix *mat = tiled_matrix(self);
+    if (mat == NULL)
+        return NULL;
+    return Py_BuildValue("(LL)", (long long)mat->rows, (long long)mat->cols);
+}
+
+static PyObject *TiledMatrix_get_tile(TiledMatrix *self, void *closure) {
+    ooc_matrix *mat = tiled_matrix(self);
+    if (mat == NULL)
+        return NULL;
+    return PyLong_FromLong(mat->tile);
+}
+
+static PyMethodDef TiledMatrix_methods[] = {
+    {"read", (PyCFunction)TiledMatrix_read, METH_VARARGS,
+     "read(row, col, rows, cols): the block starting at (row, col) as a numc.Matrix"},
+    {"write", (PyCFunction)TiledMatrix_write, METH_VARARGS,
+     "write(row, col, m): writes the numc.Matrix m starting at (row, col)"},
+    {"flush", (PyCFunction)TiledMatrix_flush, METH_NOARGS, "Writes the changed tiles in the cache to the file"},
+    {"close", (PyCFunction)TiledMatrix_close, METH_NOARGS, "Flushes and closes the file"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef TiledMatrix_getset[] = {
+    {"shape", (getter)TiledMatrix_get_shape, NULL, "(rows, cols)", NULL},
+    {"tile", (getter)TiledMatrix_get_tile, NULL, "side of the square tiles", NULL},
+    {NULL}
+};
+
+static PyTypeObject TiledMatrixType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "numc.TiledMatrix",
+    .tp_basicsize = sizeof(TiledMatrix),
+    .tp_dealloc = (destructor)TiledMatrix_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A matrix stored in a tiled file and paged in through a bounded tile cache",
+    .tp_methods = TiledMatrix_methods,
+    .tp_getset = TiledMatrix_getset,
+    .tp_init = (initproc)TiledMatrix_init,
+    .tp_new = PyType_GenericNew,
+};
+
+/* Runs ooc_add or ooc_mul on the numc.TiledMatrix arguments a, b, out without the GIL */
+static PyObject *tiled_binary(PyObject *args, int (*op)(ooc_matrix *, ooc_matrix *, ooc_matrix *)) {
+    TiledMatrix *a, *b, *out;
+    if (!PyArg_ParseTuple(args, "O!O!O!", &TiledMatrixType, &a, &TiledMatrixType, &b,
+                          &TiledMatrixType, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Invalid arguments");
+        return NULL;
+    }
+    if (tiled_matrix(a) == NULL || tiled_matrix(b) == NULL || tiled_matrix(out) == NULL)
+        return NULL;
+    PyThreadState *state = PyEval_SaveThread();
+    int status = op(out->mat, a->mat, b->mat);
+    PyEval_RestoreThread(state);
+    if (status > 0) {
+        PyErr_SetString(PyExc_ValueError, "Shapes or tile sizes do not match");
+        return NULL;
+    }
+    if (status < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+}
+
+/* numc.tiled_add(a, b, out). out = a + b on numc.TiledMatrix objects, tile by tile; out may be a or b */
+static PyObject *numc_tiled_add(PyObject *self, PyObject *args) {
+    return tiled_binary(args, ooc_add);
+}
+
+/* numc.tiled_mul(a, b, out). out = a * b on numc.TiledMatrix objects of the same tile size */
+static PyObject *numc_tiled_mul(PyObject *self, PyObject *args) {
+    return tiled_binary(args, ooc_mul);
+}
+
+/*
+ * numc.set_tile_cache(budget=None). Sets how many bytes of tiles the cache of numc.TiledMatrix
+ * may hold (NUMC_OOC_BYTES at startup, 256 MiB by default) and returns it with the counters of
+ * the cache as a dict.
+ */
+static PyObject *numc_set_tile_cache(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"budget", NULL};
+    Py_ssize_t budget = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &budget))
+        return NULL;
+    if (budget >= 0)
+        ooc_set_budget(budget);
+    ooc_stats stats;
+    ooc_get_stats(&stats);
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:n}",
+                         "budget", (Py_ssize_t)stats.budget,
+                         "bytes", (Py_ssize_t)stats.bytes,
+                         "hits", (Py_ssize_t)stats.hits,
+                         "misses", (Py_ssize_t)stats.misses,
+                         "prefetched", (Py_ssize_t)stats.prefetched,
+                         "reads", (Py_ssize_t)stats.reads,
+                         "writes", (Py_ssize_t)stats.writes);
+}
+
 /*
  * Create an array of PyMethodDef structs to hold the instance methods.
  * Name the python function corresponding to Matrix61c_get_value as "get" and Matrix61c_set_value
@@ -522,6 +2652,9 @@ static PyObject *Matrix61c_get_value(Matrix61c *self, PyObject* args) {
 static PyMethodDef Matrix61c_methods[] = {
     {"get", (PyCFunction) Matrix61c_get_value, METH_VARARGS, NULL},
     {"set", (PyCFunction) Matrix61c_set_value, METH_VARARGS, NULL},
+    {"rows", (PyCFunction) Matrix61c_rows, METH_NOARGS, "Returns an iterator over the rows as lists"},
+    {"frombuffer", (PyCFunction) Matrix61c_frombuffer, METH_VARARGS | METH_CLASS,
+     "Wraps a float64 buffer of rows * cols values in a numc.Matrix without copying"},
     {NULL, NULL, 0, NULL}
 };
 
@@ -545,6 +2678,7 @@ static PyTypeObject Matrix61cType = {
     .tp_methods = Matrix61c_methods,
     .tp_members = Matrix61c_members,
     .tp_as_mapping = &Matrix61c_mapping,
+    .tp_as_buffer = &Matrix61c_as_buffer,
     .tp_init = (initproc)Matrix61c_init,
     .tp_new = Matrix61c_new
 };
@@ -562,15 +2696,31 @@ static struct PyModuleDef numcmodule = {
 PyMODINIT_FUNC PyInit_numc(void) {
     PyObject* m;
 
-    if (PyType_Ready(&Matrix61cType) < 0)
+    if (PyType_Ready(&Matrix61cType) < 0 || PyType_Ready(&RowIteratorType) < 0
+            || PyType_Ready(&TiledMatrixType) < 0 || PyType_Ready(&FutureType) < 0)
         return NULL;
 
+    select_kernels();
+    /* The workers must be gone before the interpreter tears down the process */
+    Py_AtExit(pool_shutdown);
+    Py_AtExit(ooc_shutdown);
+    Py_AtExit(executor_shutdown); // registered last so that it runs first, while the pool is up
+    trace_thread_name("python");
+    const char *lazy = getenv("NUMC_LAZY");
+    lazy_mode = lazy != NULL && atoi(lazy) != 0;
+    const char *counting = getenv("NUMC_STATS");
+    stats_set_enabled(counting != NULL && atoi(counting) != 0);
+
     m = PyModule_Create(&numcmodule);
     if (m == NULL)
         return NULL;
 
     Py_INCREF(&Matrix61cType);
     PyModule_AddObject(m, "Matrix", (PyObject *)&Matrix61cType);
+    Py_INCREF(&TiledMatrixType);
+    PyModule_AddObject(m, "TiledMatrix", (PyObject *)&TiledMatrixType);
+    Py_INCREF(&FutureType);
+    PyModule_AddObject(m, "Future", (PyObject *)&FutureType);
     printf("CS61C Summer 2020 Project 4: numc imported!\n");
     fflush(stdout);
     return m;
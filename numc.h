@@ -1,4 +1,5 @@
 #include "matrix.h"
+#include "expr.h"
 
 /*
  * Defines the struct that represents the object
@@ -6,16 +7,21 @@
  * It also has the matrix that is being wrapped
  * is of type PyObject
  */
-typedef struct {
+typedef struct Matrix61c {
     PyObject_HEAD
-    matrix* mat;
+    matrix* mat; // NULL while `expr` is pending
     PyObject *shape;
+    Py_ssize_t buffer_shape[2]; // shape handed out through the buffer protocol
+    Py_ssize_t buffer_strides[2]; // strides in bytes handed out through the buffer protocol
+    struct expr *expr; // lazy mode: the expression computing the entries, NULL once evaluated
+    struct Matrix61c *prev_pending, *next_pending; // links of the list of pending results
 } Matrix61c;
 
 /* Function definitions */
-static int init_rand(PyObject *self, int rows, int cols, unsigned int seed, double low, double high);
-static int init_fill(PyObject *self, int rows, int cols, double val);
-static int init_1d(PyObject *self, int rows, int cols, PyObject *lst);
+static int init_rand(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, unsigned int seed, int normal,
+                     int libc, double a, double b);
+static int init_fill(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, double val);
+static int init_1d(PyObject *self, Py_ssize_t rows, Py_ssize_t cols, PyObject *lst);
 static int init_2d(PyObject *self, PyObject *lst);
 static void Matrix61c_dealloc(Matrix61c *self);
 static PyObject *Matrix61c_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
@@ -30,4 +36,35 @@ static PyObject *Matrix61c_multiply(Matrix61c* self, PyObject *args);
 static PyObject *Matrix61c_neg(Matrix61c* self);
 static PyObject *Matrix61c_abs(Matrix61c *self);
 static PyObject *Matrix61c_pow(Matrix61c *self, PyObject *pow, PyObject *optional);
+static PyObject *numc_add(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_sub(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_mul(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_neg(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_abs(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_pow(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_gemm(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_set_lazy(PyObject *self, PyObject *args);
+static PyObject *numc_stats(PyObject *self, PyObject *args);
+static PyObject *numc_reset_stats(PyObject *self, PyObject *args);
+static PyObject *numc_set_stats(PyObject *self, PyObject *args);
+static PyObject *numc_trace_start(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_trace_stop(PyObject *self, PyObject *args);
+static PyObject *numc_set_threading(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_set_huge_pages(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_set_numa_policy(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_numa_node_bytes(PyObject *self, PyObject *args);
+static PyObject *numc_set_printoptions(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_save(PyObject *self, PyObject *args);
+static PyObject *numc_load(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_tiled_add(PyObject *self, PyObject *args);
+static PyObject *numc_tiled_mul(PyObject *self, PyObject *args);
+static PyObject *numc_set_tile_cache(PyObject *self, PyObject *args, PyObject *kwds);
+static PyObject *numc_submit(PyObject *self, PyObject *args);
+static PyObject *numc_set_executor(PyObject *self, PyObject *args, PyObject *kwds);
+static PyThreadState *release_gil(double work);
+static void restore_gil(PyThreadState *state);
+static void unlink_pending(Matrix61c *self);
+static int evaluate(Matrix61c *self);
+static int flush_pending(matrix *mat);
+static void wait_futures(matrix *mat);
 
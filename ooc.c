@@ -0,0 +1,700 @@
+#include "ooc.h" // Python.h first, which asks for the POSIX 2008 pread, pwrite and ftruncate
+#include "alloc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Header of an out-of-core file; the tiles start OOC_HEADER_SIZE bytes in */
+typedef struct ooc_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t tile;
+    uint64_t rows;
+    uint64_t cols;
+    char reserved[32];
+} ooc_header;
+
+/*
+ * A buffer of the tile cache. A frame is FREE (holds no tile), READY (holds tile `index` of
+ * `owner`), or BUSY while a thread reads or writes its tile without holding the lock; threads
+ * that want a BUSY tile wait on cache_cond and look again. Pinned frames are never evicted.
+ */
+typedef enum frame_state { FRAME_FREE, FRAME_READY, FRAME_BUSY } frame_state;
+
+typedef struct frame {
+    ooc_matrix *owner;
+    int64_t index; // ti * tile_cols + tj
+    double *data;
+    size_t size; // doubles in `data`
+    frame_state state;
+    int pins;
+    int dirty; // the tile has changes that are not in the file yet
+    uint64_t last_use; // for picking the least recently used frame to evict
+    struct frame *next;
+} frame;
+
+/* Tiles waiting for the prefetch thread; requests that do not fit are dropped */
+#define PREFETCH_QUEUE 64
+
+typedef struct request {
+    ooc_matrix *mat;
+    int64_t index;
+} request;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_cond = PTHREAD_COND_INITIALIZER; // a BUSY frame changed state
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER; // the prefetch thread waits here
+static frame *frames = NULL;
+static uint64_t tick = 0;
+static ooc_stats stats;
+static int initialized = 0;
+static request queue[PREFETCH_QUEUE];
+static int queue_head = 0, queue_len = 0;
+static ooc_matrix *io_current = NULL; // the matrix the prefetch thread is reading a tile of
+static pthread_t io_thread;
+static int io_started = 0;
+static int io_stopping = 0;
+
+static void init_locked(void) {
+    const char *budget = getenv("NUMC_OOC_BYTES");
+    stats.budget = budget != NULL ? strtoull(budget, NULL, 10) : OOC_DEFAULT_BUDGET;
+    initialized = 1;
+}
+
+static size_t tile_doubles(ooc_matrix *mat) {
+    return (size_t)mat -> tile * mat -> tile;
+}
+
+static off_t tile_offset(ooc_matrix *mat, int64_t index) {
+    return OOC_HEADER_SIZE + (off_t)index * tile_doubles(mat) * sizeof(double);
+}
+
+static int transfer(int fd, void *buf, size_t bytes, off_t offset, int writing) {
+    char *p = (char *)buf;
+    while (bytes > 0) {
+        ssize_t n = writing ? pwrite(fd, p, bytes, offset) : pread(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        p += n; bytes -= n; offset += n;
+    }
+    return 0;
+}
+
+static int read_tile(frame *f) {
+    return transfer(f -> owner -> fd, f -> data, f -> size * sizeof(double),
+                    tile_offset(f -> owner, f -> index), 0);
+}
+
+static int write_tile(frame *f) {
+    return transfer(f -> owner -> fd, f -> data, f -> size * sizeof(double),
+                    tile_offset(f -> owner, f -> index), 1);
+}
+
+static frame *find_frame(ooc_matrix *mat, int64_t index) {
+    for (frame *f = frames; f != NULL; f = f -> next) {
+        if (f -> owner == mat && f -> index == index && f -> state != FRAME_FREE) return f;
+    }
+    return NULL;
+}
+
+/* Gives `f` a buffer of `size` doubles. Called with the lock held. */
+static int resize_frame(frame *f, size_t size) {
+    if (f -> size == size) return 0;
+    free_data(f -> data, f -> size);
+    stats.bytes -= f -> size * sizeof(double);
+    f -> data = alloc_data(size, 0);
+    f -> size = f -> data != NULL ? size : 0;
+    stats.bytes += f -> size * sizeof(double);
+    return f -> data != NULL ? 0 : -1;
+}
+
+/*
+ * Returns a BUSY frame with room for `size` doubles and no tile, or NULL. A new frame is
+ * allocated while the budget allows; otherwise the least recently used unpinned frame is
+ * evicted, after writing its tile back if it is dirty. Pins may outnumber what the budget
+ * holds, in which case a new frame is allocated anyway rather than waiting, unless this is for
+ * a prefetch, which never goes over the budget. Called with the lock held, which is released
+ * while a dirty tile is written.
+ */
+static frame *acquire_frame(size_t size, int prefetch) {
+    frame *victim = NULL;
+    for (frame *f = frames; f != NULL; f = f -> next) {
+        if (f -> state == FRAME_FREE) {
+            victim = f;
+            break;
+        }
+        if (f -> state == FRAME_READY && f -> pins == 0
+                && (victim == NULL || f -> last_use < victim -> last_use)) {
+            victim = f;
+        }
+    }
+    int room = stats.bytes + size * sizeof(double) <= stats.budget;
+    if (victim == NULL || (room && victim -> state != FRAME_FREE)) {
+        if (prefetch && !room) return NULL;
+        frame *f = (frame *)calloc(1, sizeof(frame));
+        if (f != NULL) f -> data = alloc_data(size, 0);
+        if (f == NULL || f -> data == NULL) {
+            free(f);
+            errno = ENOMEM;
+            return NULL;
+        }
+        f -> size = size;
+        f -> state = FRAME_BUSY;
+        f -> next = frames;
+        frames = f;
+        stats.bytes += size * sizeof(double);
+        return f;
+    }
+    victim -> state = FRAME_BUSY;
+    if (victim -> dirty) {
+        pthread_mutex_unlock(&cache_lock);
+        int failed = write_tile(victim);
+        pthread_mutex_lock(&cache_lock);
+        if (failed) {
+            victim -> state = FRAME_READY; // keep the changes, the caller fails instead
+            pthread_cond_broadcast(&cache_cond);
+            return NULL;
+        }
+        victim -> dirty = 0;
+        stats.writes++;
+    }
+    victim -> owner = NULL;
+    pthread_cond_broadcast(&cache_cond);
+    if (resize_frame(victim, size) == 0) return victim;
+    victim -> state = FRAME_FREE;
+    errno = ENOMEM;
+    return NULL;
+}
+
+/* Puts a frame acquire_frame returned back as FREE. Called with the lock held. */
+static void discard_frame(frame *f) {
+    f -> owner = NULL;
+    f -> pins = 0;
+    f -> dirty = 0;
+    f -> state = FRAME_FREE;
+    pthread_cond_broadcast(&cache_cond);
+}
+
+/*
+ * Fetches tile `index` of `mat` into a frame and returns it, BUSY, with the lock held, or NULL
+ * on failure. Another thread may have fetched it while the lock was released; that frame is
+ * returned instead and `*found` is set.
+ */
+static frame *load_tile(ooc_matrix *mat, int64_t index, ooc_mode mode, int prefetch, int *found) {
+    frame *f = acquire_frame(tile_doubles(mat), prefetch);
+    if (f == NULL) return NULL;
+    frame *other = find_frame(mat, index);
+    if (other != NULL) {
+        discard_frame(f);
+        *found = 1;
+        return other;
+    }
+    *found = 0;
+    f -> owner = mat;
+    f -> index = index;
+    f -> dirty = 0;
+    if (mode == OOC_OVERWRITE) return f;
+    pthread_mutex_unlock(&cache_lock);
+    int failed = read_tile(f);
+    pthread_mutex_lock(&cache_lock);
+    if (failed) {
+        discard_frame(f);
+        return NULL;
+    }
+    stats.reads++;
+    return f;
+}
+
+/*
+ * Returns the data of tile (ti, tj) of `mat`, tile * tile doubles that stay in memory until
+ * the matching ooc_unpin. With OOC_OVERWRITE a tile that is not cached is not read, so the
+ * data is garbage until the caller writes every entry, padding included.
+ * Returns NULL and sets errno if the tile could not be read.
+ */
+double *ooc_pin(ooc_matrix *mat, int64_t ti, int64_t tj, ooc_mode mode) {
+    int64_t index = ti * mat -> tile_cols + tj;
+    pthread_mutex_lock(&cache_lock);
+    if (!initialized) init_locked();
+    frame *f;
+    while (1) {
+        f = find_frame(mat, index);
+        if (f != NULL && f -> state == FRAME_BUSY) {
+            pthread_cond_wait(&cache_cond, &cache_lock);
+            continue;
+        }
+        if (f != NULL) {
+            stats.hits++;
+            break;
+        }
+        int found;
+        f = load_tile(mat, index, mode, 0, &found);
+        if (f == NULL) {
+            pthread_mutex_unlock(&cache_lock);
+            return NULL;
+        }
+        if (found) continue; // wait for it like any BUSY frame
+        f -> state = FRAME_READY;
+        stats.misses++;
+        pthread_cond_broadcast(&cache_cond);
+        break;
+    }
+    f -> pins++;
+    f -> last_use = ++tick;
+    pthread_mutex_unlock(&cache_lock);
+    return f -> data;
+}
+
+/*
+ * Frees unpinned, clean frames until the cache fits in its budget again, for instance after
+ * concurrent operations pinned more tiles than it holds. Called with the lock held.
+ */
+static void trim_locked(void) {
+    frame **link = &frames;
+    while (*link != NULL && stats.bytes > stats.budget) {
+        frame *f = *link;
+        if (f -> state == FRAME_FREE || (f -> state == FRAME_READY && f -> pins == 0 && !f -> dirty)) {
+            *link = f -> next;
+            stats.bytes -= f -> size * sizeof(double);
+            free_data(f -> data, f -> size);
+            free(f);
+        } else {
+            link = &f -> next;
+        }
+    }
+}
+
+/* Releases a tile pinned by ooc_pin. Set `dirty` if the entries were changed. */
+void ooc_unpin(ooc_matrix *mat, int64_t ti, int64_t tj, int dirty) {
+    pthread_mutex_lock(&cache_lock);
+    frame *f = find_frame(mat, ti * mat -> tile_cols + tj);
+    if (f != NULL) {
+        f -> pins--;
+        f -> dirty |= dirty;
+        f -> last_use = ++tick;
+    }
+    if (stats.bytes > stats.budget) trim_locked();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * Releases a pinned tile whose entries are no longer valid, such as an OOC_OVERWRITE tile that
+ * an operation failed to fill in. Once nothing else pins it the frame is freed, so the tile is
+ * read from the file again instead of being served, or written back, with those entries.
+ */
+static void unpin_invalid(ooc_matrix *mat, int64_t ti, int64_t tj) {
+    pthread_mutex_lock(&cache_lock);
+    frame *f = find_frame(mat, ti * mat -> tile_cols + tj);
+    if (f != NULL && --f -> pins == 0) discard_frame(f);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void *io_main(void *arg) {
+    pthread_mutex_lock(&cache_lock);
+    while (1) {
+        while (!io_stopping && queue_len == 0) {
+            pthread_cond_wait(&io_cond, &cache_lock);
+        }
+        if (io_stopping) break;
+        request r = queue[queue_head];
+        queue_head = (queue_head + 1) % PREFETCH_QUEUE;
+        queue_len--;
+        if (r.mat == NULL || find_frame(r.mat, r.index) != NULL) continue;
+        io_current = r.mat;
+        int found;
+        frame *f = load_tile(r.mat, r.index, OOC_READ, 1, &found);
+        if (f != NULL && !found) {
+            f -> state = FRAME_READY;
+            f -> last_use = ++tick;
+            stats.prefetched++;
+            pthread_cond_broadcast(&cache_cond);
+        }
+        io_current = NULL;
+        pthread_cond_broadcast(&cache_cond);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NULL;
+}
+
+/* In the child of a fork the prefetch thread is gone; start a new one on the next prefetch */
+static void reset_after_fork(void) {
+    pthread_mutex_init(&cache_lock, NULL);
+    pthread_cond_init(&cache_cond, NULL);
+    pthread_cond_init(&io_cond, NULL);
+    io_started = 0;
+    io_stopping = 0;
+    io_current = NULL;
+    queue_len = 0;
+}
+
+/*
+ * Asks the prefetch thread to read tile (ti, tj) of `mat` into the cache, so that a later
+ * ooc_pin finds it there (or waits for the read in flight) instead of reading it itself.
+ * Does nothing if the tile is cached, the queue is full or the cache has no room to spare.
+ */
+void ooc_prefetch(ooc_matrix *mat, int64_t ti, int64_t tj) {
+    int64_t index = ti * mat -> tile_cols + tj;
+    pthread_mutex_lock(&cache_lock);
+    if (!initialized) init_locked();
+    if (!io_started) {
+        static int atfork_registered = 0;
+        if (!atfork_registered) {
+            pthread_atfork(NULL, NULL, reset_after_fork);
+            atfork_registered = 1;
+        }
+        io_started = pthread_create(&io_thread, NULL, io_main, NULL) == 0;
+    }
+    if (io_started && queue_len < PREFETCH_QUEUE && find_frame(mat, index) == NULL) {
+        queue[(queue_head + queue_len) % PREFETCH_QUEUE] = (request){mat, index};
+        queue_len++;
+        pthread_cond_signal(&io_cond);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/*
+ * Writes the dirty tiles of `mat` back to its file and, if `drop` is set, frees them from the
+ * cache. Waits for tiles of `mat` that are being read or written. Called with the lock held.
+ */
+static int write_back(ooc_matrix *mat, int drop) {
+    int status = 0;
+    int busy = 1;
+    while (busy) {
+        busy = io_current == mat;
+        for (frame *f = frames; f != NULL; f = f -> next) {
+            if (f -> owner == mat && f -> state == FRAME_BUSY) busy = 1;
+        }
+        if (busy) pthread_cond_wait(&cache_cond, &cache_lock);
+    }
+    frame *f = frames;
+    while (f != NULL) {
+        if (f -> owner != mat || f -> state != FRAME_READY || !f -> dirty) {
+            f = f -> next;
+            continue;
+        }
+        f -> state = FRAME_BUSY;
+        pthread_mutex_unlock(&cache_lock);
+        int failed = write_tile(f);
+        pthread_mutex_lock(&cache_lock);
+        f -> state = FRAME_READY;
+        pthread_cond_broadcast(&cache_cond);
+        if (failed) {
+            status = -1;
+            break;
+        }
+        f -> dirty = 0;
+        stats.writes++;
+        f = frames; // frames may have come and gone while the lock was released
+    }
+    for (f = frames; drop && f != NULL; f = f -> next) {
+        if (f -> owner == mat && !f -> dirty) discard_frame(f);
+    }
+    return status;
+}
+
+/* Writes every changed tile of `mat` to its file. Returns -1 and sets errno on failure. */
+int ooc_flush(ooc_matrix *mat) {
+    pthread_mutex_lock(&cache_lock);
+    int status = write_back(mat, 0);
+    pthread_mutex_unlock(&cache_lock);
+    return status;
+}
+
+/*
+ * Flushes `mat`, drops its tiles from the cache and closes its file. No tile of `mat` may
+ * still be pinned. The struct is freed even if the flush fails, in which case -1 is returned.
+ */
+int ooc_close(ooc_matrix *mat) {
+    pthread_mutex_lock(&cache_lock);
+    for (int q = 0; q < queue_len; q++) {
+        request *r = &queue[(queue_head + q) % PREFETCH_QUEUE];
+        if (r -> mat == mat) r -> mat = NULL; // skipped by the prefetch thread
+    }
+    int status = write_back(mat, 1);
+    for (frame *f = frames; f != NULL; f = f -> next) {
+        if (f -> owner == mat) discard_frame(f); // changes that could not be written are lost
+    }
+    pthread_mutex_unlock(&cache_lock);
+    int saved = errno;
+    if (close(mat -> fd)) status = -1;
+    else errno = saved;
+    free(mat);
+    return status;
+}
+
+static ooc_matrix *new_ooc(int fd, int64_t rows, int64_t cols, int tile) {
+    ooc_matrix *mat = (ooc_matrix *)malloc(sizeof(ooc_matrix));
+    if (mat == NULL) return NULL;
+    mat -> rows = rows;
+    mat -> cols = cols;
+    mat -> tile = tile;
+    mat -> tile_rows = (rows + tile - 1) / tile;
+    mat -> tile_cols = (cols + tile - 1) / tile;
+    mat -> fd = fd;
+    return mat;
+}
+
+/* Bytes of the file of a rows x cols matrix, or 0 if that does not fit an off_t */
+static uint64_t file_size(int64_t rows, int64_t cols, int tile) {
+    uint64_t tiles = (uint64_t)((rows + tile - 1) / tile) * (uint64_t)((cols + tile - 1) / tile);
+    uint64_t bytes = (uint64_t)tile * tile * sizeof(double);
+    if (tiles > ((uint64_t)INT64_MAX - OOC_HEADER_SIZE) / bytes) return 0;
+    return OOC_HEADER_SIZE + tiles * bytes;
+}
+
+/*
+ * Creates a rows x cols out-of-core matrix of zeros in a new file at `path`, replacing any file
+ * already there. The file is sized with ftruncate, so on most file systems the tiles take no
+ * disk space until they are written.
+ */
+storage_status ooc_create(ooc_matrix **mat, const char *path, int64_t rows, int64_t cols, int tile) {
+    if (rows < 1 || cols < 1 || tile < 1 || tile > OOC_MAX_TILE) return STORAGE_FORMAT;
+    uint64_t size = file_size(rows, cols, tile);
+    if (size == 0) return STORAGE_FORMAT;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return STORAGE_IO;
+    ooc_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OOC_MAGIC, sizeof(header.magic));
+    header.version = OOC_VERSION;
+    header.tile = tile;
+    header.rows = rows;
+    header.cols = cols;
+    storage_status status = STORAGE_OK;
+    if (ftruncate(fd, (off_t)size) || transfer(fd, &header, sizeof(header), 0, 1)) {
+        status = STORAGE_IO;
+    } else if ((*mat = new_ooc(fd, rows, cols, tile)) == NULL) {
+        status = STORAGE_NOMEM;
+    }
+    if (status != STORAGE_OK) {
+        int saved = errno;
+        close(fd);
+        unlink(path);
+        errno = saved;
+    }
+    return status;
+}
+
+/* Opens the out-of-core matrix stored at `path` by ooc_create */
+storage_status ooc_open(ooc_matrix **mat, const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return STORAGE_IO;
+    ooc_header header;
+    struct stat st;
+    storage_status status = STORAGE_OK;
+    if (fstat(fd, &st)) {
+        status = STORAGE_IO;
+    } else if (st.st_size < (off_t)sizeof(header)) {
+        status = STORAGE_FORMAT;
+    } else if (transfer(fd, &header, sizeof(header), 0, 0)) {
+        status = STORAGE_IO;
+    } else if (memcmp(header.magic, OOC_MAGIC, sizeof(header.magic)) || header.version != OOC_VERSION
+               || header.tile < 1 || header.tile > OOC_MAX_TILE || header.rows < 1
+               || header.rows > INT64_MAX || header.cols < 1 || header.cols > INT64_MAX
+               || file_size(header.rows, header.cols, header.tile) == 0
+               || (uint64_t)st.st_size < file_size(header.rows, header.cols, header.tile)) {
+        status = STORAGE_FORMAT;
+    } else if ((*mat = new_ooc(fd, header.rows, header.cols, header.tile)) == NULL) {
+        status = STORAGE_NOMEM;
+    }
+    if (status != STORAGE_OK) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    return status;
+}
+
+/*
+ * Copies between `block`, an in-memory matrix, and the entries of `mat` starting at (row, col),
+ * one overlapping tile at a time. Tiles that `block` covers completely are not read first when
+ * writing. Returns -1 and sets errno on failure.
+ */
+static int copy_block(ooc_matrix *mat, int64_t row, int64_t col, matrix *block, int writing) {
+    int tile = mat -> tile;
+    int64_t last_row = row + block -> rows, last_col = col + block -> cols;
+    for (int64_t ti = row / tile; ti * tile < last_row; ti++) {
+        for (int64_t tj = col / tile; tj * tile < last_col; tj++) {
+            int64_t r0 = ti * tile > row ? ti * tile : row;
+            int64_t r1 = (ti + 1) * tile < last_row ? (ti + 1) * tile : last_row;
+            int64_t c0 = tj * tile > col ? tj * tile : col;
+            int64_t c1 = (tj + 1) * tile < last_col ? (tj + 1) * tile : last_col;
+            int whole = r1 - r0 == tile && c1 - c0 == tile;
+            double *data = ooc_pin(mat, ti, tj, writing && whole ? OOC_OVERWRITE : OOC_READ);
+            if (data == NULL) return -1;
+            for (int64_t r = r0; r < r1; r++) {
+                double *t = data + (r - ti * tile) * tile;
+                for (int64_t c = c0; c < c1; c++) {
+                    if (writing) t[c - tj * tile] = get(block, r - row, c - col);
+                    else set(block, r - row, c - col, t[c - tj * tile]);
+                }
+            }
+            ooc_unpin(mat, ti, tj, writing);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads the entries of `mat` starting at (row, col) into `dst`, which must fit inside `mat`
+ * from there. Return 0 upon success, 1 if `dst` does not fit and -1 (with errno) on I/O errors.
+ */
+int ooc_read_block(matrix *dst, ooc_matrix *mat, int64_t row, int64_t col) {
+    if (row < 0 || col < 0 || row + dst -> rows > mat -> rows || col + dst -> cols > mat -> cols) {
+        return 1;
+    }
+    return copy_block(mat, row, col, dst, 0);
+}
+
+/* Writes `src` to the entries of `mat` starting at (row, col). Returns like ooc_read_block. */
+int ooc_write_block(ooc_matrix *mat, int64_t row, int64_t col, matrix *src) {
+    if (row < 0 || col < 0 || row + src -> rows > mat -> rows || col + src -> cols > mat -> cols) {
+        return 1;
+    }
+    return copy_block(mat, row, col, src, 1);
+}
+
+/* Points `view` at the tile * tile doubles of a pinned tile, without allocating anything */
+static matrix *tile_view(matrix *view, double *data, int tile) {
+    view -> rows = tile; view -> cols = tile;
+    view -> row_stride = tile; view -> col_stride = 1;
+    view -> data = data;
+    view -> ref_cnt = 1;
+    view -> parent = NULL;
+    view -> release = NULL; view -> owner = NULL;
+    return view;
+}
+
+static int same_layout(ooc_matrix *a, ooc_matrix *b) {
+    return a -> tile == b -> tile;
+}
+
+/*
+ * result = mat1 + mat2, tile by tile. The tiles for the next step are prefetched before each
+ * addition, which itself runs on the thread pool, so the reads overlap the computation.
+ * `result` may be one of the operands. Return 0 upon success, 1 if the shapes or tile sizes
+ * differ and -1 (with errno) on I/O errors.
+ */
+int ooc_add(ooc_matrix *result, ooc_matrix *mat1, ooc_matrix *mat2) {
+    if (mat1 -> rows != mat2 -> rows || mat1 -> cols != mat2 -> cols || result -> rows != mat1 -> rows
+            || result -> cols != mat1 -> cols || !same_layout(mat1, mat2) || !same_layout(result, mat1)) {
+        return 1;
+    }
+    int tile = result -> tile;
+    int64_t tiles = result -> tile_rows * result -> tile_cols;
+    ooc_mode mode = result == mat1 || result == mat2 ? OOC_READ : OOC_OVERWRITE;
+    for (int64_t t = 0; t < tiles; t++) {
+        int64_t ti = t / result -> tile_cols, tj = t % result -> tile_cols;
+        if (t + 1 < tiles) {
+            ooc_prefetch(mat1, (t + 1) / result -> tile_cols, (t + 1) % result -> tile_cols);
+            ooc_prefetch(mat2, (t + 1) / result -> tile_cols, (t + 1) % result -> tile_cols);
+        }
+        double *a = ooc_pin(mat1, ti, tj, OOC_READ);
+        double *b = a != NULL ? ooc_pin(mat2, ti, tj, OOC_READ) : NULL;
+        double *c = b != NULL ? ooc_pin(result, ti, tj, mode) : NULL;
+        if (c != NULL) {
+            matrix va, vb, vc;
+            add_matrix(tile_view(&vc, c, tile), tile_view(&va, a, tile), tile_view(&vb, b, tile));
+            ooc_unpin(result, ti, tj, 1);
+        }
+        if (b != NULL) ooc_unpin(mat2, ti, tj, 0);
+        if (a != NULL) ooc_unpin(mat1, ti, tj, 0);
+        if (c == NULL) return -1;
+    }
+    return 0;
+}
+
+/*
+ * result = mat1 * mat2. Each tile of `result` stays pinned while the products of a row of tiles
+ * of mat1 and a column of tiles of mat2 are accumulated into it with gemm_matrix, and the
+ * operand tiles of the next product are prefetched before each one. Every step reads two tiles
+ * and does 2 * tile^3 flops, so large tiles keep the multiplication compute bound; once the
+ * cache holds a row of tiles of mat1 and a column of mat2, the row is reused across the columns
+ * of `result` instead of being read again. `result` must not be an operand.
+ * Return 0 upon success, 1 if the shapes or tile sizes do not match and -1 (with errno) on I/O errors.
+ */
+int ooc_mul(ooc_matrix *result, ooc_matrix *mat1, ooc_matrix *mat2) {
+    if (mat1 -> cols != mat2 -> rows || result -> rows != mat1 -> rows || result -> cols != mat2 -> cols
+            || !same_layout(mat1, mat2) || !same_layout(result, mat1) || result == mat1
+            || result == mat2) {
+        return 1;
+    }
+    int tile = result -> tile;
+    int64_t depth = mat1 -> tile_cols;
+    for (int64_t ti = 0; ti < result -> tile_rows; ti++) {
+        for (int64_t tj = 0; tj < result -> tile_cols; tj++) {
+            double *c = ooc_pin(result, ti, tj, OOC_OVERWRITE);
+            if (c == NULL) return -1;
+            for (int64_t tk = 0; tk < depth; tk++) {
+                int64_t ni = ti, nj = tj, nk = tk + 1;
+                if (nk == depth) {
+                    nk = 0;
+                    if (++nj == result -> tile_cols) {
+                        nj = 0;
+                        ni++;
+                    }
+                }
+                if (ni < result -> tile_rows) {
+                    ooc_prefetch(mat1, ni, nk);
+                    ooc_prefetch(mat2, nk, nj);
+                }
+                double *a = ooc_pin(mat1, ti, tk, OOC_READ);
+                double *b = a != NULL ? ooc_pin(mat2, tk, tj, OOC_READ) : NULL;
+                if (b != NULL) {
+                    matrix va, vb, vc;
+                    gemm_matrix(tile_view(&vc, c, tile), 1.0, 0, tile_view(&va, a, tile), 0,
+                                tile_view(&vb, b, tile), tk == 0 ? 0.0 : 1.0);
+                    ooc_unpin(mat2, tk, tj, 0);
+                }
+                if (a != NULL) ooc_unpin(mat1, ti, tk, 0);
+                if (b == NULL) {
+                    unpin_invalid(result, ti, tj);
+                    return -1;
+                }
+            }
+            ooc_unpin(result, ti, tj, 1);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sets the budget of the tile cache in bytes and frees unpinned, clean tiles until the cache
+ * fits in it. Dirty tiles above the budget are written back as they get evicted.
+ */
+void ooc_set_budget(size_t bytes) {
+    pthread_mutex_lock(&cache_lock);
+    if (!initialized) init_locked();
+    stats.budget = bytes;
+    trim_locked();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Copies the current counters to `out` */
+void ooc_get_stats(ooc_stats *out) {
+    pthread_mutex_lock(&cache_lock);
+    if (!initialized) init_locked();
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Stops the prefetch thread; the next prefetch starts it again */
+void ooc_shutdown(void) {
+    pthread_mutex_lock(&cache_lock);
+    int started = io_started;
+    io_stopping = 1;
+    pthread_cond_broadcast(&io_cond);
+    pthread_mutex_unlock(&cache_lock);
+    if (started) pthread_join(io_thread, NULL);
+    pthread_mutex_lock(&cache_lock);
+    io_started = 0;
+    io_stopping = 0;
+    pthread_mutex_unlock(&cache_lock);
+}
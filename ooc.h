@@ -0,0 +1,65 @@
+#ifndef OOC_H
+#define OOC_H
+
+#include "matrix.h"
+#include "storage.h"
+#include <stdint.h>
+
+/*
+ * Out-of-core matrices, for data larger than memory. The entries live in a file, cut into
+ * square tiles of `tile` x `tile` doubles that are stored one after the other, row of tiles
+ * after row of tiles, each tile row-major. Tiles on the right and bottom edges are padded with
+ * zeros to full size, so every tile can be handled by the same full-size kernels. Tiles are
+ * paged in and out through one buffer cache shared by all out-of-core matrices, whose size is
+ * bounded by a byte budget, and a background thread reads the tiles an operation is about to
+ * need while it computes on the current ones.
+ */
+#define OOC_MAGIC "NUMCOOC" // followed by a NUL, 8 bytes
+#define OOC_VERSION 1
+#define OOC_HEADER_SIZE 64
+
+/* Default budget of the tile cache, overridden by the NUMC_OOC_BYTES environment variable */
+#define OOC_DEFAULT_BUDGET ((size_t)256 << 20)
+
+/* Largest tile side, which keeps a tile of doubles (512 MiB at most) a sensible unit of I/O */
+#define OOC_MAX_TILE 8192
+
+typedef struct ooc_matrix {
+    int64_t rows;
+    int64_t cols;
+    int tile; // side of the square tiles
+    int64_t tile_rows; // number of rows of tiles
+    int64_t tile_cols; // number of columns of tiles
+    int fd; // the backing file, open for reading and writing
+} ooc_matrix;
+
+/* Counters of the tile cache, see ooc_get_stats */
+typedef struct ooc_stats {
+    size_t budget; // bytes of tiles the cache may hold
+    size_t bytes; // bytes of tiles currently held
+    size_t hits; // tiles found in the cache when pinned
+    size_t misses; // tiles that had to be read (or zeroed) on the spot
+    size_t prefetched; // tiles read by the background thread ahead of use
+    size_t reads; // tiles read from files
+    size_t writes; // dirty tiles written back to files
+} ooc_stats;
+
+/* How ooc_pin gets a tile: read it, or skip the read because every entry is about to be written */
+typedef enum ooc_mode { OOC_READ, OOC_OVERWRITE } ooc_mode;
+
+storage_status ooc_create(ooc_matrix **mat, const char *path, int64_t rows, int64_t cols, int tile);
+storage_status ooc_open(ooc_matrix **mat, const char *path);
+int ooc_flush(ooc_matrix *mat);
+int ooc_close(ooc_matrix *mat);
+double *ooc_pin(ooc_matrix *mat, int64_t ti, int64_t tj, ooc_mode mode);
+void ooc_unpin(ooc_matrix *mat, int64_t ti, int64_t tj, int dirty);
+void ooc_prefetch(ooc_matrix *mat, int64_t ti, int64_t tj);
+int ooc_read_block(matrix *dst, ooc_matrix *mat, int64_t row, int64_t col);
+int ooc_write_block(ooc_matrix *mat, int64_t row, int64_t col, matrix *src);
+int ooc_add(ooc_matrix *result, ooc_matrix *mat1, ooc_matrix *mat2);
+int ooc_mul(ooc_matrix *result, ooc_matrix *mat1, ooc_matrix *mat2);
+void ooc_set_budget(size_t bytes);
+void ooc_get_stats(ooc_stats *stats);
+void ooc_shutdown(void);
+
+#endif
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE // pthread_setaffinity_np and CPU_SET
+
+#include "pool.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * A loop is split into one contiguous range of iterations per slot. Each participant (the
+ * calling thread in slot 0, and workers that pick up the loop in the other slots) runs
+ * iterations from the front of its own range; once that is empty it steals the back half of
+ * the fullest remaining range. Uneven iterations (GEMM edge blocks, a worker that woke up
+ * late) therefore balance out without a central queue, and slots no worker picked up are
+ * simply stolen, so a loop always finishes even if every worker is busy elsewhere.
+ */
+typedef struct range {
+    long begin;
+    long end;
+    int lock; // spin lock, only held for a few instructions
+} range;
+
+typedef struct job {
+    pool_body body;
+    void *ctx;
+    int slots; // number of ranges, the calling thread's included
+    int joined; // slots handed out so far
+    int active; // workers currently running one of the slots
+    range ranges[POOL_MAX_THREADS];
+    struct job *next;
+} job;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER; // workers wait here for jobs
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; // callers wait here for workers to leave
+static pthread_t workers[POOL_MAX_THREADS];
+static int nworkers = 0;
+static int stopping = 0;
+static int pinned = -1; // -1 until NUMC_PIN_THREADS has been read
+static int atfork_registered = 0;
+static job *queue = NULL; // jobs that still have slots to hand out, oldest first
+
+static void lock_range(range *r) {
+    while (__atomic_exchange_n(&r -> lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&r -> lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void unlock_range(range *r) {
+    __atomic_store_n(&r -> lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Takes the next iteration from the front of `slot`'s own range */
+static int take(job *j, int slot, long *i) {
+    range *r = &j -> ranges[slot];
+    lock_range(r);
+    int found = r -> begin < r -> end;
+    if (found) *i = r -> begin++;
+    unlock_range(r);
+    return found;
+}
+
+/*
+ * Moves the back half of the fullest other range to `slot`'s (empty) range and takes its first
+ * iteration. Returns 0 once every range is empty.
+ */
+static int steal(job *j, int slot, long *i) {
+    while (1) {
+        int victim = -1;
+        long most = 0;
+        for (int s = 0; s < j -> slots; s++) {
+            range *r = &j -> ranges[s];
+            long left = __atomic_load_n(&r -> end, __ATOMIC_RELAXED)
+                - __atomic_load_n(&r -> begin, __ATOMIC_RELAXED);
+            if (s != slot && left > most) {
+                most = left;
+                victim = s;
+            }
+        }
+        if (victim < 0) return 0;
+        range *r = &j -> ranges[victim];
+        lock_range(r);
+        long begin = r -> begin, end = r -> end;
+        if (begin >= end) {
+            unlock_range(r); // emptied since the scan, look again
+            continue;
+        }
+        long mid = begin + (end - begin) / 2;
+        r -> end = mid;
+        unlock_range(r);
+        range *own = &j -> ranges[slot];
+        lock_range(own);
+        own -> begin = mid + 1;
+        own -> end = end;
+        unlock_range(own);
+        *i = mid;
+        return 1;
+    }
+}
+
+static void run_slot(job *j, int slot) {
+    TRACE_BEGIN(span);
+    long i;
+    while (take(j, slot, &i) || steal(j, slot, &i)) {
+        j -> body(j -> ctx, i, slot);
+    }
+    TRACE_END(span, "pool slot", slot);
+}
+
+/*
+ * The CPUs the process may run on, read once: under taskset or a cgroup cpuset they need not
+ * be 0..N-1, nor all of the online ones
+ */
+static pthread_once_t allowed_once = PTHREAD_ONCE_INIT;
+static cpu_set_t allowed;
+
+static void read_allowed(void) {
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) return;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&allowed);
+    for (long c = 0; c < online && c < CPU_SETSIZE; c++) CPU_SET(c, &allowed);
+    if (CPU_COUNT(&allowed) == 0) CPU_SET(0, &allowed);
+}
+
+/* Returns the number of CPUs the process may run on */
+int pool_cores(void) {
+    pthread_once(&allowed_once, read_allowed);
+    int cores = CPU_COUNT(&allowed);
+    return cores > POOL_MAX_THREADS ? POOL_MAX_THREADS : cores;
+}
+
+/* Returns the `k`-th CPU the process may run on, counting from 0 */
+static int allowed_cpu(int k) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed) && k-- == 0) return c;
+    }
+    return 0;
+}
+
+/*
+ * Pins worker `id` to a CPU of its own, leaving the first allowed CPU to the thread that
+ * started the loops. Returns 0 upon success and an error number upon failure.
+ */
+static int pin_worker(pthread_t thread, int id) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(allowed_cpu((id + 1) % pool_cores()), &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+/* Lets `thread` run on every CPU the process was allowed again. Returns like pin_worker. */
+static int unpin_worker(pthread_t thread) {
+    pool_cores();
+    return pthread_setaffinity_np(thread, sizeof(allowed), &allowed);
+}
+
+static void *worker_main(void *arg) {
+    trace_thread_name("numc worker");
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+        while (!stopping && queue == NULL) {
+            pthread_cond_wait(&work_cond, &pool_lock);
+        }
+        if (stopping) break;
+        job *j = queue;
+        int slot = j -> joined++;
+        if (j -> joined == j -> slots) queue = j -> next;
+        j -> active++;
+        pthread_mutex_unlock(&pool_lock);
+        run_slot(j, slot);
+        pthread_mutex_lock(&pool_lock);
+        if (--j -> active == 0) pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/*
+ * In the child of a fork only the forking thread exists. Forget the workers (the loops still
+ * finish, by stealing every slot) so that the next loop starts new ones.
+ */
+static void reset_after_fork(void) {
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+    nworkers = 0;
+    stopping = 0;
+    queue = NULL;
+}
+
+/* Starts workers until there are `count`. Called with the lock held. */
+static void start_workers(int count) {
+    if (pinned < 0) {
+        const char *pin = getenv("NUMC_PIN_THREADS");
+        pinned = pin != NULL && atoi(pin) != 0;
+    }
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, reset_after_fork);
+        atfork_registered = 1;
+    }
+    while (nworkers < count) {
+        if (pthread_create(&workers[nworkers], NULL, worker_main, NULL)) return;
+        if (pinned) pin_worker(workers[nworkers], nworkers); // left unpinned if that fails
+        nworkers++;
+    }
+}
+
+/*
+ * Runs body(ctx, i, slot) for every i in [0, n) on `threads` threads, the calling thread
+ * included, and returns once all iterations are done. Workers are started on first use.
+ * Several threads may run loops at the same time; the workers are shared between them.
+ */
+void pool_parallel_for(long n, int threads, pool_body body, void *ctx) {
+    if (threads > n) threads = (int)n;
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    if (threads <= 1) {
+        for (long i = 0; i < n; i++) {
+            body(ctx, i, 0);
+        }
+        return;
+    }
+    job j;
+    j.body = body;
+    j.ctx = ctx;
+    j.slots = threads;
+    j.joined = 1;
+    j.active = 0;
+    j.next = NULL;
+    for (int s = 0; s < threads; s++) {
+        j.ranges[s].begin = n * s / threads;
+        j.ranges[s].end = n * (s + 1) / threads;
+        j.ranges[s].lock = 0;
+    }
+    pthread_mutex_lock(&pool_lock);
+    start_workers(threads - 1);
+    job **tail = &queue;
+    while (*tail != NULL) tail = &(*tail) -> next;
+    *tail = &j;
+    for (int s = 1; s < threads; s++) {
+        pthread_cond_signal(&work_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    run_slot(&j, 0);
+    /* Time spent here is time the other slots took longer than the caller's */
+    TRACE_BEGIN(span);
+    pthread_mutex_lock(&pool_lock);
+    for (job **p = &queue; *p != NULL; p = &(*p) -> next) {
+        if (*p == &j) {
+            *p = j.next;
+            break;
+        }
+    }
+    while (j.active > 0) {
+        pthread_cond_wait(&done_cond, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    TRACE_END(span, "pool join", threads);
+}
+
+/*
+ * Pins every worker, current and future, to a CPU of its own if `pin` is set, or unpins them.
+ * If a worker cannot be pinned, every worker is unpinned again. Returns 0 upon success, or -1
+ * with errno set.
+ */
+int pool_set_pinning(int pin) {
+    pthread_mutex_lock(&pool_lock);
+    pinned = pin != 0;
+    int err = 0;
+    for (int w = 0; w < nworkers && !err; w++) {
+        err = pinned ? pin_worker(workers[w], w) : unpin_worker(workers[w]);
+    }
+    if (err && pinned) {
+        pinned = 0;
+        for (int w = 0; w < nworkers; w++) unpin_worker(workers[w]);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (err) errno = err;
+    return err ? -1 : 0;
+}
+
+/* Returns the number of workers currently started */
+int pool_workers(void) {
+    pthread_mutex_lock(&pool_lock);
+    int count = nworkers;
+    pthread_mutex_unlock(&pool_lock);
+    return count;
+}
+
+/*
+ * Stops and joins every worker. Loops still running finish on the threads that started them.
+ * The next loop starts new workers, so this is also how the pool is shrunk.
+ */
+void pool_shutdown(void) {
+    pthread_mutex_lock(&pool_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_cond);
+    int count = nworkers;
+    pthread_mutex_unlock(&pool_lock);
+    for (int w = 0; w < count; w++) {
+        pthread_join(workers[w], NULL);
+    }
+    pthread_mutex_lock(&pool_lock);
+    nworkers = 0;
+    stopping = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,26 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * Persistent pool of worker threads that runs the parallel loops of the kernels. The workers
+ * are started on first use, sleep on a condition variable between loops instead of spinning,
+ * and are joined at interpreter exit.
+ */
+
+/* Longest team a loop can have, the calling thread included */
+#define POOL_MAX_THREADS 256
+
+/*
+ * Body of a parallel loop: runs iteration `i`. `slot` is below the `threads` the loop was
+ * started with and no two iterations with the same slot run at the same time, so it can index
+ * per-thread scratch buffers.
+ */
+typedef void (*pool_body)(void *ctx, long i, int slot);
+
+void pool_parallel_for(long n, int threads, pool_body body, void *ctx);
+int pool_set_pinning(int pin);
+int pool_workers(void);
+int pool_cores(void);
+void pool_shutdown(void);
+
+#endif
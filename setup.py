@@ -2,11 +2,13 @@ from distutils.core import setup, Extension
 import sysconfig
 
 def main():
-    CFLAGS = ['-g', '-Wall', '-std=c99', '-fopenmp', '-mavx', '-mfma', '-pthread', '-O3']
-    LDFLAGS = ['-fopenmp']
+    # No -m flags here: kernels.c compiles each instruction set variant with its own target
+    # options and picks one at import time, so the module runs on any x86-64 CPU.
+    CFLAGS = ['-g', '-Wall', '-std=c99', '-pthread', '-O3']
+    LDFLAGS = ['-pthread']
     # Use the setup function we imported and set up the modules.
     # You may find this reference helpful: https://docs.python.org/3.6/extending/building.html
-    module = Extension('numc', sources = ['numc.c', 'matrix.c'],
+    module = Extension('numc', sources = ['numc.c', 'matrix.c', 'kernels.c', 'alloc.c', 'expr.c', 'threading.c', 'pool.c', 'storage.c', 'ooc.c', 'stats.c', 'trace.c', 'numa.c', 'executor.c'],
             extra_compile_args = CFLAGS, extra_link_args = LDFLAGS)
     setup(name = 'numc', ext_modules = [module])
 
@@ -0,0 +1,203 @@
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ * The counters of one thread. Only the owning thread writes them, with relaxed atomic stores
+ * so that stats_get can read them at any time; a sum read while a call is being recorded may
+ * include some of its fields and not others. stats_reset does not touch the blocks but starts
+ * a new generation: readers skip blocks of an older generation, and each thread zeroes its own
+ * block the next time it records something.
+ */
+typedef struct stats_block {
+    uint64_t generation;
+    stats_counter counters[STATS_OPS][STATS_BUCKETS];
+    struct stats_block *next;
+} stats_block;
+
+int stats_enabled = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_block *blocks = NULL; // blocks of the live threads
+static stats_block retired; // what the threads that have exited counted
+static uint64_t generation = 0;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key; // its destructor retires the block of an exiting thread
+
+static __thread stats_block *mine = NULL;
+static __thread stats_scope *current = NULL; // innermost open scope of this thread
+
+static const char *const op_names[STATS_OPS] = {
+    "add", "sub", "neg", "abs", "copy", "fill", "rand", "gemm", "pow", "expr",
+    "Matrix.__add__", "Matrix.__sub__", "Matrix.__mul__", "Matrix.__neg__", "Matrix.__abs__",
+    "Matrix.__pow__", "Matrix.__iadd__", "Matrix.__isub__", "Matrix.__imul__", "Matrix.__ipow__",
+    "Matrix.__getitem__", "Matrix.__setitem__"
+};
+
+static const char *const bucket_names[STATS_BUCKETS] = {
+    "<=1K", "<=16K", "<=256K", "<=4M", "<=64M", ">64M"
+};
+
+static uint64_t load(const uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void store(uint64_t *p, uint64_t val) {
+    __atomic_store_n(p, val, __ATOMIC_RELAXED);
+}
+
+/* Zeroes `block` and stamps it with generation `gen` */
+static void clear_block(stats_block *block, uint64_t gen) {
+    uint64_t *p = (uint64_t *)block -> counters;
+    for (size_t i = 0; i < sizeof(block -> counters) / sizeof(uint64_t); i++) store(&p[i], 0);
+    __atomic_store_n(&block -> generation, gen, __ATOMIC_RELEASE);
+}
+
+/* Adds the counters of `from` to those of `to`; both are of the current generation */
+static void merge_block(stats_block *to, stats_block *from) {
+    for (int op = 0; op < STATS_OPS; op++) {
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            stats_counter *t = &to -> counters[op][b];
+            stats_counter *f = &from -> counters[op][b];
+            store(&t -> calls, load(&t -> calls) + load(&f -> calls));
+            store(&t -> ns, load(&t -> ns) + load(&f -> ns));
+            if (load(&f -> max_ns) > load(&t -> max_ns)) store(&t -> max_ns, load(&f -> max_ns));
+            store(&t -> bytes_read, load(&t -> bytes_read) + load(&f -> bytes_read));
+            store(&t -> bytes_written, load(&t -> bytes_written) + load(&f -> bytes_written));
+            store(&t -> flops, load(&t -> flops) + load(&f -> flops));
+            store(&t -> alloc_bytes, load(&t -> alloc_bytes) + load(&f -> alloc_bytes));
+        }
+    }
+}
+
+/* Destructor of `key`: moves what an exiting thread counted to `retired` and frees its block */
+static void retire_block(void *arg) {
+    stats_block *block = (stats_block *)arg;
+    pthread_mutex_lock(&lock);
+    stats_block **link = &blocks;
+    while (*link != block) link = &(*link) -> next;
+    *link = block -> next;
+    if (retired.generation != generation) clear_block(&retired, generation);
+    if (block -> generation == generation) merge_block(&retired, block);
+    pthread_mutex_unlock(&lock);
+    free(block);
+}
+
+static void make_key(void) {
+    pthread_key_create(&key, retire_block);
+}
+
+/* Returns the block of the calling thread, zeroed if a reset happened since it last counted */
+static stats_block *thread_block(void) {
+    stats_block *block = mine;
+    if (block == NULL) {
+        block = (stats_block *)calloc(1, sizeof(stats_block));
+        if (block == NULL) return NULL;
+        pthread_once(&key_once, make_key);
+        pthread_setspecific(key, block);
+        pthread_mutex_lock(&lock);
+        block -> generation = generation;
+        block -> next = blocks;
+        blocks = block;
+        pthread_mutex_unlock(&lock);
+        mine = block;
+    }
+    uint64_t gen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if (block -> generation != gen) clear_block(block, gen);
+    return block;
+}
+
+/* Returns the bucket of a call touching matrices of at most `entries` entries */
+static int bucket_of(double entries) {
+    int bucket = 0;
+    for (double limit = 1024; bucket < STATS_BUCKETS - 1 && entries > limit; limit *= 16) bucket++;
+    return bucket;
+}
+
+/* Opens `scope` for a call of `op` on the calling thread */
+void stats_begin(stats_scope *scope, stats_op op) {
+    scope -> active = 1;
+    scope -> counted = stats_enabled;
+    scope -> op = op;
+    scope -> alloc_bytes = 0;
+    scope -> parent = current;
+    current = scope;
+    scope -> start = trace_now();
+}
+
+/*
+ * Closes `scope` and counts its call in the bucket of `entries`, the size of the largest
+ * matrix it touched, along with its traffic and floating point operations. If tracing is on,
+ * the call also becomes a span of the trace.
+ */
+void stats_end(stats_scope *scope, double entries, double bytes_read, double bytes_written,
+               double flops) {
+    uint64_t ns = trace_now() - scope -> start;
+    current = scope -> parent;
+    if (trace_enabled) trace_event(op_names[scope -> op], scope -> start, (long)entries);
+    if (!scope -> counted) return;
+    stats_block *block = thread_block();
+    if (block == NULL) return;
+    stats_counter *c = &block -> counters[scope -> op][bucket_of(entries)];
+    store(&c -> calls, c -> calls + 1);
+    store(&c -> ns, c -> ns + ns);
+    if (ns > c -> max_ns) store(&c -> max_ns, ns);
+    store(&c -> bytes_read, c -> bytes_read + (uint64_t)bytes_read);
+    store(&c -> bytes_written, c -> bytes_written + (uint64_t)bytes_written);
+    store(&c -> flops, c -> flops + (uint64_t)flops);
+    store(&c -> alloc_bytes, c -> alloc_bytes + scope -> alloc_bytes);
+}
+
+/* Charges an allocation of `bytes` bytes to every call open on the calling thread */
+void stats_alloc(size_t bytes) {
+    for (stats_scope *scope = current; scope != NULL; scope = scope -> parent) {
+        scope -> alloc_bytes += bytes;
+    }
+}
+
+/* Adds the counters of `op` in `bucket` of `block` to `sum`, if the block is of generation `gen` */
+static void sum_block(stats_counter *sum, stats_block *block, uint64_t gen, stats_op op, int bucket) {
+    if (__atomic_load_n(&block -> generation, __ATOMIC_ACQUIRE) != gen) return;
+    stats_counter *c = &block -> counters[op][bucket];
+    sum -> calls += load(&c -> calls);
+    sum -> ns += load(&c -> ns);
+    if (load(&c -> max_ns) > sum -> max_ns) sum -> max_ns = load(&c -> max_ns);
+    sum -> bytes_read += load(&c -> bytes_read);
+    sum -> bytes_written += load(&c -> bytes_written);
+    sum -> flops += load(&c -> flops);
+    sum -> alloc_bytes += load(&c -> alloc_bytes);
+}
+
+/* Stores the sum over all threads of the counters of `op` in `bucket` to `out` */
+void stats_get(stats_op op, int bucket, stats_counter *out) {
+    stats_counter sum = {0, 0, 0, 0, 0, 0, 0};
+    pthread_mutex_lock(&lock);
+    sum_block(&sum, &retired, generation, op, bucket);
+    for (stats_block *block = blocks; block != NULL; block = block -> next) {
+        sum_block(&sum, block, generation, op, bucket);
+    }
+    pthread_mutex_unlock(&lock);
+    *out = sum;
+}
+
+/* Zeroes the counters of all threads */
+void stats_reset(void) {
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Turns counting on or off and returns whether it was on */
+int stats_set_enabled(int enabled) {
+    int was = stats_enabled;
+    stats_enabled = enabled != 0;
+    return was;
+}
+
+const char *stats_op_name(stats_op op) {
+    return op_names[op];
+}
+
+const char *stats_bucket_name(int bucket) {
+    return bucket_names[bucket];
+}
@@ -0,0 +1,91 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "trace.h"
+
+/*
+ * Per-operation counters: calls, time, bytes moved, floating point operations and bytes
+ * allocated, per operation and per shape bucket. Every thread counts into a block of its own
+ * without any locking, and stats_get adds up the blocks of all threads. Counting is off unless
+ * NUMC_STATS=1 is set at import or stats_set_enabled turns it on, and then costs one predictable
+ * branch per call. Building with -DNUMC_NO_STATS removes it altogether. The same scopes give
+ * the tracer of trace.h its spans of kernels and methods, so they also open while it runs.
+ */
+
+/* The operations counted: the kernels of matrix.c and expr.c, then the numc.Matrix methods */
+typedef enum stats_op {
+    STATS_ADD, STATS_SUB, STATS_NEG, STATS_ABS, STATS_COPY, STATS_FILL, STATS_RAND, STATS_GEMM,
+    STATS_POW, STATS_EXPR,
+    STATS_PY_ADD, STATS_PY_SUB, STATS_PY_MUL, STATS_PY_NEG, STATS_PY_ABS, STATS_PY_POW,
+    STATS_PY_IADD, STATS_PY_ISUB, STATS_PY_IMUL, STATS_PY_IPOW, STATS_PY_GETITEM,
+    STATS_PY_SETITEM,
+    STATS_OPS
+} stats_op;
+
+/*
+ * Shape buckets by the number of entries of the largest matrix a call touches: up to 1K, 16K,
+ * 256K, 4M and 64M entries, and more than that.
+ */
+#define STATS_BUCKETS 6
+
+/* What stats_get returns for one operation and bucket */
+typedef struct stats_counter {
+    uint64_t calls;
+    uint64_t ns; // total wall time of the calls
+    uint64_t max_ns; // longest call
+    uint64_t bytes_read; // bytes of operands read, each entry counted once
+    uint64_t bytes_written; // bytes of results written
+    uint64_t flops; // floating point operations, a multiply-add counting as two
+    uint64_t alloc_bytes; // bytes requested from alloc_data during the calls
+} stats_counter;
+
+/*
+ * One call being counted, kept on the stack of the calling thread. Calls nest (numc.Matrix
+ * methods call kernels, pow_matrix calls gemm_matrix), and allocations are charged to every
+ * call open at the time.
+ */
+typedef struct stats_scope {
+    int active; // set by stats_begin if counting or tracing was on
+    int counted; // set if counting was on
+    stats_op op;
+    uint64_t start;
+    uint64_t alloc_bytes;
+    struct stats_scope *parent;
+} stats_scope;
+
+extern int stats_enabled;
+
+void stats_begin(stats_scope *scope, stats_op op);
+void stats_end(stats_scope *scope, double entries, double bytes_read, double bytes_written,
+               double flops);
+void stats_alloc(size_t bytes);
+void stats_get(stats_op op, int bucket, stats_counter *out);
+void stats_reset(void);
+int stats_set_enabled(int enabled);
+const char *stats_op_name(stats_op op);
+const char *stats_bucket_name(int bucket);
+
+/*
+ * What the instrumented functions use: STATS_SCOPE declares a scope, STATS_BEGIN opens it if
+ * counting or tracing is on, and STATS_END closes it with the size and the traffic of the call.
+ */
+#ifdef NUMC_NO_STATS
+#define STATS_SCOPE(scope)
+#define STATS_BEGIN(scope, op) ((void)0)
+#define STATS_END(scope, entries, bytes_read, bytes_written, flops) \
+    ((void)sizeof((entries) + (bytes_read) + (bytes_written) + (flops)))
+#define STATS_ALLOC(bytes) ((void)0)
+#else
+#define STATS_SCOPE(scope) stats_scope scope; scope.active = 0
+#define STATS_BEGIN(scope, op) do { \
+        if (stats_enabled || trace_enabled) stats_begin(&(scope), op); \
+    } while (0)
+#define STATS_END(scope, entries, bytes_read, bytes_written, flops) do { \
+        if ((scope).active) stats_end(&(scope), entries, bytes_read, bytes_written, flops); \
+    } while (0)
+#define STATS_ALLOC(bytes) do { if (stats_enabled) stats_alloc(bytes); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,326 @@
+#include "storage.h" // Python.h first, which asks for the POSIX 2008 pread, pwrite and mmap
+#include "alloc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The data checksum is chained over blocks of this many bytes, so files can be written and
+ * read through a buffer of any multiple of it and still get the same value.
+ */
+#define CHECKSUM_BLOCK ((size_t)1 << 16)
+
+/* Doubles moved per read or write; a multiple of CHECKSUM_BLOCK */
+#define STAGE_DOUBLES ((size_t)1 << 17)
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME1;
+    h ^= h >> 32;
+    return h;
+}
+
+/*
+ * Returns a 64-bit checksum of `bytes` bytes at `data`, continuing from `seed`. Four
+ * independent lanes each fold in every fourth word with an invertible step, so the loop runs
+ * at memory speed and changing any single word always changes the result.
+ */
+uint64_t storage_checksum(uint64_t seed, const void *data, size_t bytes) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t lane[4] = {seed ^ PRIME1, seed + PRIME2, ~seed, seed * PRIME1 + 1};
+    size_t words = bytes / 8;
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t w;
+            memcpy(&w, p + (i + l) * 8, 8);
+            lane[l] = (lane[l] ^ w) * PRIME1;
+        }
+    }
+    for (; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + i * 8, 8);
+        lane[i % 4] = (lane[i % 4] ^ w) * PRIME1;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + words * 8, bytes % 8);
+    uint64_t h = (uint64_t)bytes * PRIME2 ^ tail;
+    for (int l = 0; l < 4; l++) {
+        h = mix(h ^ lane[l]) * PRIME1;
+    }
+    return mix(h);
+}
+
+/* Feeds `bytes` more bytes at `data` into the chained data checksum `h` */
+static uint64_t checksum_blocks(uint64_t h, const void *data, size_t bytes) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t off = 0; off < bytes; off += CHECKSUM_BLOCK) {
+        size_t len = bytes - off < CHECKSUM_BLOCK ? bytes - off : CHECKSUM_BLOCK;
+        h = storage_checksum(h, p + off, len);
+    }
+    return h;
+}
+
+/* The format stores doubles as they are in memory, which only matches the file on little-endian hosts */
+static int little_endian(void) {
+    const uint16_t one = 1;
+    return *(const unsigned char *)&one == 1;
+}
+
+/* Writes all `bytes` bytes at `buf` to `fd` at `offset`, retrying short writes. Returns -1 on error. */
+static int write_all(int fd, const void *buf, size_t bytes, off_t offset) {
+    const char *p = (const char *)buf;
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n; bytes -= n; offset += n;
+    }
+    return 0;
+}
+
+/* Reads exactly `bytes` bytes at `offset` of `fd` to `buf`. Returns -1 on error or early end of file. */
+static int read_all(int fd, void *buf, size_t bytes, off_t offset) {
+    char *p = (char *)buf;
+    while (bytes > 0) {
+        ssize_t n = pread(fd, p, bytes, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) {
+            errno = EIO;
+            return -1;
+        }
+        p += n; bytes -= n; offset += n;
+    }
+    return 0;
+}
+
+/* Numbers the temporary files of matrix_save, which may run on several threads at once */
+static unsigned long temp_counter = 0;
+
+/*
+ * Opens a new file next to `path` for matrix_save to write to, and stores its name to `*temp`,
+ * to be freed by the caller. Returns the descriptor, or -1 with `*temp` set to NULL.
+ */
+static int open_temp(const char *path, char **temp) {
+    size_t len = strlen(path) + 64;
+    *temp = (char *)malloc(len);
+    if (*temp == NULL) return -1;
+    for (int attempt = 0; attempt < 100; attempt++) {
+        unsigned long n = __atomic_fetch_add(&temp_counter, 1, __ATOMIC_RELAXED);
+        snprintf(*temp, len, "%s.tmp%ld.%lu", path, (long)getpid(), n);
+        int fd = open(*temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd >= 0 || errno != EEXIST) {
+            if (fd < 0) {
+                free(*temp);
+                *temp = NULL;
+            }
+            return fd;
+        }
+    }
+    free(*temp);
+    *temp = NULL;
+    return -1;
+}
+
+/*
+ * Writes `mat` to a new file at `path`, replacing any file already there. The entries are
+ * stored contiguously whatever the strides of `mat` are. The data goes first and the header
+ * last, so a file cut short by a crash never passes its checksum. The file is written under a
+ * temporary name in the same directory, synced, and renamed over `path`: the file it replaces
+ * may still be mapped by matrices matrix_load returned (even `mat` itself), and truncating it
+ * under them would fault their next access.
+ */
+storage_status matrix_save(const char *path, matrix *mat) {
+    if (!little_endian()) return STORAGE_FORMAT;
+    char *temp;
+    int fd = open_temp(path, &temp);
+    if (fd < 0) return STORAGE_IO;
+    size_t total = (size_t)mat -> rows * mat -> cols;
+    double *stage = NULL;
+    if (!is_contiguous(mat)) {
+        stage = alloc_data(total < STAGE_DOUBLES ? total : STAGE_DOUBLES, 0);
+        if (stage == NULL) {
+            close(fd);
+            unlink(temp);
+            free(temp);
+            return STORAGE_NOMEM;
+        }
+    }
+    storage_status status = STORAGE_OK;
+    uint64_t h = 0;
+    off_t offset = STORAGE_HEADER_SIZE;
+    int64_t r = 0, c = 0; // next entry to gather into `stage`
+    for (size_t done = 0; done < total && status == STORAGE_OK;) {
+        size_t n = total - done < STAGE_DOUBLES ? total - done : STAGE_DOUBLES;
+        const double *piece = mat -> data + done;
+        if (stage != NULL) {
+            for (size_t k = 0; k < n; k++, c++) {
+                if (c == mat -> cols) {
+                    c = 0;
+                    r++;
+                }
+                stage[k] = get(mat, r, c);
+            }
+            piece = stage;
+        }
+        h = checksum_blocks(h, piece, n * sizeof(double));
+        if (write_all(fd, piece, n * sizeof(double), offset)) status = STORAGE_IO;
+        offset += n * sizeof(double);
+        done += n;
+    }
+    if (stage != NULL) free_data(stage, total < STAGE_DOUBLES ? total : STAGE_DOUBLES);
+    if (status == STORAGE_OK) {
+        storage_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STORAGE_MAGIC, sizeof(header.magic));
+        header.version = STORAGE_VERSION;
+        header.header_size = STORAGE_HEADER_SIZE;
+        header.rows = mat -> rows;
+        header.cols = mat -> cols;
+        header.row_stride = mat -> cols;
+        header.dtype = STORAGE_DTYPE_F64;
+        header.checksum = h;
+        header.header_checksum = storage_checksum(0, &header, offsetof(storage_header, header_checksum));
+        if (write_all(fd, &header, sizeof(header), 0)) status = STORAGE_IO;
+    }
+    if (status == STORAGE_OK && fsync(fd)) status = STORAGE_IO;
+    int saved = errno;
+    if (close(fd) && status == STORAGE_OK) {
+        saved = errno;
+        status = STORAGE_IO;
+    }
+    if (status == STORAGE_OK && rename(temp, path)) {
+        saved = errno;
+        status = STORAGE_IO;
+    }
+    if (status != STORAGE_OK) unlink(temp);
+    free(temp);
+    errno = saved;
+    return status;
+}
+
+/* Checks `header` against the format and a file of `file_size` bytes */
+static storage_status check_header(const storage_header *header, off_t file_size) {
+    if (memcmp(header -> magic, STORAGE_MAGIC, sizeof(header -> magic))) return STORAGE_FORMAT;
+    if (header -> header_checksum
+            != storage_checksum(0, header, offsetof(storage_header, header_checksum))) {
+        return STORAGE_CHECKSUM;
+    }
+    if (header -> version != STORAGE_VERSION || header -> dtype != STORAGE_DTYPE_F64
+            || header -> flags != 0 || !little_endian()) {
+        return STORAGE_FORMAT;
+    }
+    if (header -> header_size < STORAGE_HEADER_SIZE || header -> header_size % ALLOC_ALIGNMENT
+            || header -> rows < 1 || header -> cols < 1 || header -> row_stride < header -> cols
+            || header -> row_stride > (uint64_t)PTRDIFF_MAX / sizeof(double) / header -> rows) {
+        return STORAGE_FORMAT;
+    }
+    uint64_t bytes = header -> rows * header -> row_stride * sizeof(double);
+    if ((uint64_t)file_size < header -> header_size + bytes) return STORAGE_FORMAT;
+    return STORAGE_OK;
+}
+
+/* What deallocate_matrix needs to unmap a loaded file */
+typedef struct mapping {
+    void *addr;
+    size_t length;
+} mapping;
+
+static void unmap_file(void *owner) {
+    mapping *m = (mapping *)owner;
+    munmap(m -> addr, m -> length);
+    free(m);
+}
+
+/*
+ * Reads the matrix stored at `path` into `*mat`. If `use_mmap` is set, the file is mapped
+ * copy-on-write and the matrix points straight into the mapping, so nothing is read until it
+ * is touched and writes to the matrix never reach the file. The mapping lives until the matrix
+ * and all its slices are gone. Otherwise the data is read into memory from alloc_data. The data
+ * checksum is only computed if `verify` is set, which for a mapped file means reading all of it.
+ */
+storage_status matrix_load(matrix **mat, const char *path, int use_mmap, int verify) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return STORAGE_IO;
+    storage_header header;
+    struct stat st;
+    storage_status status = STORAGE_OK;
+    if (fstat(fd, &st) || (st.st_size >= (off_t)sizeof(header)
+                               && read_all(fd, &header, sizeof(header), 0))) {
+        status = STORAGE_IO;
+    } else if (st.st_size < (off_t)sizeof(header)) {
+        status = STORAGE_FORMAT;
+    } else {
+        status = check_header(&header, st.st_size);
+    }
+    if (status != STORAGE_OK) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return status;
+    }
+    int64_t rows = (int64_t)header.rows, cols = (int64_t)header.cols;
+    int64_t row_stride = (int64_t)header.row_stride;
+    size_t total = (size_t)rows * row_stride;
+    matrix *data_mat = NULL;
+    if (use_mmap) {
+        size_t length = header.header_size + total * sizeof(double);
+        void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        mapping *m = (mapping *)malloc(sizeof(mapping));
+        if (addr == MAP_FAILED || m == NULL) {
+            status = addr == MAP_FAILED ? STORAGE_IO : STORAGE_NOMEM;
+            if (addr != MAP_FAILED) munmap(addr, length);
+            free(m);
+        } else {
+            m -> addr = addr; m -> length = length;
+            double *data = (double *)((char *)addr + header.header_size);
+            if (verify && checksum_blocks(0, data, total * sizeof(double)) != header.checksum) {
+                status = STORAGE_CHECKSUM;
+                unmap_file(m);
+            } else if (allocate_matrix_external(&data_mat, data, rows, row_stride, unmap_file, m)) {
+                status = STORAGE_NOMEM;
+                unmap_file(m);
+            }
+        }
+    } else if (allocate_matrix_uninit(&data_mat, rows, row_stride)) {
+        status = STORAGE_NOMEM;
+    } else {
+        uint64_t h = 0;
+        off_t offset = header.header_size;
+        for (size_t done = 0; done < total; done += STAGE_DOUBLES) {
+            size_t n = total - done < STAGE_DOUBLES ? total - done : STAGE_DOUBLES;
+            if (read_all(fd, data_mat -> data + done, n * sizeof(double), offset)) {
+                status = STORAGE_IO;
+                break;
+            }
+            if (verify) h = checksum_blocks(h, data_mat -> data + done, n * sizeof(double));
+            offset += n * sizeof(double);
+        }
+        if (status == STORAGE_OK && verify && h != header.checksum) status = STORAGE_CHECKSUM;
+        if (status != STORAGE_OK) deallocate_matrix(data_mat);
+    }
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    if (status != STORAGE_OK) return status;
+    if (row_stride == cols) {
+        *mat = data_mat;
+        return STORAGE_OK;
+    }
+    /* Padded rows: hand out a view of the first `cols` entries of each, which keeps the data alive */
+    int failed = allocate_matrix_view(mat, data_mat, 0, rows, cols, row_stride, 1);
+    deallocate_matrix(data_mat);
+    return failed ? STORAGE_NOMEM : STORAGE_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "matrix.h"
+#include <stdint.h>
+
+/*
+ * Binary file format of numc.save and numc.load. A file is a 64-byte header followed by the
+ * entries as raw little-endian doubles, row after row, each row starting `row_stride` doubles
+ * after the previous one. The header is exactly as long as the alignment of alloc_data, so
+ * the data of a file mapped into memory (at a page boundary) is as aligned as any other matrix.
+ * Integers in the header are little-endian too.
+ */
+#define STORAGE_MAGIC "NUMCMAT" // followed by a NUL, 8 bytes
+#define STORAGE_VERSION 1
+#define STORAGE_HEADER_SIZE 64
+#define STORAGE_DTYPE_F64 1 // little-endian IEEE 754 double
+
+typedef struct storage_header {
+    char magic[8];
+    uint32_t version; // readers reject files with a version they do not know
+    uint32_t header_size; // offset of the data from the start of the file
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t row_stride; // in doubles, at least cols
+    uint32_t dtype;
+    uint32_t flags; // reserved, 0
+    uint64_t checksum; // storage_checksum of the rows * row_stride doubles of data
+    uint64_t header_checksum; // storage_checksum of the 56 bytes above
+} storage_header;
+
+/* What went wrong in matrix_save or matrix_load, to be turned into an exception by the caller */
+typedef enum storage_status {
+    STORAGE_OK = 0,
+    STORAGE_IO, // a system call failed, errno says why
+    STORAGE_FORMAT, // not a numc file, or a version, dtype or shape this build cannot handle
+    STORAGE_CHECKSUM, // the header or the data does not match its checksum
+    STORAGE_NOMEM
+} storage_status;
+
+uint64_t storage_checksum(uint64_t seed, const void *data, size_t bytes);
+storage_status matrix_save(const char *path, matrix *mat);
+storage_status matrix_load(matrix **mat, const char *path, int use_mmap, int verify);
+
+#endif
@@ -4,6 +4,8 @@ Make sure you follow these naming conventions: https://docs.pytest.org/en/reorga
 for your new tests/classes/python files or else they might be skipped.
 """
 from utils import *
+import array
+import pytest
 
 """
 For each operation, you should write tests to test correctness on matrices of different sizes.
@@ -127,3 +129,539 @@ class TestSetCorrectness:
     def test_set(self):
         # TODO: YOUR CODE HERE
         pass
+
+class TestSliceCorrectness:
+    def test_slice_view(self):
+        lst = [[float(i * 6 + j) for j in range(6)] for i in range(5)]
+        nc1 = nc.Matrix(lst)
+        view = nc1[1:5:2, ::-2]
+        assert(view.shape == (2, 3))
+        assert(nc.to_list(view) == [row[::-2] for row in lst[1:5:2]])
+        assert(nc1[2, 3] == lst[2][3])
+        assert(nc1[1:3, 4].shape == (2, 1))
+
+    def test_slice_shares_data(self):
+        nc1 = nc.Matrix(4, 4)
+        view = nc1[:, 1:3]
+        view[0:2, 0] = [1, 2]
+        view[3, :] = 5
+        assert(nc1.get(0, 1) == 1 and nc1.get(1, 1) == 2)
+        assert(nc1.get(3, 2) == 5 and nc1.get(3, 3) == 0)
+
+    def test_slice_operations(self):
+        dp1, nc1 = rand_dp_nc_matrix(30, 40, rand=True)
+        lst = nc.to_list(nc1)
+        view = nc1[3:27:3, 1::4]
+        dp_view = dp.Matrix([row[1::4] for row in lst[3:27:3]])
+        assert(cmp_dp_nc_matrix(dp_view + dp_view, view + view))
+        assert(cmp_dp_nc_matrix(dp_view - dp_view, view - view))
+        assert(cmp_dp_nc_matrix(-dp_view, -view))
+        assert(cmp_dp_nc_matrix(abs(dp_view), abs(view)))
+        dp2, nc2 = rand_dp_nc_matrix(10, 8, rand=True)
+        assert(cmp_dp_nc_matrix(dp_view * dp2, view * nc2))
+
+class TestBufferCorrectness:
+    def test_export(self):
+        dp1, nc1 = rand_dp_nc_matrix(20, 30, rand=True)
+        arr = np.asarray(nc1)
+        assert(arr.shape == (20, 30))
+        assert(arr[3, 7] == nc1.get(3, 7))
+        arr[3, 7] = 2.5
+        assert(nc1.get(3, 7) == 2.5)
+        view = np.asarray(nc1[2:10:2, ::-3])
+        assert(view.tolist() == nc.to_list(nc1[2:10:2, ::-3]))
+
+    def test_frombuffer(self):
+        arr = np.arange(24, dtype=np.float64)
+        nc1 = nc.Matrix.frombuffer(arr, 4, 6)
+        assert(nc1.shape == (4, 6))
+        assert(nc1.get(3, 5) == 23)
+        nc1.set(0, 0, -1)
+        assert(arr[0] == -1)
+        row = nc1[1:3]
+        del nc1, arr
+        assert(nc.to_list(row) == [[6, 7, 8, 9, 10, 11], [12, 13, 14, 15, 16, 17]])
+
+class TestThreadCorrectness:
+    def test_concurrent_operations(self):
+        import threading
+        dp1, nc1 = rand_dp_nc_matrix(120, 130, rand=True)
+        dp2, nc2 = rand_dp_nc_matrix(130, 110, rand=True)
+        dpr = dp1 * dp2
+        results = [None] * 4
+        def work(i):
+            for _ in range(5):
+                view = nc1[i:i + 10]
+                del view
+            results[i] = nc1 * nc2
+        threads = [threading.Thread(target=work, args=(i,)) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for ncr in results:
+            assert(cmp_dp_nc_matrix(dpr, ncr))
+
+    def test_set_threading(self):
+        defaults = nc.set_threading()
+        try:
+            settings = nc.set_threading(max_threads=1, elements_per_thread=0)
+            assert(settings["max_threads"] == 1 and settings["elements_per_thread"] == 0)
+            assert(settings["flops_per_thread"] == defaults["flops_per_thread"])
+            dp1, nc1 = rand_dp_nc_matrix(300, 200, rand=True, seed=1)
+            dp2, nc2 = rand_dp_nc_matrix(200, 300, rand=True, seed=2)
+            assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+            nc.set_threading(max_threads=0, serial_elements=10 ** 9, flops_per_thread=1)
+            assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+            assert(cmp_dp_nc_matrix(abs(-dp1 - dp1), abs(-nc1 - nc1)))
+            assert(nc.set_threading(pin_workers=True)["pin_workers"])
+            assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+        finally:
+            nc.set_threading(**defaults)
+
+class TestInplaceCorrectness:
+    def test_inplace_operators(self):
+        dp1, nc1 = rand_dp_nc_matrix(30, 30, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(30, 30, rand=True, seed=2)
+        orig = nc1
+        nc1 += nc2
+        assert(nc1 is orig and cmp_dp_nc_matrix(dp1 + dp2, nc1))
+        nc1 -= nc2
+        nc1 -= nc2
+        assert(nc1 is orig and cmp_dp_nc_matrix(dp1 - dp2, nc1))
+        nc1 *= nc2
+        assert(nc1 is orig and cmp_dp_nc_matrix((dp1 - dp2) * dp2, nc1))
+        nc2 **= 3
+        assert(cmp_dp_nc_matrix(dp2 ** 3, nc2))
+
+    def test_out(self):
+        dp1, nc1 = rand_dp_nc_matrix(20, 30, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(20, 30, rand=True, seed=2)
+        dp3, nc3 = rand_dp_nc_matrix(30, 10, rand=True, seed=3)
+        out = nc.Matrix(20, 30)
+        assert(nc.add(nc1, nc2, out=out) is out and cmp_dp_nc_matrix(dp1 + dp2, out))
+        assert(cmp_dp_nc_matrix(dp1 - dp2, nc.sub(nc1, nc2, out=out)))
+        assert(cmp_dp_nc_matrix(dp1 * dp3, nc.mul(nc1, nc3)))
+        assert(cmp_dp_nc_matrix(-dp2, nc.neg(nc2, out=nc2)))
+        assert(cmp_dp_nc_matrix(abs(dp2), nc.abs(nc2, out=nc2)))
+
+class TestMemoryCorrectness:
+    def test_memory_reuse(self):
+        dp1, nc1 = rand_dp_nc_matrix(40, 40, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(40, 40, rand=True, seed=2)
+        (nc1 + nc2).get(0, 0)
+        before = nc.memory_stats()
+        for _ in range(10):
+            assert(cmp_dp_nc_matrix(dp1 + dp2, nc1 + nc2))
+        after = nc.memory_stats()
+        assert(after["hits"] - before["hits"] >= 10)
+        assert(after["bytes_live"] == before["bytes_live"])
+
+    def test_memory_trim(self):
+        dp, ncm = rand_dp_nc_matrix(100, 100, rand=True, seed=1)
+        del ncm
+        assert(nc.memory_stats()["bytes_cached"] > 0)
+        assert(nc.memory_trim() > 0)
+        assert(nc.memory_stats()["bytes_cached"] == 0)
+
+    def test_huge_pages(self):
+        settings = nc.set_huge_pages()
+        try:
+            assert(nc.set_huge_pages(min_bytes=8 << 20, mode="transparent")["min_bytes"] == 8 << 20)
+            nc.memory_trim()
+            before = nc.memory_stats()["huge_mapped"]
+            dp, ncm = rand_dp_nc_matrix(1024, 1024, rand=True, seed=1) # 8 MiB
+            assert(cmp_dp_nc_matrix(dp + dp, ncm + ncm))
+            stats = nc.memory_stats()
+            assert(stats["huge_resident"] is None or stats["huge_resident"] >= 0)
+            assert(nc.set_huge_pages(mode="off")["mode"] == "off")
+            del ncm
+            nc.memory_trim()
+            mapped = nc.memory_stats()["huge_mapped"]
+            assert(cmp_dp_nc_matrix(dp, rand_dp_nc_matrix(1024, 1024, rand=True, seed=1)[1]))
+            assert(nc.memory_stats()["huge_mapped"] == mapped >= before)
+        finally:
+            nc.set_huge_pages(**settings)
+        with pytest.raises(ValueError):
+            nc.set_huge_pages(mode="gigantic")
+
+class TestLazyCorrectness:
+    def setup_method(self):
+        self.was_lazy = nc.set_lazy(True)
+
+    def teardown_method(self):
+        nc.set_lazy(self.was_lazy)
+
+    def test_lazy_fused(self):
+        dp1, nc1 = rand_dp_nc_matrix(100, 80, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(100, 80, rand=True, seed=2)
+        dp3, nc3 = rand_dp_nc_matrix(100, 80, rand=True, seed=3)
+        ncr = abs(nc1 - nc2) + -nc3
+        assert(ncr.shape == (100, 80))
+        assert(cmp_dp_nc_matrix(abs(dp1 - dp2) + -dp3, ncr))
+        # more operations than fit in one fused pass
+        dps, ncs = dp1, nc1
+        for _ in range(20):
+            dps, ncs = dps - dp2, ncs - nc2
+        assert(cmp_dp_nc_matrix(dps, ncs))
+        # strided views as operands, compared with the eager result
+        ncr = abs(nc1[::2, 1:41] - nc2[50:, ::-2])
+        nc.set_lazy(False)
+        assert(nc.to_list(ncr) == nc.to_list(abs(nc1[::2, 1:41] - nc2[50:, ::-2])))
+
+    def test_lazy_mutation(self):
+        dp1, nc1 = rand_dp_nc_matrix(30, 30, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(30, 30, rand=True, seed=2)
+        ncr = nc1 + nc2
+        ncs = -nc1[5:]
+        nc1[0:10] = 5
+        nc1.set(20, 20, 5)
+        nc1[1:3, 1:3] = 7
+        nc1 += nc2
+        assert(cmp_dp_nc_matrix(dp1 + dp2, ncr))
+        assert(ncs.get(0, 0) == -dp1.get(5, 0))
+        ncr = nc2 * nc2
+        ncs = nc2 - nc1
+        nc.mul(nc1, nc2, out=nc2)
+        assert(cmp_dp_nc_matrix(dp2 * dp2, ncr))
+        assert(ncs.get(3, 4) == dp2.get(3, 4) - nc1.get(3, 4))
+
+    def test_lazy_inplace_multiply(self):
+        dp1, nc1 = rand_dp_nc_matrix(20, 20, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(20, 20, rand=True, seed=2)
+        dp3, nc3 = rand_dp_nc_matrix(20, 20, rand=True, seed=3)
+        ncr = nc1 + nc2
+        ncr *= nc3
+        assert(cmp_dp_nc_matrix((dp1 + dp2) * dp3, ncr))
+        ncs = -(nc1 - nc2)
+        ncs *= nc1 + nc3
+        assert(cmp_dp_nc_matrix(-(dp1 - dp2) * (dp1 + dp3), ncs))
+
+class TestGemmCorrectness:
+    def test_gemm(self):
+        dp1, nc1 = rand_dp_nc_matrix(50, 30, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(40, 50, rand=True, seed=2)
+        dp3, nc3 = rand_dp_nc_matrix(30, 40, rand=True, seed=3)
+        a, b, c = np.array(nc.to_list(nc1)), np.array(nc.to_list(nc2)), np.array(nc.to_list(nc3))
+        assert(nc.gemm(nc1, nc2, nc3, 2.0, 0.5, True, True) is nc3)
+        assert(np.allclose(nc.to_list(nc3), 2.0 * a.T @ b.T + 0.5 * c))
+        assert(cmp_dp_nc_matrix(dp2 * dp1, nc.gemm(nc2, nc1)))
+        ncr = nc.gemm(nc1, nc1, alpha=-1.0, trans_a=True)
+        assert(np.allclose(nc.to_list(ncr), -a.T @ a))
+        # the result may be an operand
+        nc.gemm(nc2, nc2, nc2[:, 10:], 1.0, 1.0, trans_b=True)
+        assert(np.allclose(nc.to_list(nc2)[0][:10], b[0][:10]))
+        assert(np.allclose(nc.to_list(nc2[:, 10:]), b[:, 10:] + b @ b.T))
+
+class TestRandomCorrectness:
+    def test_uniform(self):
+        a = np.array(nc.to_list(nc.Matrix(300, 200, rand=True, seed=7, low=-2, high=3)))
+        assert(a.min() >= -2 and a.max() < 3 and abs(a.mean() - 0.5) < 0.05)
+        # the numbers only depend on the seed and the position, not on shape or thread count
+        b = np.array(nc.to_list(nc.Matrix(1, 60000, rand=True, seed=7, low=-2, high=3)))
+        assert(np.array_equal(a.reshape(1, 60000), b))
+        defaults = nc.set_threading()
+        try:
+            nc.set_threading(max_threads=1)
+            c = np.array(nc.to_list(nc.Matrix(300, 200, rand=True, seed=7, low=-2, high=3)))
+            nc.set_threading(max_threads=0, elements_per_thread=1)
+            d = np.array(nc.to_list(nc.Matrix(300, 200, rand=True, seed=7, low=-2, high=3)))
+        finally:
+            nc.set_threading(**defaults)
+        assert(np.array_equal(a, c) and np.array_equal(a, d))
+        e = np.array(nc.to_list(nc.Matrix(300, 200, rand=True, seed=8, low=-2, high=3)))
+        assert(not np.array_equal(a, e))
+
+    def test_normal(self):
+        a = np.array(nc.to_list(nc.Matrix(400, 250, rand=True, seed=3, normal=True, mean=1, std=2)))
+        assert(abs(a.mean() - 1) < 0.05 and abs(a.std() - 2) < 0.05)
+        b = np.array(nc.to_list(nc.Matrix(400, 250, rand=True, seed=3, normal=True, mean=1, std=2)))
+        assert(np.array_equal(a, b))
+        try:
+            nc.Matrix(2, 2, rand=True, normal=True, std=-1)
+            assert(False)
+        except TypeError:
+            pass
+
+class TestConstructionCorrectness:
+    def test_sequences_and_buffers(self):
+        dp1, nc1 = rand_dp_nc_matrix(30, 40, rand=True, seed=1)
+        lst = nc.to_list(nc1)
+        flat = [x for row in lst for x in row]
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix(lst)))
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix([tuple(row) for row in lst])))
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix(30, 40, tuple(flat))))
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix(30, 40, array.array('d', flat))))
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix([array.array('d', row) for row in lst])))
+        assert(cmp_dp_nc_matrix(dp1, nc.Matrix(np.array(lst))))
+        # strided buffers, integer items and other numeric formats
+        assert(nc.to_list(nc.Matrix(np.array(lst)[::-1, ::2])) == [row[::2] for row in lst[::-1]])
+        assert(nc.to_list(nc.Matrix(2, 3, range(6))) == [[0, 1, 2], [3, 4, 5]])
+        assert(nc.to_list(nc.Matrix(2, 2, b"\x01\x02\x03\xff")) == [[1, 2], [3, 255]])
+        assert(nc.to_list(nc.Matrix([array.array('i', [-1, 2]), (True, 4.5)])) == [[-1, 2], [1, 4.5]])
+        for bad in ([[1, 2], [3]], [1, 2], [[1, "x"]], [[]]):
+            try:
+                nc.Matrix(bad)
+                assert(False)
+            except TypeError:
+                pass
+
+    def test_large_shapes(self):
+        # shapes whose size overflows are refused before anything is allocated
+        for rows, cols in ((1 << 40, 1 << 40), (1 << 62, 4), (2, 1 << 62)):
+            try:
+                nc.Matrix(rows, cols)
+                assert(False)
+            except ValueError:
+                pass
+        for rows, cols in ((1 << 32, 1 << 32), (1 << 31, 2)):
+            try:
+                nc.Matrix(rows, cols, [1.0, 2.0])
+                assert(False)
+            except TypeError:
+                pass
+            try:
+                nc.Matrix.frombuffer(array.array('d', [1.0, 2.0]), rows, cols)
+                assert(False)
+            except ValueError:
+                pass
+        mat = nc.Matrix(2, 2)
+        try:
+            mat.get(1 << 32, 0)
+            assert(False)
+        except IndexError:
+            pass
+
+class TestReprCorrectness:
+    def test_repr(self):
+        dp1, nc1 = rand_dp_nc_matrix(20, 30, rand=True, seed=1)
+        assert(repr(nc1) == repr(nc.to_list(nc1)))
+        defaults = nc.set_printoptions()
+        try:
+            nc.set_printoptions(threshold=100, edgeitems=2)
+            lst = nc.to_list(nc1)
+            edge = lambda row: ", ".join(repr(x) for x in row[:2]) + ", ..., " + ", ".join(repr(x) for x in row[-2:])
+            expected = "[[" + edge(lst[0]) + "], [" + edge(lst[1]) + "], ..., [" + edge(lst[-2]) + "], [" + edge(lst[-1]) + "]]"
+            assert(repr(nc1) == expected)
+            assert(repr(nc1[:5, :20]) == repr(nc.to_list(nc1[:5, :20])))
+        finally:
+            nc.set_printoptions(**defaults)
+
+    def test_rows(self):
+        dp1, nc1 = rand_dp_nc_matrix(20, 30, rand=True, seed=1)
+        rows = nc1.rows()
+        assert(next(rows) == nc.to_list(nc1)[0])
+        assert([nc.to_list(nc1)[0]] + list(rows) == nc.to_list(nc1))
+        assert(list(nc1[::-2, 3].rows()) == nc.to_list(nc1[::-2, 3]))
+
+class TestStorageCorrectness:
+    def test_save_load(self, tmp_path):
+        path = str(tmp_path / "m.numc")
+        dp1, nc1 = rand_dp_nc_matrix(300, 200, rand=True, seed=1)
+        nc.save(path, nc1)
+        for mmap in (True, False):
+            loaded = nc.load(path, mmap=mmap)
+            assert(loaded.shape == nc1.shape)
+            assert(nc.to_list(loaded) == nc.to_list(nc1))
+        nc.save(path, nc1[::-1, ::3])
+        assert(nc.to_list(nc.load(path, verify=True)) == nc.to_list(nc1[::-1, ::3]))
+
+    def test_mmap_lifetime(self, tmp_path):
+        path = str(tmp_path / "m.numc")
+        dp1, nc1 = rand_dp_nc_matrix(50, 40, rand=True, seed=2)
+        nc.save(path, nc1)
+        loaded = nc.load(path)
+        piece = loaded[10:20, 5:9]
+        del loaded
+        assert(nc.to_list(piece) == nc.to_list(nc1[10:20, 5:9]))
+        piece[0, 0] = 42.0
+        assert(nc.load(path)[10][5] == nc1[10][5])
+
+    def test_save_over_loaded(self, tmp_path):
+        path = str(tmp_path / "m.numc")
+        dp1, nc1 = rand_dp_nc_matrix(300, 200, rand=True, seed=4)
+        dp2, nc2 = rand_dp_nc_matrix(100, 100, rand=True, seed=5)
+        nc.save(path, nc1)
+        loaded = nc.load(path)
+        nc.save(path, loaded)
+        assert(nc.to_list(loaded) == nc.to_list(nc1))
+        nc.save(path, nc2)
+        assert(nc.to_list(loaded) == nc.to_list(nc1))
+        assert(nc.to_list(nc.load(path, verify=True)) == nc.to_list(nc2))
+        assert([p.name for p in tmp_path.iterdir()] == ["m.numc"])
+
+    def test_corrupted(self, tmp_path):
+        path = tmp_path / "m.numc"
+        dp1, nc1 = rand_dp_nc_matrix(50, 40, rand=True, seed=3)
+        nc.save(str(path), nc1)
+        data = bytearray(path.read_bytes())
+        data[64 + 8 * 100] ^= 1
+        path.write_bytes(bytes(data))
+        with pytest.raises(ValueError):
+            nc.load(str(path), mmap=False)
+        with pytest.raises(ValueError):
+            nc.load(str(path), verify=True)
+        path.write_bytes(b"not a matrix")
+        with pytest.raises(ValueError):
+            nc.load(str(path))
+        with pytest.raises(OSError):
+            nc.load(str(tmp_path / "missing.numc"))
+
+class TestTiledCorrectness:
+    def test_tiled_mul_add(self, tmp_path):
+        defaults = nc.set_tile_cache()
+        try:
+            # Room for six 32 x 32 tiles, so most tiles go through the file
+            nc.set_tile_cache(budget=6 * 32 * 32 * 8)
+            a = nc.TiledMatrix(str(tmp_path / "a"), 100, 70, tile=32)
+            b = nc.TiledMatrix(str(tmp_path / "b"), 70, 90, tile=32)
+            c = nc.TiledMatrix(str(tmp_path / "c"), 100, 90, tile=32)
+            dp1, nc1 = rand_dp_nc_matrix(100, 70, rand=True, seed=1)
+            dp2, nc2 = rand_dp_nc_matrix(70, 90, rand=True, seed=2)
+            a.write(0, 0, nc1)
+            b.write(0, 0, nc2)
+            nc.tiled_mul(a, b, c)
+            assert(cmp_dp_nc_matrix(dp1 * dp2, c.read(0, 0, 100, 90)))
+            lst = nc.to_list(nc1 * nc2)
+            assert(cmp_dp_nc_matrix(dp.Matrix([row[5:85] for row in lst[10:40]]), c.read(10, 5, 30, 80)))
+            nc.tiled_add(c, c, c)
+            stats = nc.set_tile_cache()
+            assert(stats["writes"] > 0 and stats["reads"] > 0)
+            c.close()
+            c = nc.TiledMatrix(str(tmp_path / "c"))
+            assert(c.shape == (100, 90) and c.tile == 32)
+            assert(cmp_dp_nc_matrix(dp1 * dp2 + dp1 * dp2, c.read(0, 0, 100, 90)))
+            with pytest.raises(ValueError):
+                nc.tiled_mul(a, a, c)
+            with pytest.raises(IndexError):
+                c.read(90, 0, 20, 10)
+            c.close()
+            with pytest.raises(ValueError):
+                c.read(0, 0, 1, 1)
+        finally:
+            nc.set_tile_cache(budget=defaults["budget"])
+
+class TestStatsCorrectness:
+    def test_stats(self):
+        was_counting = nc.set_stats(True)
+        was_lazy = nc.set_lazy(False)
+        try:
+            nc.reset_stats()
+            dp1, nc1 = rand_dp_nc_matrix(100, 60, rand=True, seed=1)
+            dp2, nc2 = rand_dp_nc_matrix(60, 80, rand=True, seed=2)
+            assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+            assert(cmp_dp_nc_matrix(dp1 + dp1, nc1 + nc1))
+            stats = nc.stats()
+            gemm = stats["gemm"]["<=16K"]
+            assert(gemm["calls"] == 1 and gemm["flops"] == 2 * 100 * 60 * 80)
+            assert(gemm["bytes_written"] == 100 * 80 * 8 and gemm["max_ns"] <= gemm["ns"])
+            add = stats["add"]["<=16K"]
+            assert(add["calls"] == 1 and add["bytes_read"] == 2 * 6000 * 8)
+            method = stats["Matrix.__mul__"]["<=16K"]
+            assert(method["calls"] == 1 and method["alloc_bytes"] >= 100 * 80 * 8)
+            nc.reset_stats()
+            assert(nc.stats() == {})
+            nc.set_stats(False)
+            nc1 + nc1
+            assert(nc.stats() == {})
+        finally:
+            nc.set_stats(was_counting)
+            nc.set_lazy(was_lazy)
+
+class TestTraceCorrectness:
+    def test_trace(self, tmp_path):
+        import json
+        path = str(tmp_path / "trace.json")
+        dp1, nc1 = rand_dp_nc_matrix(200, 150, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(150, 100, rand=True, seed=2)
+        nc.trace_start()
+        assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+        written = nc.trace_stop(path)
+        with open(path) as f:
+            trace = json.load(f)
+        spans = [e for e in trace["traceEvents"] if e["ph"] == "X"]
+        assert(written == len(spans))
+        names = set(e["name"] for e in spans)
+        assert({"Matrix.__mul__", "gemm", "gemm block", "allocate_matrix"} <= names)
+        gemm = next(e for e in spans if e["name"] == "gemm")
+        assert(all(gemm["ts"] <= e["ts"] and e["ts"] + e["dur"] <= gemm["ts"] + gemm["dur"] + 1e-3
+                   for e in spans if e["name"] == "gemm block" and e["tid"] == gemm["tid"]))
+        with pytest.raises(ValueError):
+            nc.trace_stop(path)
+
+
+class TestNumaCorrectness:
+    def test_numa(self):
+        settings = nc.set_numa_policy()
+        assert(settings["policy"] == "partitioned" and settings["nodes"] >= 1)
+        try:
+            for policy in ["local", "interleave", "partitioned"]:
+                assert(nc.set_numa_policy(policy)["policy"] == policy)
+                dp, m = rand_dp_nc_matrix(512, 512, rand=True, seed=0)
+                zeros = nc.Matrix(512, 512)
+                assert(cmp_dp_nc_matrix(dp + dp, m + m + zeros))
+                placed = nc.numa_node_bytes(m)
+                assert(set(placed) <= set(range(64)))
+                assert(sum(placed.values()) >= 512 * 512 * 8)
+            assert(nc.set_numa_policy(bind=True)["bind"])
+            assert(not nc.set_numa_policy(bind=False)["bind"])
+        finally:
+            nc.set_numa_policy(settings["policy"], bind=settings["bind"])
+        with pytest.raises(ValueError):
+            nc.set_numa_policy("scatter")
+        with pytest.raises(TypeError):
+            nc.numa_node_bytes([1])
+
+
+class TestAsyncCorrectness:
+    def test_submit(self):
+        dp1, nc1 = rand_dp_nc_matrix(60, 40, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(40, 60, rand=True, seed=2)
+        dp3, nc3 = rand_dp_nc_matrix(60, 60, rand=True, seed=3)
+        prod = nc.submit("mul", nc1, nc2)
+        other = nc.submit(nc.neg, nc3)
+        total = nc.submit(nc.add, prod, other)
+        power = nc.submit("pow", total, 2)
+        diff = nc.submit("sub", nc.submit("abs", power), nc3[:, :])
+        assert(cmp_dp_nc_matrix(abs((dp1 * dp2 + -dp3) ** 2) - dp3, diff.result()))
+        assert(cmp_dp_nc_matrix(dp1 * dp2, prod.result()))
+        assert(total.done() and nc.set_executor()["pending"] == 0)
+        # shapes and operands are checked on submission
+        for args, error in [(("mul", nc1, nc1), TypeError), (("pow", nc1, 2), TypeError),
+                            (("add", nc1, 1), TypeError), (("add", nc1), TypeError),
+                            (("dot", nc1, nc2), ValueError)]:
+            with pytest.raises(error):
+                nc.submit(*args)
+
+    def test_writes_wait(self):
+        dp1, nc1 = rand_dp_nc_matrix(300, 300, rand=True, seed=1)
+        future = nc.submit("mul", nc1, nc1)
+        nc1[0:150] = 2.0
+        nc1.set(299, 299, 2.0)
+        nc1 += nc1
+        assert(cmp_dp_nc_matrix(dp1 * dp1, future.result(timeout=60)))
+        result = future.result()
+        expected = -result.get(0, 0)
+        future = nc.submit("neg", result)
+        result[0, 0] = 1.0
+        assert(future.result().get(0, 0) == expected)
+
+    def test_await(self):
+        import asyncio
+        dp1, nc1 = rand_dp_nc_matrix(50, 50, rand=True, seed=1)
+        async def both():
+            return await asyncio.gather(nc.submit("abs", nc1), nc.submit("mul", nc1, nc1))
+        absolute, product = asyncio.run(both())
+        assert(cmp_dp_nc_matrix(abs(dp1), absolute))
+        assert(cmp_dp_nc_matrix(dp1 * dp1, product))
+
+    def test_set_executor(self):
+        threads = nc.set_executor()["threads"]
+        try:
+            assert(nc.set_executor(threads=1)["threads"] == 1)
+            futures = [nc.submit("add", nc.Matrix(20, 20, float(i)), nc.Matrix(20, 20, 1.0)) for i in range(10)]
+            assert([f.result().get(19, 19) for f in futures] == [i + 1.0 for i in range(10)])
+        finally:
+            nc.set_executor(threads=threads)
+        with pytest.raises(ValueError):
+            nc.set_executor(threads=0)
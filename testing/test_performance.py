@@ -4,151 +4,246 @@ Make sure you follow these naming conventions: https://docs.pytest.org/en/reorga
 for your new tests/classes/python files or else they might be skipped.
 """
 from utils import *
-import time
+import json, math, os, platform, statistics, time
+import pytest
 
 """
-- We will test you on your performance on add, sub, abs, neg, mul, and pow, so make sure to test these
-yourself! We will also test your implementation on matrices on different sizes. It is normal if
-your smaller matrices are about the same speed as the naive implementation or even slower.
-- Use time.time(), NOT time.perf_counter() to time your program!
-- DO NOT count the time for initializing matrices into your performance time. Only count the
-time the part where operations are carried out.
-- Please also check for correctness while testing for performance!
-- We provide the structure for test_small_add. All other tests should have similar structures
+Regression suite. Every number method is timed over a set of shapes and compared against the
+baseline in perf_baseline.json, recorded on the machine the suite normally runs on. Each case
+does a few warm-up runs and then takes repeated perf_counter_ns samples until it has enough of
+them or has used its time budget. The comparison uses a 95% confidence interval for the median
+that makes no assumption about the distribution of the samples. Speed also drifts between runs
+on a shared machine, so the baseline keeps the last RECORDED_RUNS recordings of each case and
+the noise they show: the highest end of their intervals above their median, or NOISE_MADS
+median absolute deviations if that is wider. A case only fails when even the low end of its
+interval is more than the tolerance above the baseline median plus that noise. Correctness is
+checked against dumbpy for every case as well.
+
+The baseline stores the tolerance, "tolerance" (0.15, i.e. 15% slower) for every op and
+"tolerances" for ops that need their own. NUMC_PERF_TOLERANCE overrides both.
+NUMC_PERF_UPDATE=1 adds a recording of the cases that run instead of comparing, replacing the
+oldest one; record a new baseline a few times, at different times of day if the machine is
+shared. A baseline recorded on a different machine (CPU model, core count or kernel variant)
+is not compared against, unless NUMC_PERF_STRICT=1.
 """
-class TestAddPerformance:
-    def test_small_add(self):
-        # Initialize matrices using rand_dp_nc_matrix
-        # TODO: YOUR CODE HERE
-
-        nc_start = time.time()
-        # Carry out numc matrix operations
-        # TODO: YOUR CODE HERE
-        nc_end = time.time()
-
-        dp_start = time.time()
-        # Carry out dumbpy matrix operations
-        # TODO: YOUR CODE HERE
-        dp_end = time.time()
-
-        # Check for correctness using cmp_dp_nc_matrix and calculate speedup
-        # TODO: YOUR CODE HERE
-        pass
-
-    def test_medium_add(self):
-        dp1, nc1 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp2, nc2 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp_start = time.time()
-        dpr = dp1 + dp2
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = nc1 + nc2
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nAdd Speedup: {}".format(speedup))
-
-    def test_large_add(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-class TestSubPerformance:
-    def test_small_sub(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-    def test_medium_sub(self):
-        dp1, nc1 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp2, nc2 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp_start = time.time()
-        dpr = dp1 - dp2
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = nc1 - nc2
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nSub Speedup: {}".format(speedup))
-
-    def test_large_sub(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-class TestAbsPerformance:
-    def test_small_abs(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-    def test_medium_abs(self):
-        dp1, nc1 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp_start = time.time()
-        dpr = abs(dp1)
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = abs(nc1)
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nAbs Speedup: {}".format(speedup))
-
-    def test_large_abs(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-class TestNegPerformance:
-    def test_small_neg(self):
-        # TODO: YOUR CODE HERE
-        pass
+BASELINE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "perf_baseline.json")
+WARMUP_RUNS = 3
+MIN_SAMPLES = 15
+MAX_SAMPLES = 500
+SAMPLE_BUDGET_NS = 200 * 1000 * 1000
+NOISE_MADS = 3
+RECORDED_RUNS = 5
+
+def sample_ns(fn):
+    for _ in range(WARMUP_RUNS):
+        fn()
+    samples = []
+    start = time.perf_counter_ns()
+    while len(samples) < MIN_SAMPLES or (len(samples) < MAX_SAMPLES
+                                         and time.perf_counter_ns() - start < SAMPLE_BUDGET_NS):
+        t0 = time.perf_counter_ns()
+        fn()
+        samples.append(time.perf_counter_ns() - t0)
+    return sorted(samples)
 
-    def test_medium_neg(self):
-        dp1, nc1 = rand_dp_nc_matrix(8000, 12000, rand=True)
-        dp_start = time.time()
-        dpr = -dp1
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = -nc1
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nNeg Speedup: {}".format(speedup))
-
-    def test_large_neg(self):
-        # TODO: YOUR CODE HERE
-        pass
-
-class TestMulPerformance:
-    def test_small_mul(self):
-        # TODO: YOUR CODE HERE
-        pass
+"""
+Returns the median of the sorted samples and a confidence interval for it from two order
+statistics: the number of samples below the true median is Binomial(n, 1/2), which fixes how
+likely the true median is to lie between the j-th smallest and the j-th largest sample.
+"""
+def median_ci(samples, confidence=0.95):
+    n = len(samples)
+    median = statistics.median(samples)
+    j, cdf = 0, 0.0
+    while j < n // 2:
+        cdf += math.comb(n, j) / 2 ** n
+        if cdf > (1 - confidence) / 2:
+            break
+        j += 1
+    j = max(j - 1, 0)
+    return median, samples[j], samples[n - 1 - j]
+
+def median_abs_deviation(samples, median):
+    return statistics.median(abs(s - median) for s in samples)
 
-    def test_medium_mul(self):
-        # TODO: YOUR CODE HERE
+"""
+Returns the median of the recorded runs of a case and how far above it the case was measured
+while recording: the highest end of a run's interval, or NOISE_MADS median absolute deviations
+of the noisiest run if that is further.
+"""
+def baseline_noise(runs):
+    reference = statistics.median(run["median_ns"] for run in runs)
+    high = max(run["ci_ns"][1] for run in runs)
+    mad = max(run["mad_ns"] for run in runs)
+    return reference, max(high - reference, NOISE_MADS * mad, 0)
+
+def machine_info():
+    model = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            model = next((line.split(":", 1)[1].strip() for line in f if line.startswith("model name")), model)
+    except OSError:
         pass
+    return {"cpu": model, "cores": os.cpu_count(), "backend": nc.backend()}
+
+def load_baseline():
+    try:
+        with open(BASELINE_PATH) as f:
+            return json.load(f)
+    except FileNotFoundError:
+        return {"tolerance": 0.15, "tolerances": {}, "machine": None, "cases": {}}
+
+def save_baseline(baseline):
+    with open(BASELINE_PATH, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+ELEMENTWISE_SHAPES = {"small": (8, 8), "medium": (256, 256), "large": (1024, 1024),
+                      "odd": (257, 255), "skinny": (16384, 16), "fat": (16, 16384)}
+MUL_SHAPES = {"small": (8, 8, 8), "medium": (128, 128, 128), "large": (512, 512, 512),
+              "odd": (257, 259, 255), "skinny": (4096, 16, 16), "fat": (16, 4096, 16)}
+POW_SHAPES = {"small": (8, 5), "medium": (128, 3), "large": (256, 3), "odd": (97, 4)}
+
+def iadd(a, b):
+    a += b
+    return a
+
+def isub(a, b):
+    a -= b
+    return a
+
+def imul(a, b):
+    a *= b
+    return a
 
-    def test_large_mul(self):
-        dp1, nc1 = rand_dp_nc_matrix(2000, 3000, rand=True)
-        dp2, nc2 = rand_dp_nc_matrix(3000, 4000, rand=True)
-        dp_start = time.time()
-        dpr = dp1 * dp2
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = nc1 * nc2
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nMul Speedup: {}".format(speedup))
-
-class TestPowPerformance:
-    def test_small_pow(self):
-        # TODO: YOUR CODE HERE
-        pass
+"""
+Each case: how to build its operands (rows, cols, seed) from a shape, and the operation on them.
+The in-place operators keep accumulating into their left operand across samples, which does not
+change their speed.
+"""
+def cases():
+    for name, dims in ELEMENTWISE_SHAPES.items():
+        rows, cols = dims
+        two = [(rows, cols, 1), (rows, cols, 2)]
+        yield "add", name, two, lambda a, b: a + b
+        yield "sub", name, two, lambda a, b: a - b
+        yield "neg", name, two[:1], lambda a: -a
+        yield "abs", name, two[:1], lambda a: abs(a)
+        yield "iadd", name, two, iadd
+        yield "isub", name, two, isub
+    for name, (m, k, n) in MUL_SHAPES.items():
+        yield "mul", name, [(m, k, 1), (k, n, 2)], lambda a, b: a * b
+        if m == k == n:
+            yield "imul", name, [(m, k, 1), (k, n, 2)], imul
+    for name, (size, power) in POW_SHAPES.items():
+        yield "pow", name, [(size, size, 1)], lambda a, power=power: a ** power
+
+CASES = list(cases())
+
+class TestRegression:
+    @pytest.fixture(autouse=True)
+    def eager(self):
+        was_lazy = nc.set_lazy(False)
+        yield
+        nc.set_lazy(was_lazy)
+
+    @pytest.mark.parametrize("op, shape, operands, fn", CASES,
+                             ids=["{}-{}".format(c[0], c[1]) for c in CASES])
+    def test_regression(self, op, shape, operands, fn):
+        key = "{}/{}".format(op, shape)
+        mats = [rand_dp_nc_matrix(rows, cols, rand=True, seed=seed) for rows, cols, seed in operands]
+        dps = [m[0] for m in mats]
+        ncs = [m[1] for m in mats]
+        if not op.startswith("i"):
+            assert(cmp_dp_nc_matrix(fn(*dps), fn(*ncs)))
+        else:
+            copies = [rand_dp_nc_matrix(rows, cols, rand=True, seed=seed)[1] for rows, cols, seed in operands]
+            assert(cmp_dp_nc_matrix(fn(*dps), fn(*copies)))
+        samples = sample_ns(lambda: fn(*ncs))
+        median, low, high = median_ci(samples)
+        print("\n{}: median {:.1f}us, 95% CI [{:.1f}, {:.1f}]us".format(key, median / 1e3, low / 1e3, high / 1e3))
+        baseline = load_baseline()
+        if os.environ.get("NUMC_PERF_UPDATE") == "1":
+            if baseline["machine"] != machine_info():
+                baseline["cases"] = {}
+            baseline["machine"] = machine_info()
+            runs = baseline["cases"].get(key, {}).get("runs", [])[1 - RECORDED_RUNS:]
+            runs.append({"median_ns": median, "ci_ns": [low, high], "mad_ns": median_abs_deviation(samples, median)})
+            baseline["cases"][key] = {"runs": runs}
+            save_baseline(baseline)
+            return
+        if key not in baseline["cases"]:
+            pytest.skip("no baseline for {}; record one with NUMC_PERF_UPDATE=1".format(key))
+        if baseline["machine"] != machine_info() and os.environ.get("NUMC_PERF_STRICT") != "1":
+            pytest.skip("baseline was recorded on {}".format(baseline["machine"]))
+        tolerance = baseline.get("tolerances", {}).get(op, baseline["tolerance"])
+        tolerance = float(os.environ.get("NUMC_PERF_TOLERANCE", tolerance))
+        reference, noise = baseline_noise(baseline["cases"][key]["runs"])
+        limit = (reference + noise) * (1 + tolerance)
+        assert low <= limit, ("{} regressed: 95% CI of the median [{:.1f}, {:.1f}]us, baseline {:.1f}us "
+                              "+ {:.1f}us noise + {:.0%}").format(
+            key, low / 1e3, high / 1e3, reference / 1e3, noise / 1e3, tolerance)
 
-    def test_medium_pow(self):
-        dp, nc = rand_dp_nc_matrix(53,53, rand=True)
-        dp_start = time.time()
-        dpr = dp ** 89
-        dp_end = time.time()
-        nc_start = time.time()
-        ncr = nc ** 89
-        nc_end = time.time()
-        speedup = (dp_end - dp_start) / (nc_end - nc_start)
-        print("\nPow Speedup: {}".format(speedup))
-
-    def test_large_pow(self):
-        # TODO: YOUR CODE HERE
-        pass
+"""
+The thresholds of numc.set_threading decide when a kernel call runs on one thread and when it
+wakes the workers of the thread pool. This sweeps the sizes around the default thresholds and
+compares the cost model with always using every core, which wakes the workers for every call.
+Up to THREADING_GATED the defaults must be no slower: a size fails when the low end of the
+interval for the median with the defaults is more than THREADING_TOLERANCE above the high end
+with every core. The larger sizes are printed, which is what to look at when tuning the
+thresholds for a new machine.
+"""
+THREADING_SIZES = [2, 4, 8, 16, 32, 64, 128, 256]
+THREADING_GATED = 16
+THREADING_TOLERANCE = 0.15
+
+class TestThreadingPerformance:
+    @pytest.fixture(autouse=True)
+    def eager(self):
+        was_lazy = nc.set_lazy(False)
+        yield
+        nc.set_lazy(was_lazy)
+
+    """
+    Samples `fn` under each of the two `settings` of numc.set_threading in turn, so that the
+    machine getting slower or faster during the test affects both alike
+    """
+    def sample_pair_ns(self, fn, settings):
+        samples = [[], []]
+        for config in settings:
+            nc.set_threading(**config)
+            for _ in range(WARMUP_RUNS):
+                fn()
+        start = time.perf_counter_ns()
+        while len(samples[0]) < MIN_SAMPLES or (len(samples[0]) < MAX_SAMPLES
+                                                and time.perf_counter_ns() - start < SAMPLE_BUDGET_NS):
+            for config, out in zip(settings, samples):
+                nc.set_threading(**config)
+                t0 = time.perf_counter_ns()
+                fn()
+                out.append(time.perf_counter_ns() - t0)
+        return [median_ci(sorted(out)) for out in samples]
+
+    @pytest.mark.parametrize("size", THREADING_SIZES)
+    def test_small_threading(self, size):
+        dp1, nc1 = rand_dp_nc_matrix(size, size, rand=True, seed=1)
+        dp2, nc2 = rand_dp_nc_matrix(size, size, rand=True, seed=2)
+        defaults = nc.set_threading()
+        tuned = {key: value for key, value in defaults.items() if key != "pin_workers"}
+        every_core = dict(tuned, serial_elements=0, elements_per_thread=0, flops_per_thread=0)
+        try:
+            for config in [every_core, tuned]:
+                nc.set_threading(**config)
+                assert(cmp_dp_nc_matrix(dp1 + dp2, nc1 + nc2))
+                assert(cmp_dp_nc_matrix(dp1 * dp2, nc1 * nc2))
+            add = self.sample_pair_ns(lambda: nc1 + nc2, [tuned, every_core])
+            mul = self.sample_pair_ns(lambda: nc1 * nc2, [tuned, every_core])
+        finally:
+            nc.set_threading(**defaults)
+        for op, ((median, low, high), (core_median, core_low, core_high)) in [("add", add), ("mul", mul)]:
+            print("\n{0}x{0} {1}: {2:.2f}us, 95% CI [{3:.2f}, {4:.2f}]us (every core {5:.2f}us, [{6:.2f}, {7:.2f}]us)"
+                  .format(size, op, median / 1e3, low / 1e3, high / 1e3, core_median / 1e3, core_low / 1e3,
+                          core_high / 1e3))
+            if size <= THREADING_GATED:
+                assert low <= core_high * (1 + THREADING_TOLERANCE), \
+                    "{0}x{0} {1} is slower with the default thresholds than on every core".format(size, op)
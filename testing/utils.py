@@ -16,14 +16,15 @@ num_samples = 1000
 decimal_places = 6
 
 """
-Returns a dumbpy matrix and a numc matrix with the same data
+Returns a dumbpy matrix and a numc matrix with the same data. dumbpy draws random matrices
+from srand/rand, so numc is asked for its matching libc generator instead of the default one.
 """
 def rand_dp_nc_matrix(*args, **kwargs):
     dp_mat, nc_mat = None, None
     if len(kwargs) == 0:
         dp_mat, nc_mat = dp.Matrix(*args), nc.Matrix(*args)
     else:
-        dp_mat, nc_mat = dp.Matrix(*args, **kwargs), nc.Matrix(*args, **kwargs)
+        dp_mat, nc_mat = dp.Matrix(*args, **kwargs), nc.Matrix(*args, rng="libc", **kwargs)
     return dp_mat, nc_mat
 
 """
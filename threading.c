@@ -0,0 +1,90 @@
+#include "threading.h"
+#include "pool.h"
+#include <stdlib.h>
+
+/*
+ * Defaults, each overridden by an environment variable of the same name read on first use
+ * (NUMC_MAX_THREADS, ...) and afterwards by set_threading. Below 32768 entries an element-wise
+ * operation is over in about the time it takes to wake the pool's workers; a 64 x 64 x 64 product
+ * is about the smallest that gains from a second thread.
+ */
+#define NUMC_MAX_THREADS 0
+#define NUMC_SERIAL_ELEMENTS 16
+#define NUMC_ELEMENTS_PER_THREAD 32768
+#define NUMC_FLOPS_PER_THREAD 262144
+
+static threading_config config;
+static int initialized = 0;
+
+/* Returns the environment variable `name` as a number, or `fallback` if it is not set */
+static long env_long(const char *name, long fallback) {
+    const char *val = getenv(name);
+    return val != NULL ? strtol(val, NULL, 10) : fallback;
+}
+
+static void init_config(void) {
+    if (initialized) return;
+    config.max_threads = (int)env_long("NUMC_MAX_THREADS", NUMC_MAX_THREADS);
+    config.serial_elements = env_long("NUMC_SERIAL_ELEMENTS", NUMC_SERIAL_ELEMENTS);
+    config.elements_per_thread = env_long("NUMC_ELEMENTS_PER_THREAD", NUMC_ELEMENTS_PER_THREAD);
+    config.flops_per_thread = env_long("NUMC_FLOPS_PER_THREAD", NUMC_FLOPS_PER_THREAD);
+    config.pin_workers = (int)env_long("NUMC_PIN_THREADS", 0) != 0;
+    initialized = 1;
+}
+
+/* Returns the plan for `work` units of work when every thread should get at least `per_thread` */
+static exec_plan plan(double work, long per_thread) {
+    init_config();
+    int cores = pool_cores();
+    int max = config.max_threads > 0 && config.max_threads < cores ? config.max_threads : cores;
+    double threads = per_thread > 0 ? work / per_thread : max;
+    exec_plan p;
+    p.threads = threads < 2 ? 1 : threads > max ? max : (int)threads;
+    p.mode = p.threads > 1 ? EXEC_PARALLEL : EXEC_SIMD;
+    p.kernels = active_kernels();
+    return p;
+}
+
+/* Plans an element-wise operation over `entries` entries */
+exec_plan plan_elementwise(long entries) {
+    init_config();
+    exec_plan p = plan((double)entries, config.elements_per_thread);
+    if (entries < config.serial_elements) {
+        p.mode = EXEC_SERIAL;
+        p.kernels = scalar_kernel_table();
+    }
+    return p;
+}
+
+/* Plans a matrix multiplication doing `flops` multiply-adds */
+exec_plan plan_gemm(double flops) {
+    init_config();
+    return plan(flops, config.flops_per_thread);
+}
+
+/* Copies the current settings to `out` */
+void get_threading(threading_config *out) {
+    init_config();
+    *out = config;
+}
+
+/*
+ * Replaces the current settings; fields that are negative keep their current value. Returns 0
+ * upon success, or -1 with errno set if the workers could not be pinned, which leaves them
+ * unpinned.
+ */
+int set_threading(const threading_config *in) {
+    init_config();
+    if (in -> max_threads >= 0) config.max_threads = in -> max_threads;
+    if (in -> serial_elements >= 0) config.serial_elements = in -> serial_elements;
+    if (in -> elements_per_thread >= 0) config.elements_per_thread = in -> elements_per_thread;
+    if (in -> flops_per_thread >= 0) config.flops_per_thread = in -> flops_per_thread;
+    if (in -> pin_workers >= 0) {
+        config.pin_workers = in -> pin_workers != 0;
+        if (pool_set_pinning(config.pin_workers)) {
+            config.pin_workers = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+#include "kernels.h"
+
+/*
+ * Cost model deciding how each kernel call runs. Waking the workers of the pool costs
+ * microseconds, which is more than a small matrix takes to process, so the work of a call
+ * (entries for the element-wise operations, multiply-adds for the multiplication) decides
+ * between running the scalar kernels inline, running the SIMD kernels on the calling thread,
+ * or splitting the work over as many threads as it can keep busy.
+ */
+typedef struct threading_config {
+    int max_threads; // most threads a single call may use; 0 means one per core
+    long serial_elements; // element-wise calls on fewer entries use the scalar kernels
+    long elements_per_thread; // element-wise calls get one thread per this many entries
+    long flops_per_thread; // multiplications get one thread per this many multiply-adds
+    int pin_workers; // nonzero if each worker of the pool is pinned to a core of its own
+} threading_config;
+
+typedef enum exec_mode { EXEC_SERIAL, EXEC_SIMD, EXEC_PARALLEL } exec_mode;
+
+/* How one kernel call runs, as decided by plan_elementwise or plan_gemm */
+typedef struct exec_plan {
+    exec_mode mode;
+    int threads; // 1 unless mode is EXEC_PARALLEL
+    const kernel_table *kernels; // the kernels to run, scalar ones for EXEC_SERIAL
+} exec_plan;
+
+/* Number of elements each iteration of the element-wise loops hands to a kernel */
+#define ELEMENTWISE_CHUNK 4096
+
+exec_plan plan_elementwise(long entries);
+exec_plan plan_gemm(double flops);
+void get_threading(threading_config *config);
+int set_threading(const threading_config *config);
+
+#endif
@@ -0,0 +1,188 @@
+#define _POSIX_C_SOURCE 200112L // clock_gettime under -std=c99
+
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* One span; the fields are written with relaxed atomics since trace_stop may read them at any time */
+typedef struct trace_record {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+    long arg;
+} trace_record;
+
+/*
+ * The spans of one thread, a ring of `capacity` records. Only the owning thread writes it: it
+ * fills record head % capacity and then publishes it by incrementing `head`. A reader copies
+ * the records below `head` and afterwards discards the ones the owner may have overwritten
+ * meanwhile. trace_start starts a new generation; each thread empties its ring the first time
+ * it records a span of the new one, and trace_stop ignores rings of older generations.
+ */
+typedef struct trace_buffer {
+    uint64_t generation;
+    uint64_t head; // number of spans recorded in this generation
+    size_t capacity;
+    trace_record *records;
+    int tid;
+    const char *thread_name;
+    struct trace_buffer *next;
+} trace_buffer;
+
+int trace_enabled = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer *buffers = NULL; // never freed, since threads come and go during a trace
+static uint64_t generation = 0;
+static size_t capacity = TRACE_DEFAULT_EVENTS;
+static uint64_t origin; // trace_now() at trace_start
+static int next_tid = 1;
+
+static __thread trace_buffer *mine = NULL;
+static __thread const char *my_name = NULL;
+
+/* Nanoseconds on the monotonic clock, never 0 */
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+}
+
+/* Names the timeline of the calling thread in the trace */
+void trace_thread_name(const char *name) {
+    my_name = name;
+    if (mine != NULL) __atomic_store_n(&mine -> thread_name, name, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the ring of the calling thread, emptied and sized for the current generation, or
+ * NULL if there is no memory for it. The lock keeps trace_stop from reading a ring while it is
+ * being replaced.
+ */
+static trace_buffer *thread_buffer(void) {
+    trace_buffer *b = mine;
+    uint64_t gen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    if (b != NULL && b -> generation == gen) return b;
+    pthread_mutex_lock(&lock);
+    if (b == NULL) {
+        b = (trace_buffer *)calloc(1, sizeof(trace_buffer));
+        if (b == NULL) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        b -> tid = next_tid++;
+        b -> thread_name = my_name;
+        b -> next = buffers;
+        buffers = b;
+        mine = b;
+    }
+    if (b -> capacity != capacity) {
+        free(b -> records);
+        b -> records = (trace_record *)malloc(capacity * sizeof(trace_record));
+        b -> capacity = b -> records != NULL ? capacity : 0;
+    }
+    b -> head = 0;
+    b -> generation = generation;
+    pthread_mutex_unlock(&lock);
+    return b -> capacity ? b : NULL;
+}
+
+/* Records a span named `name` from `start` to now on the calling thread */
+void trace_event(const char *name, uint64_t start, long arg) {
+    uint64_t end = trace_now();
+    trace_buffer *b = thread_buffer();
+    if (b == NULL) return;
+    uint64_t head = b -> head;
+    trace_record *r = &b -> records[head % b -> capacity];
+    __atomic_store_n(&r -> name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&r -> start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&r -> dur, end - start, __ATOMIC_RELAXED);
+    __atomic_store_n(&r -> arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&b -> head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Starts a new trace, keeping the last `events_per_thread` spans of every thread */
+void trace_start(size_t events_per_thread) {
+    pthread_mutex_lock(&lock);
+    capacity = events_per_thread > 0 ? events_per_thread : 1;
+    origin = trace_now();
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lock);
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Copies the spans of `b` that are still intact into `out`, which has room for its capacity,
+ * and returns how many there are. `dropped` is increased by the number that were overwritten.
+ */
+static size_t snapshot(trace_buffer *b, trace_record *out, uint64_t *dropped) {
+    uint64_t head = __atomic_load_n(&b -> head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > b -> capacity ? head - b -> capacity : 0;
+    for (uint64_t i = first; i < head; i++) {
+        trace_record *r = &b -> records[i % b -> capacity];
+        trace_record *o = &out[i - first];
+        o -> name = __atomic_load_n(&r -> name, __ATOMIC_RELAXED);
+        o -> start = __atomic_load_n(&r -> start, __ATOMIC_RELAXED);
+        o -> dur = __atomic_load_n(&r -> dur, __ATOMIC_RELAXED);
+        o -> arg = __atomic_load_n(&r -> arg, __ATOMIC_RELAXED);
+    }
+    /* Records the owner reached while they were copied may be torn */
+    uint64_t now = __atomic_load_n(&b -> head, __ATOMIC_ACQUIRE);
+    uint64_t valid = now > b -> capacity ? now - b -> capacity : 0;
+    size_t skip = valid > first ? (size_t)(valid - first) : 0;
+    if (skip > head - first) skip = (size_t)(head - first);
+    *dropped += first + skip;
+    for (size_t i = skip; i < head - first; i++) out[i - skip] = out[i];
+    return (size_t)(head - first) - skip;
+}
+
+/*
+ * Stops tracing and writes the spans recorded since trace_start to `path` as Chrome
+ * trace-event JSON: one complete ("X") event per span, in microseconds since trace_start, and
+ * a thread_name metadata event per thread. Returns the number of spans written, or -1 with
+ * errno set if the file cannot be written.
+ */
+long trace_stop(const char *path) {
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return -1;
+    pthread_mutex_lock(&lock);
+    trace_record *copy = (trace_record *)malloc(capacity * sizeof(trace_record));
+    if (copy == NULL) {
+        pthread_mutex_unlock(&lock);
+        fclose(f);
+        errno = ENOMEM;
+        return -1;
+    }
+    long pid = (long)getpid();
+    long written = 0;
+    uint64_t dropped = 0;
+    const char *separator = "";
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (trace_buffer *b = buffers; b != NULL; b = b -> next) {
+        if (b -> generation != generation || b -> capacity != capacity) continue;
+        const char *name = __atomic_load_n(&b -> thread_name, __ATOMIC_RELAXED);
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s %d\"}}", separator, pid,
+                b -> tid, name != NULL ? name : "thread", b -> tid);
+        separator = ",\n";
+        size_t n = snapshot(b, copy, &dropped);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t start = copy[i].start > origin ? copy[i].start - origin : 0;
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %ld, \"tid\": %d, "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %ld}}", copy[i].name, pid,
+                    b -> tid, start / 1e3, copy[i].dur / 1e3, copy[i].arg);
+        }
+        written += (long)n;
+    }
+    pthread_mutex_unlock(&lock);
+    free(copy);
+    fprintf(f, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long)dropped);
+    int failed = ferror(f);
+    if (fclose(f) || failed) return -1;
+    return written;
+}
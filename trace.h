@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Span tracer. Between trace_start and trace_stop, every instrumented piece of work (kernel
+ * calls, numc.Matrix methods, allocations, the slots of the thread pool and the tiles of the
+ * parallel loops) is recorded as a span with its start and duration. Each thread writes its
+ * spans into a ring buffer of its own without locking, keeping the most recent ones if it fills
+ * up, and trace_stop writes them all as Chrome trace-event JSON, which Perfetto and
+ * chrome://tracing display as one timeline per thread. While tracing is off a span costs one
+ * predictable branch.
+ */
+
+/* Default number of spans each thread keeps */
+#define TRACE_DEFAULT_EVENTS ((size_t)1 << 16)
+
+extern int trace_enabled;
+
+uint64_t trace_now(void);
+void trace_event(const char *name, uint64_t start, long arg);
+void trace_thread_name(const char *name);
+void trace_start(size_t events_per_thread);
+long trace_stop(const char *path);
+
+/*
+ * TRACE_BEGIN declares `span` and stamps it if tracing is on; TRACE_END records the span from
+ * then to now under `name`, a string literal, with the number `arg` attached to it.
+ */
+#define TRACE_BEGIN(span) uint64_t span = trace_enabled ? trace_now() : 0
+#define TRACE_END(span, name, arg) do { if (span) trace_event(name, span, arg); } while (0)
+
+#endif